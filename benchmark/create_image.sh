@@ -0,0 +1,55 @@
+#!/bin/sh -e
+
+######################################################################
+# @author       Enno Boland (mail@eboland.de)
+# @file         create_image.sh
+#
+# @description  Creates a reproducible squashfs image for the
+#               benchmarks. The image contains a single large file
+#               at /large and a tree of small files below /tree.
+######################################################################
+
+: "${MKSQUASHFS:?MKSQUASHFS is not set}"
+
+out=$1
+tmp=$2
+compressor=$3
+block_size=$4
+file_count=$5
+fanout=$6
+large_size=$7
+
+mkdir -p "$tmp/empty"
+
+# Check if the directory is actually empty
+[ -z "$(find "$tmp/empty" -mindepth 1)" ]
+
+# The content of /large is text, so it compresses roughly like typical
+# file system content instead of being a best or worst case.
+cat > "$tmp/pf" <<EOF2
+"large" F 0 644 0 0 seq 1 1000000000 | head -c $large_size
+"tree" D 0 755 0 0
+EOF2
+
+# Files are spread over directories of $fanout entries each.
+awk -v count="$file_count" -v fanout="$fanout" 'BEGIN {
+	for (i = 0; i < count; i++) {
+		dir = int(i / fanout);
+		if (i % fanout == 0)
+			printf "\"tree/d%06i\" D 0 755 0 0\n", dir;
+		printf "\"tree/d%06i/f%08i\" F 0 644 0 0 echo %i\n", dir, i, i;
+	}
+}' >> "$tmp/pf"
+
+[ -e "$tmp/image" ] && rm "$tmp/image"
+$MKSQUASHFS "$tmp/empty" "$tmp/image" \
+	-pf "$tmp/pf" \
+	-comp "$compressor" \
+	-b "$block_size" \
+	-noappend \
+	-no-xattrs \
+	-mkfs-time 0 \
+	-all-time 0 \
+	-quiet -no-progress
+
+mv "$tmp/image" "$out"
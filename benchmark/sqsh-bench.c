@@ -0,0 +1,457 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         sqsh-bench.c
+ *
+ * Micro benchmarks for the hot paths of libsqsh. Every run prints a single
+ * JSON object per line to stdout so results can be collected and compared
+ * by scripts.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <sqsh.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_RANDOM_READ_SIZE 4096
+#define BENCH_RANDOM_READ_COUNT 2048
+#define BENCH_LARGE_FILE "/large"
+#define BENCH_TREE_DIR "/tree"
+
+struct BenchResult {
+	uint64_t ops;
+	uint64_t bytes;
+};
+
+typedef int (*bench_func_t)(
+		struct SqshArchive *archive, const char *image,
+		struct BenchResult *result);
+
+static uint64_t
+now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t
+xorshift64(uint64_t *state) {
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+static int
+bench_read_seq(
+		struct SqshArchive *archive, const char *image,
+		struct BenchResult *result) {
+	(void)image;
+	int rv = 0;
+	struct SqshFileIterator *iterator = NULL;
+	struct SqshFile *file = sqsh_open(archive, BENCH_LARGE_FILE, &rv);
+	if (rv < 0) {
+		goto out;
+	}
+	iterator = sqsh_file_iterator_new(file, &rv);
+	if (rv < 0) {
+		goto out;
+	}
+	while (sqsh_file_iterator_next(iterator, SIZE_MAX, &rv)) {
+		result->bytes += sqsh_file_iterator_size(iterator);
+		result->ops++;
+	}
+
+out:
+	sqsh_file_iterator_free(iterator);
+	sqsh_close(file);
+	return rv;
+}
+
+static int
+bench_read_random(
+		struct SqshArchive *archive, const char *image,
+		struct BenchResult *result) {
+	(void)image;
+	int rv = 0;
+	uint64_t seed = 0x5eed5eed5eed5eedULL;
+	struct SqshFile *file = sqsh_open(archive, BENCH_LARGE_FILE, &rv);
+	if (rv < 0) {
+		goto out;
+	}
+	const uint64_t file_size = sqsh_file_size(file);
+	if (file_size < BENCH_RANDOM_READ_SIZE) {
+		rv = -SQSH_ERROR_OUT_OF_BOUNDS;
+		goto out;
+	}
+	const uint64_t range = file_size - BENCH_RANDOM_READ_SIZE + 1;
+
+	for (size_t i = 0; i < BENCH_RANDOM_READ_COUNT; i++) {
+		const uint64_t offset = xorshift64(&seed) % range;
+		struct SqshFileReader *reader = sqsh_file_reader_new(file, &rv);
+		if (rv < 0) {
+			goto out;
+		}
+		rv = sqsh_file_reader_advance2(
+				reader, offset, BENCH_RANDOM_READ_SIZE);
+		if (rv == 0) {
+			result->bytes += sqsh_file_reader_size(reader);
+			result->ops++;
+		}
+		sqsh_file_reader_free(reader);
+		if (rv < 0) {
+			goto out;
+		}
+	}
+
+out:
+	sqsh_close(file);
+	return rv;
+}
+
+static int
+collect_paths(
+		struct SqshArchive *archive, bool directories, char ***paths,
+		size_t *count) {
+	int rv = 0;
+	size_t capacity = 0;
+	struct SqshTreeTraversal *traversal = NULL;
+	struct SqshFile *file = sqsh_open(archive, BENCH_TREE_DIR, &rv);
+	if (rv < 0) {
+		goto out;
+	}
+	traversal = sqsh_tree_traversal_new(file, &rv);
+	if (rv < 0) {
+		goto out;
+	}
+
+	*paths = NULL;
+	*count = 0;
+	while (sqsh_tree_traversal_next(traversal, &rv)) {
+		const enum SqshFileType type = sqsh_tree_traversal_type(traversal);
+		const enum SqshTreeTraversalState state =
+				sqsh_tree_traversal_state(traversal);
+		if (directories) {
+			if (state != SQSH_TREE_TRAVERSAL_STATE_DIRECTORY_BEGIN) {
+				continue;
+			}
+		} else if (type == SQSH_FILE_TYPE_DIRECTORY) {
+			continue;
+		}
+
+		if (*count == capacity) {
+			capacity = capacity ? capacity * 2 : 1024;
+			char **new_paths = realloc(*paths, capacity * sizeof(char *));
+			if (new_paths == NULL) {
+				rv = -SQSH_ERROR_MALLOC_FAILED;
+				goto out;
+			}
+			*paths = new_paths;
+		}
+		char *segment = sqsh_tree_traversal_path_dup(traversal);
+		if (segment == NULL) {
+			rv = -SQSH_ERROR_MALLOC_FAILED;
+			goto out;
+		}
+		/* The traversal paths are relative to BENCH_TREE_DIR. */
+		char *path = malloc(strlen(BENCH_TREE_DIR) + strlen(segment) + 2);
+		if (path == NULL) {
+			free(segment);
+			rv = -SQSH_ERROR_MALLOC_FAILED;
+			goto out;
+		}
+		sprintf(path, "%s/%s", BENCH_TREE_DIR, segment);
+		free(segment);
+		(*paths)[(*count)++] = path;
+	}
+
+out:
+	sqsh_tree_traversal_free(traversal);
+	sqsh_close(file);
+	return rv;
+}
+
+static void
+free_paths(char **paths, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		free(paths[i]);
+	}
+	free(paths);
+}
+
+static int
+bench_resolve(
+		struct SqshArchive *archive, const char *image,
+		struct BenchResult *result) {
+	(void)image;
+	char **paths = NULL;
+	size_t count = 0;
+	uint64_t seed = 0x0123456789abcdefULL;
+	int rv = collect_paths(archive, false, &paths, &count);
+	if (rv < 0 || count == 0) {
+		goto out;
+	}
+
+	/* Resolve in a shuffled order to defeat any locality in the caches. */
+	for (size_t i = count - 1; i > 0; i--) {
+		const size_t j = xorshift64(&seed) % (i + 1);
+		char *tmp = paths[i];
+		paths[i] = paths[j];
+		paths[j] = tmp;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		struct SqshFile *file = sqsh_open(archive, paths[i], &rv);
+		if (rv < 0) {
+			goto out;
+		}
+		sqsh_close(file);
+		result->ops++;
+	}
+
+out:
+	free_paths(paths, count);
+	return rv;
+}
+
+static int
+bench_ls(
+		struct SqshArchive *archive, const char *image,
+		struct BenchResult *result) {
+	(void)image;
+	char **paths = NULL;
+	size_t count = 0;
+	int rv = collect_paths(archive, true, &paths, &count);
+	if (rv < 0) {
+		goto out;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		struct SqshDirectoryIterator *iterator = NULL;
+		struct SqshFile *file = sqsh_open(archive, paths[i], &rv);
+		if (rv < 0) {
+			goto out;
+		}
+		iterator = sqsh_directory_iterator_new(file, &rv);
+		if (rv == 0) {
+			while (sqsh_directory_iterator_next(iterator, &rv)) {
+				result->ops++;
+			}
+		}
+		sqsh_directory_iterator_free(iterator);
+		sqsh_close(file);
+		if (rv < 0) {
+			goto out;
+		}
+	}
+
+out:
+	free_paths(paths, count);
+	return rv;
+}
+
+static int
+bench_traverse(
+		struct SqshArchive *archive, const char *image,
+		struct BenchResult *result) {
+	(void)image;
+	int rv = 0;
+	struct SqshTreeTraversal *traversal = NULL;
+	const struct SqshSuperblock *superblock = sqsh_archive_superblock(archive);
+	struct SqshFile *file = sqsh_open_by_ref(
+			archive, sqsh_superblock_inode_root_ref(superblock), &rv);
+	if (rv < 0) {
+		goto out;
+	}
+	traversal = sqsh_tree_traversal_new(file, &rv);
+	if (rv < 0) {
+		goto out;
+	}
+	while (sqsh_tree_traversal_next(traversal, &rv)) {
+		result->ops++;
+	}
+
+out:
+	sqsh_tree_traversal_free(traversal);
+	sqsh_close(file);
+	return rv;
+}
+
+static const struct {
+	const char *name;
+	bench_func_t func;
+} benchmarks[] = {
+		{"read-seq", bench_read_seq}, {"read-random", bench_read_random},
+		{"resolve", bench_resolve},   {"ls", bench_ls},
+		{"traverse", bench_traverse},
+};
+
+static const char *
+basename_of(const char *path) {
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+static void
+print_result(
+		const char *name, const char *image, unsigned int runs,
+		const struct BenchResult *result, uint64_t total_ns,
+		uint64_t best_ns) {
+	printf("{\"benchmark\":\"%s\",\"image\":\"%s\",\"runs\":%u,"
+		   "\"ops\":%llu,\"bytes\":%llu,\"seconds\":%.9f,"
+		   "\"best_seconds\":%.9f}\n",
+		   name, basename_of(image), runs, (unsigned long long)result->ops,
+		   (unsigned long long)result->bytes, (double)total_ns / 1e9,
+		   (double)best_ns / 1e9);
+	fflush(stdout);
+}
+
+static int
+run_exec(const char *image, unsigned int runs, char *argv[]) {
+	struct BenchResult result = {0};
+	uint64_t total_ns = 0;
+	uint64_t best_ns = UINT64_MAX;
+
+	for (unsigned int i = 0; i < runs; i++) {
+		int status;
+		const uint64_t start = now_ns();
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return EXIT_FAILURE;
+		} else if (pid == 0) {
+			execv(argv[0], argv);
+			perror(argv[0]);
+			_exit(127);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			perror("waitpid");
+			return EXIT_FAILURE;
+		}
+		const uint64_t elapsed = now_ns() - start;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "%s failed\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		total_ns += elapsed;
+		best_ns = elapsed < best_ns ? elapsed : best_ns;
+		result.ops++;
+	}
+	print_result(basename_of(argv[0]), image, runs, &result, total_ns, best_ns);
+	return EXIT_SUCCESS;
+}
+
+static int
+run_benchmark(
+		const char *name, bench_func_t func, const char *image,
+		unsigned int runs) {
+	int rv = 0;
+	struct BenchResult result = {0};
+	uint64_t total_ns = 0;
+	uint64_t best_ns = UINT64_MAX;
+
+	for (unsigned int i = 0; i < runs; i++) {
+		/* Every run opens the archive again to start with cold caches. */
+		struct SqshArchive *archive = sqsh_archive_open(image, NULL, &rv);
+		if (rv < 0) {
+			sqsh_perror(rv, "sqsh_archive_open");
+			return EXIT_FAILURE;
+		}
+		const uint64_t start = now_ns();
+		rv = func(archive, image, &result);
+		const uint64_t elapsed = now_ns() - start;
+		sqsh_archive_close(archive);
+		if (rv < 0) {
+			sqsh_perror(rv, name);
+			return EXIT_FAILURE;
+		}
+		total_ns += elapsed;
+		best_ns = elapsed < best_ns ? elapsed : best_ns;
+	}
+	print_result(name, image, runs, &result, total_ns, best_ns);
+	return EXIT_SUCCESS;
+}
+
+static int
+usage(const char *arg0) {
+	fprintf(stderr, "Usage: %s [-r RUNS] BENCHMARK IMAGE\n", arg0);
+	fprintf(stderr, "       %s [-r RUNS] exec IMAGE COMMAND [ARGS...]\n", arg0);
+	fputs("Benchmarks:", stderr);
+	for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+		fprintf(stderr, " %s", benchmarks[i].name);
+	}
+	fputc('\n', stderr);
+	return EXIT_FAILURE;
+}
+
+int
+main(int argc, char *argv[]) {
+	int opt;
+	unsigned int runs = 3;
+
+	while ((opt = getopt(argc, argv, "+r:")) != -1) {
+		switch (opt) {
+		case 'r':
+			runs = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (runs == 0 || argc - optind < 2) {
+		return usage(argv[0]);
+	}
+
+	const char *name = argv[optind];
+	const char *image = argv[optind + 1];
+	if (strcmp(name, "exec") == 0) {
+		if (argc - optind < 3) {
+			return usage(argv[0]);
+		}
+		return run_exec(image, runs, &argv[optind + 2]);
+	}
+
+	for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+		if (strcmp(name, benchmarks[i].name) == 0) {
+			return run_benchmark(name, benchmarks[i].func, image, runs);
+		}
+	}
+	return usage(argv[0]);
+}
@@ -0,0 +1,20 @@
+#!/bin/sh -e
+
+######################################################################
+# @author       Enno Boland (mail@eboland.de)
+# @file         unpack.sh
+#
+# @description  Measures the wall time of sqsh-unpack extracting a
+#               whole image.
+######################################################################
+
+: "${SQSH_BENCH:?SQSH_BENCH is not set}"
+: "${SQSH_UNPACK:?SQSH_UNPACK is not set}"
+
+image=$1
+work_dir=$2
+
+rm -rf "$work_dir"
+mkdir -p "$work_dir"
+
+exec "$SQSH_BENCH" exec "$image" "$SQSH_UNPACK" "$image" / "$work_dir"
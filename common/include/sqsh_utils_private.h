@@ -35,6 +35,7 @@
 #define SQSH_THREAD_PRIVATE_H
 
 #include <pthread.h>
+#include <stdbool.h>
 
 #include "sqsh_common.h"
 
@@ -80,6 +81,32 @@ sqsh__mutex_init_recursive(sqsh__mutex_t *mutex);
  */
 SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__mutex_lock(sqsh__mutex_t *mutex);
 
+/**
+ * @brief sqsh__mutex_trylock locks a mutex if it is not held by another
+ * thread.
+ *
+ * @param mutex the mutex to lock.
+ *
+ * @return 0 if the mutex was locked, 1 if it is held by another thread,
+ * less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__mutex_trylock(sqsh__mutex_t *mutex);
+
+/**
+ * @brief sqsh__mutex_lock_counted locks a mutex like sqsh__mutex_lock and
+ * accounts for contention. If the mutex is already held by another thread,
+ * `contentions` is incremented by one and the time spent waiting for the
+ * mutex is added to `wait_ns`. Both counters are updated atomically.
+ *
+ * @param mutex the mutex to lock.
+ * @param contentions the counter of contended lock attempts.
+ * @param wait_ns the counter of nanoseconds spent waiting.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__mutex_lock_counted(
+		sqsh__mutex_t *mutex, uint64_t *contentions, uint64_t *wait_ns);
+
 /**
  * @brief sqsh__mutex_lock unlocks a mutex.
  *
@@ -98,6 +125,257 @@ SQSH_NO_EXPORT int sqsh__mutex_unlock(sqsh__mutex_t *mutex);
  */
 SQSH_NO_EXPORT int sqsh__mutex_destroy(sqsh__mutex_t *mutex);
 
+/**
+ * @brief sqsh__cond_t represents a condition variable.
+ */
+typedef pthread_cond_t sqsh__cond_t;
+
+/**
+ * @brief sqsh__cond_init initializes a condition variable.
+ *
+ * @param cond the condition variable to initialize.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__cond_init(sqsh__cond_t *cond);
+
+/**
+ * @brief sqsh__cond_wait waits on a condition variable. The mutex must be
+ * locked by the caller and is locked again when this function returns.
+ *
+ * @param cond the condition variable to wait on.
+ * @param mutex the mutex protecting the condition.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int
+sqsh__cond_wait(sqsh__cond_t *cond, sqsh__mutex_t *mutex);
+
+/**
+ * @brief sqsh__cond_broadcast wakes up all threads waiting on a condition
+ * variable.
+ *
+ * @param cond the condition variable to signal.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT int sqsh__cond_broadcast(sqsh__cond_t *cond);
+
+/**
+ * @brief sqsh__cond_destroy destroys a condition variable.
+ *
+ * @param cond the condition variable to destroy.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT int sqsh__cond_destroy(sqsh__cond_t *cond);
+
+/***************************************
+ * utils/cache_budget.c
+ */
+
+/**
+ * @brief An entry that is accounted for in a cache budget. It is embedded
+ * in the values of a cache.
+ */
+struct SqshCacheBudgetEntry {
+	/**
+	 * @privatesection
+	 */
+	struct SqshCacheBudgetEntry *prev;
+	struct SqshCacheBudgetEntry *next;
+	uint64_t index;
+	bool linked;
+};
+
+struct SqshCacheBudgetList;
+
+/**
+ * @brief Evicts the least recently used entry of a list.
+ *
+ * @return 1 if an entry was evicted, 0 if the list was empty, less than 0 on
+ * error.
+ */
+typedef int (*sqsh_cache_budget_evict_t)(struct SqshCacheBudgetList *list);
+
+/**
+ * @brief The entries of one cache that can be evicted to stay within a
+ * budget, ordered from the most to the least recently used. The list is
+ * protected by the lock of the cache owning it.
+ */
+struct SqshCacheBudgetList {
+	/**
+	 * @privatesection
+	 */
+	struct SqshCacheBudget *budget;
+	struct SqshCacheBudgetEntry *head;
+	struct SqshCacheBudgetEntry *tail;
+	sqsh_cache_budget_evict_t evict;
+	struct SqshCacheBudgetList *next_list;
+};
+
+/**
+ * @brief A limit of bytes shared between multiple caches.
+ */
+struct SqshCacheBudget {
+	/**
+	 * @privatesection
+	 */
+	uint64_t max_bytes;
+	uint64_t used_bytes;
+	sqsh__mutex_t lock;
+	struct SqshCacheBudgetList *lists;
+	size_t list_count;
+	struct SqshCacheBudgetList *cursor;
+};
+
+/**
+ * @brief sqsh__cache_budget_init initializes a cache budget.
+ *
+ * @param budget the budget to initialize.
+ * @param max_bytes the number of bytes all caches together may hold.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int
+sqsh__cache_budget_init(struct SqshCacheBudget *budget, uint64_t max_bytes);
+
+/**
+ * @brief sqsh__cache_budget_register adds the list of a cache to the
+ * budget, so it can be evicted from when the budget is exceeded.
+ *
+ * @param budget the budget.
+ * @param list the list to initialize and register.
+ * @param evict the callback evicting the least recently used entry of the
+ * list.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__cache_budget_register(
+		struct SqshCacheBudget *budget, struct SqshCacheBudgetList *list,
+		sqsh_cache_budget_evict_t evict);
+
+/**
+ * @brief sqsh__cache_budget_unregister removes the list of a cache from its
+ * budget. Waits for a running eviction, so once this returns the list is no
+ * longer evicted from and its remaining entries can be popped.
+ *
+ * @param list the list to unregister.
+ */
+SQSH_NO_EXPORT void
+sqsh__cache_budget_unregister(struct SqshCacheBudgetList *list);
+
+/**
+ * @brief sqsh__cache_budget_charge accounts for a new value of `size` bytes.
+ *
+ * @param budget the budget.
+ * @param size the size of the value.
+ */
+SQSH_NO_EXPORT void
+sqsh__cache_budget_charge(struct SqshCacheBudget *budget, size_t size);
+
+/**
+ * @brief sqsh__cache_budget_uncharge accounts for a freed value of `size`
+ * bytes.
+ *
+ * @param budget the budget.
+ * @param size the size of the value.
+ */
+SQSH_NO_EXPORT void
+sqsh__cache_budget_uncharge(struct SqshCacheBudget *budget, size_t size);
+
+/**
+ * @brief sqsh__cache_budget_list_touch marks an entry as the most recently
+ * used one. The caller must hold the lock of the cache.
+ *
+ * @param list the list.
+ * @param entry the entry.
+ * @param index the index of the entry in the cache.
+ *
+ * @return true if the entry was not part of the list before. The caller
+ * must then retain the value on behalf of the list.
+ */
+SQSH_NO_EXPORT bool sqsh__cache_budget_list_touch(
+		struct SqshCacheBudgetList *list, struct SqshCacheBudgetEntry *entry,
+		uint64_t index);
+
+/**
+ * @brief sqsh__cache_budget_list_pop removes the least recently used entry
+ * from the list. The caller must hold the lock of the cache and release the
+ * value on behalf of the list.
+ *
+ * @param list the list.
+ *
+ * @return the entry or NULL if the list is empty.
+ */
+SQSH_NO_EXPORT struct SqshCacheBudgetEntry *
+sqsh__cache_budget_list_pop(struct SqshCacheBudgetList *list);
+
+/**
+ * @brief sqsh__cache_budget_list_remove removes an entry from the list, so
+ * it is no longer evicted. The caller must hold the lock of the cache.
+ *
+ * @param list the list.
+ * @param entry the entry.
+ *
+ * @return true if the entry was part of the list. The caller must then
+ * release the value on behalf of the list.
+ */
+SQSH_NO_EXPORT bool sqsh__cache_budget_list_remove(
+		struct SqshCacheBudgetList *list, struct SqshCacheBudgetEntry *entry);
+
+/**
+ * @brief sqsh__cache_budget_enforce evicts entries from the registered lists
+ * until the budget is met or no list has anything left to evict. The caller
+ * must not hold the lock of any cache.
+ *
+ * @param budget the budget.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT int sqsh__cache_budget_enforce(struct SqshCacheBudget *budget);
+
+/**
+ * @brief sqsh__cache_budget_cleanup cleans up a cache budget.
+ *
+ * @param budget the budget to clean up.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT int sqsh__cache_budget_cleanup(struct SqshCacheBudget *budget);
+
+/***************************************
+ * utils/hash.c
+ */
+
+/**
+ * @brief The initial value for sqsh__hash_fnv1a().
+ */
+#define SQSH_HASH_FNV1A_INIT UINT64_C(0xcbf29ce484222325)
+
+/**
+ * @brief sqsh__hash_fnv1a feeds data into a 64 bit FNV-1a hash.
+ *
+ * @param hash the hash to continue, or SQSH_HASH_FNV1A_INIT to start a new
+ * one.
+ * @param data the data to hash.
+ * @param size the size of the data.
+ *
+ * @return the updated hash.
+ */
+SQSH_NO_EXPORT uint64_t
+sqsh__hash_fnv1a(uint64_t hash, const void *data, size_t size);
+
+/**
+ * @brief sqsh__hash_mix spreads the bits of an integer key, so that keys
+ * that only differ in their upper bits can be used to index a table.
+ *
+ * @param value the value to mix.
+ *
+ * @return the mixed value. Only the lower 32 bits are significant.
+ */
+SQSH_NO_EXPORT uint64_t sqsh__hash_mix(uint64_t value);
+
 /***************************************
  * utils/math.c
  */
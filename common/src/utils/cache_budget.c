@@ -0,0 +1,225 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         cache_budget.c
+ */
+
+#include <sqsh_utils_private.h>
+
+#include <sqsh_error.h>
+
+#include <assert.h>
+#include <string.h>
+
+static void
+lock_budget(struct SqshCacheBudget *budget) {
+	int rv = sqsh__mutex_lock(&budget->lock);
+	assert(rv == 0);
+	(void)rv;
+}
+
+int
+sqsh__cache_budget_init(struct SqshCacheBudget *budget, uint64_t max_bytes) {
+	memset(budget, 0, sizeof(*budget));
+	budget->max_bytes = max_bytes;
+	return sqsh__mutex_init(&budget->lock);
+}
+
+int
+sqsh__cache_budget_register(
+		struct SqshCacheBudget *budget, struct SqshCacheBudgetList *list,
+		sqsh_cache_budget_evict_t evict) {
+	int rv = sqsh__mutex_lock(&budget->lock);
+	if (rv < 0) {
+		return rv;
+	}
+	list->budget = budget;
+	list->head = list->tail = NULL;
+	list->evict = evict;
+	list->next_list = budget->lists;
+	budget->lists = list;
+	budget->list_count++;
+	sqsh__mutex_unlock(&budget->lock);
+	return 0;
+}
+
+void
+sqsh__cache_budget_unregister(struct SqshCacheBudgetList *list) {
+	struct SqshCacheBudget *budget = list->budget;
+	if (budget == NULL) {
+		return;
+	}
+
+	// Other caches may still be enforcing the budget. The list must not be
+	// torn down while an eviction runs on it.
+	lock_budget(budget);
+	for (struct SqshCacheBudgetList **p = &budget->lists; *p != NULL;
+		 p = &(*p)->next_list) {
+		if (*p == list) {
+			*p = list->next_list;
+			budget->list_count--;
+			break;
+		}
+	}
+	if (budget->cursor == list) {
+		budget->cursor = NULL;
+	}
+	list->next_list = NULL;
+	list->budget = NULL;
+	sqsh__mutex_unlock(&budget->lock);
+}
+
+void
+sqsh__cache_budget_charge(struct SqshCacheBudget *budget, size_t size) {
+	__atomic_fetch_add(&budget->used_bytes, size, __ATOMIC_RELAXED);
+}
+
+void
+sqsh__cache_budget_uncharge(struct SqshCacheBudget *budget, size_t size) {
+	__atomic_fetch_sub(&budget->used_bytes, size, __ATOMIC_RELAXED);
+}
+
+static void
+list_unlink(
+		struct SqshCacheBudgetList *list, struct SqshCacheBudgetEntry *entry) {
+	if (entry->prev != NULL) {
+		entry->prev->next = entry->next;
+	} else {
+		list->head = entry->next;
+	}
+	if (entry->next != NULL) {
+		entry->next->prev = entry->prev;
+	} else {
+		list->tail = entry->prev;
+	}
+	entry->prev = entry->next = NULL;
+	entry->linked = false;
+}
+
+bool
+sqsh__cache_budget_list_touch(
+		struct SqshCacheBudgetList *list, struct SqshCacheBudgetEntry *entry,
+		uint64_t index) {
+	const bool is_new = !entry->linked;
+
+	if (list->head == entry) {
+		return false;
+	} else if (entry->linked) {
+		list_unlink(list, entry);
+	}
+
+	entry->index = index;
+	entry->prev = NULL;
+	entry->next = list->head;
+	if (list->head != NULL) {
+		list->head->prev = entry;
+	} else {
+		list->tail = entry;
+	}
+	list->head = entry;
+	entry->linked = true;
+
+	return is_new;
+}
+
+struct SqshCacheBudgetEntry *
+sqsh__cache_budget_list_pop(struct SqshCacheBudgetList *list) {
+	struct SqshCacheBudgetEntry *entry = list->tail;
+	if (entry != NULL) {
+		list_unlink(list, entry);
+	}
+	return entry;
+}
+
+bool
+sqsh__cache_budget_list_remove(
+		struct SqshCacheBudgetList *list, struct SqshCacheBudgetEntry *entry) {
+	if (!entry->linked) {
+		return false;
+	}
+	list_unlink(list, entry);
+	return true;
+}
+
+static bool
+is_exceeded(const struct SqshCacheBudget *budget) {
+	return __atomic_load_n(&budget->used_bytes, __ATOMIC_RELAXED) >
+			budget->max_bytes;
+}
+
+int
+sqsh__cache_budget_enforce(struct SqshCacheBudget *budget) {
+	int rv = 0;
+	size_t idle = 0;
+
+	if (!is_exceeded(budget)) {
+		return 0;
+	}
+	rv = sqsh__mutex_lock(&budget->lock);
+	if (rv < 0) {
+		return rv;
+	}
+	const size_t count = budget->list_count;
+	struct SqshCacheBudgetList *list = budget->cursor;
+
+	// Evict from the lists in turns, continuing where the last call stopped.
+	// Every list is ordered by recency, so this drops the least recently
+	// used entries of all caches evenly. Stop once every list came up empty
+	// in a row: the remaining bytes are held by users of the caches and are
+	// freed as soon as they are released.
+	while (idle < count && is_exceeded(budget)) {
+		if (list == NULL || list->next_list == NULL) {
+			list = budget->lists;
+		} else {
+			list = list->next_list;
+		}
+		rv = list->evict(list);
+		if (rv < 0) {
+			goto out;
+		}
+		idle = rv == 0 ? idle + 1 : 0;
+	}
+	rv = 0;
+
+out:
+	if (list != NULL) {
+		budget->cursor = list;
+	}
+	sqsh__mutex_unlock(&budget->lock);
+	return rv;
+}
+
+int
+sqsh__cache_budget_cleanup(struct SqshCacheBudget *budget) {
+	budget->lists = NULL;
+	budget->cursor = NULL;
+	budget->list_count = 0;
+	return sqsh__mutex_destroy(&budget->lock);
+}
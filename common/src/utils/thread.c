@@ -40,6 +40,7 @@
 #include <errno.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <time.h>
 
 int
 sqsh__mutex_init(sqsh__mutex_t *mutex) {
@@ -81,6 +82,43 @@ sqsh__mutex_lock(sqsh__mutex_t *mutex) {
 	}
 }
 
+int
+sqsh__mutex_trylock(sqsh__mutex_t *mutex) {
+	int rv = pthread_mutex_trylock(mutex);
+	if (rv == EBUSY) {
+		return 1;
+	} else if (rv != 0) {
+		return -SQSH_ERROR_MUTEX_LOCK_FAILED;
+	} else {
+		return 0;
+	}
+}
+
+int
+sqsh__mutex_lock_counted(
+		sqsh__mutex_t *mutex, uint64_t *contentions, uint64_t *wait_ns) {
+	struct timespec start, end;
+	int rv = pthread_mutex_trylock(mutex);
+	if (rv == 0) {
+		return 0;
+	} else if (rv != EBUSY) {
+		return -SQSH_ERROR_MUTEX_LOCK_FAILED;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	rv = pthread_mutex_lock(mutex);
+	if (rv != 0) {
+		return -SQSH_ERROR_MUTEX_LOCK_FAILED;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	const int64_t elapsed = (int64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+			(end.tv_nsec - start.tv_nsec);
+	__atomic_fetch_add(contentions, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(wait_ns, (uint64_t)elapsed, __ATOMIC_RELAXED);
+	return 0;
+}
+
 int
 sqsh__mutex_unlock(sqsh__mutex_t *mutex) {
 	int rv = pthread_mutex_unlock(mutex);
@@ -100,3 +138,42 @@ sqsh__mutex_destroy(sqsh__mutex_t *mutex) {
 		return 0;
 	}
 }
+
+int
+sqsh__cond_init(sqsh__cond_t *cond) {
+	int rv = pthread_cond_init(cond, NULL);
+	if (rv != 0) {
+		return -SQSH_ERROR_MUTEX_INIT_FAILED;
+	}
+	return 0;
+}
+
+int
+sqsh__cond_wait(sqsh__cond_t *cond, sqsh__mutex_t *mutex) {
+	int rv = pthread_cond_wait(cond, mutex);
+	if (rv != 0) {
+		return -SQSH_ERROR_MUTEX_LOCK_FAILED;
+	} else {
+		return 0;
+	}
+}
+
+int
+sqsh__cond_broadcast(sqsh__cond_t *cond) {
+	int rv = pthread_cond_broadcast(cond);
+	if (rv != 0) {
+		return -SQSH_ERROR_MUTEX_LOCK_FAILED;
+	} else {
+		return 0;
+	}
+}
+
+int
+sqsh__cond_destroy(sqsh__cond_t *cond) {
+	int rv = pthread_cond_destroy(cond);
+	if (rv != 0) {
+		return -SQSH_ERROR_MUTEX_DESTROY_FAILED;
+	} else {
+		return 0;
+	}
+}
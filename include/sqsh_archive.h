@@ -399,6 +399,11 @@ struct SqshConfig {
 	 *
 	 * - `sqsh_mapper_impl_mmap`: the archive will be loaded from a file. The
 	 *    source will be interpreted as a file path. this is the default.
+	 * - `sqsh_mapper_impl_mmap_full`: like `sqsh_mapper_impl_mmap`, but the
+	 *    whole file is mapped once when the archive is opened.
+	 * - `sqsh_mapper_impl_uring`: the archive will be read from a file with
+	 *    io_uring or `pread()`. The source will be interpreted as a file
+	 *    path.
 	 * - `sqsh_mapper_impl_static`: the archive will be interpreted from a
 	 *    static buffer.
 	 * - `sqsh_mapper_impl_curl`: the archive will be loaded from a remote
@@ -452,12 +457,161 @@ struct SqshConfig {
 	 */
 	int metablock_lru_size;
 
+	/**
+	 * @brief the maximum number of bytes the caches of the archive may hold
+	 * together. The budget is shared by the mapped chunks of the source, the
+	 * decompressed metablocks, including the ones kept by the id, export,
+	 * fragment and xattr tables, and the decompressed data and fragment
+	 * blocks.
+	 * When it is exceeded, the least recently used entries are evicted based
+	 * on their actual size.
+	 *
+	 * If set, `mapper_lru_size`, `data_lru_size` and `metablock_lru_size`
+	 * are ignored. Blocks that are currently referenced by readers or
+	 * iterators cannot be evicted and may push the memory use above the
+	 * budget until they are released. If unset or 0, the caches are only
+	 * limited by their entry counts.
+	 */
+	uint64_t max_cache_bytes;
+
+	/**
+	 * @brief the number of shards the mapper, metablock and data caches are
+	 * each split into. Every shard has its own lock, so threads working on
+	 * different blocks rarely wait for each other. The LRU sizes are divided
+	 * evenly between the shards. If unset or 0, each cache consists of a
+	 * single shard.
+	 */
+	int cache_shards;
+
+	/**
+	 * @brief a directory in which `sqsh_mapper_impl_curl` keeps downloaded
+	 * blocks across runs. The directory may be shared by several archives
+	 * and processes. Blocks are only reused as long as the remote file
+	 * reports the same modification time. If unset, blocks are only kept in
+	 * memory.
+	 */
+	const char *curl_cache_dir;
+
+	/**
+	 * @brief the maximum number of bytes stored in `curl_cache_dir`. When
+	 * it is exceeded, the least recently used blocks are removed. If unset
+	 * or 0, the limit defaults to 256 MiB.
+	 */
+	uint64_t curl_cache_max_bytes;
+
+	/**
+	 * @brief if set to a non-zero value, the metadata of the archive, from
+	 * the start of the inode table to the end of the archive, is loaded
+	 * while the archive is opened and kept in the mapper cache until it is
+	 * closed. This saves many small reads on remote or slow sources when
+	 * the archive is traversed later. The prefetched metadata is not
+	 * counted against `max_cache_bytes`.
+	 */
+	int prefetch_metadata;
+
+	/**
+	 * @brief the number of directories whose names are kept in hash tables
+	 * to answer lookups by name without scanning the directory listing. The
+	 * tables are built on the first lookup in a directory and hold a copy of
+	 * the listing. If `max_cache_bytes` is set, the tables are counted
+	 * against it and evicted like the other caches. If unset or 0, the
+	 * tables of 16 directories are kept. if set to -1, the cache will be
+	 * disabled.
+	 */
+	int directory_cache_size;
+
+	/**
+	 * @brief the minimum size in bytes of a directory listing for its names
+	 * to be kept in `directory_cache_size`. Smaller directories are scanned
+	 * on every lookup. If unset or 0, the minimum size defaults to 8192
+	 * bytes, the size of a single metablock.
+	 */
+	uint64_t directory_cache_min_size;
+
+	/**
+	 * @brief the number of paths whose resolved inodes are kept by
+	 * `sqsh_open()` and `sqsh_lopen()`. Paths that do not exist are cached as
+	 * well. The directories on the way to a path are added too, so lookups
+	 * of other paths below them skip the directories above. Paths are cached
+	 * as given, apart from leading slashes, so spellings like `a//b` and
+	 * `a/./b` take separate entries. If unset or 0, paths are not cached.
+	 */
+	int path_cache_size;
+
+	/**
+	 * @brief the number of inodes whose attributes are kept for
+	 * `sqsh_file_stat()`. If unset or 0, 256 inodes are kept. if set to -1,
+	 * the cache will be disabled.
+	 */
+	int file_stat_cache_size;
+
 	/**
 	 * @privatesection
 	 */
 	char _reserved[128];
 };
 
+/**
+ * @brief Counters of one cache layer of an archive. All counters start at
+ * 0 when the archive is opened and are only ever incremented.
+ */
+struct SqshCacheStats {
+	/**
+	 * @brief number of lookups that were answered from the cache.
+	 */
+	uint64_t hits;
+	/**
+	 * @brief number of lookups that had to map or decompress the block.
+	 */
+	uint64_t misses;
+	/**
+	 * @brief number of blocks that were dropped from the cache.
+	 */
+	uint64_t evictions;
+	/**
+	 * @brief number of bytes read from the layer below to fill the cache.
+	 */
+	uint64_t bytes_in;
+	/**
+	 * @brief number of bytes stored in the cache. For decompressing caches
+	 * this is the decompressed size.
+	 */
+	uint64_t bytes_out;
+	/**
+	 * @brief number of times a thread had to wait for the cache lock.
+	 */
+	uint64_t lock_contentions;
+	/**
+	 * @brief nanoseconds threads spent waiting for the cache lock.
+	 */
+	uint64_t lock_wait_ns;
+};
+
+/**
+ * @brief Runtime statistics of an archive.
+ */
+struct SqshArchiveStats {
+	/**
+	 * @brief the compression algorithm the byte counters of the metablock and
+	 * data caches refer to.
+	 */
+	enum SqshSuperblockCompressionId compression_id;
+	/**
+	 * @brief the cache of mapped chunks of the archive source. If the mapper
+	 * maps the whole source at once, the single mapping is counted as one
+	 * miss and lookups of it are not counted.
+	 */
+	struct SqshCacheStats mapper;
+	/**
+	 * @brief the cache of decompressed metablocks.
+	 */
+	struct SqshCacheStats metablock;
+	/**
+	 * @brief the cache of decompressed data and fragment blocks.
+	 */
+	struct SqshCacheStats data;
+};
+
 /**
  * @brief The Sqsh struct contains all information about the current
  * sqsh session.
@@ -579,6 +733,21 @@ SQSH_NO_UNUSED int sqsh_archive_fragment_table(
 SQSH_NO_UNUSED int sqsh_archive_xattr_table(
 		struct SqshArchive *archive, struct SqshXattrTable **xattr_table);
 
+/**
+ * @memberof SqshArchive
+ * @brief Retrieves a snapshot of the cache and decompression counters of an
+ * archive. The counters are updated without synchronizing them with each
+ * other, so a snapshot taken while other threads use the archive may be
+ * slightly inconsistent.
+ *
+ * @param[in]  archive The archive to retrieve the statistics from.
+ * @param[out] stats   The statistics.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+int sqsh_archive_stats(
+		struct SqshArchive *archive, struct SqshArchiveStats *stats);
+
 /**
  * @memberof SqshArchive
  * @brief Frees the resources used by a Sqsh instance.
@@ -101,6 +101,7 @@ enum SqshError {
 	SQSH_ERROR_INODE_PARENT_MISMATCH,
 	SQSH_ERROR_INODE_PARENT_UNSET,
 	SQSH_ERROR_NOT_A_SYMLINK,
+	SQSH_ERROR_CANCELLED,
 };
 
 /**
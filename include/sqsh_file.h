@@ -363,6 +363,84 @@ sqsh_lopen(struct SqshArchive *archive, const char *path, int *err);
 SQSH_NO_UNUSED struct SqshFile *
 sqsh_open_by_ref(struct SqshArchive *archive, uint64_t inode_ref, int *err);
 
+/**
+ * @brief The decoded attributes of an inode as returned by sqsh_file_stat().
+ * The fields hold the same values as the accessors of the same name on an
+ * open SqshFile.
+ */
+struct SqshFileStat {
+	/**
+	 * @brief the inode reference the attributes were read from.
+	 */
+	uint64_t inode_ref;
+	/**
+	 * @brief the size of the file in bytes.
+	 */
+	uint64_t size;
+	/**
+	 * @brief the address of the first data block of a regular file.
+	 */
+	uint64_t blocks_start;
+	/**
+	 * @brief the type of the file.
+	 */
+	enum SqshFileType type;
+	/**
+	 * @brief the inode number of the file.
+	 */
+	uint32_t inode_number;
+	/**
+	 * @brief the number of hard links to the file.
+	 */
+	uint32_t hard_link_count;
+	/**
+	 * @brief the modification time of the file in seconds since the epoch.
+	 */
+	uint32_t modified_time;
+	/**
+	 * @brief the owner user id of the file.
+	 */
+	uint32_t uid;
+	/**
+	 * @brief the owner group id of the file.
+	 */
+	uint32_t gid;
+	/**
+	 * @brief the index of the fragment block or SQSH_INODE_NO_FRAGMENT.
+	 */
+	uint32_t fragment_block_index;
+	/**
+	 * @brief the offset of the file contents inside of the fragment block.
+	 */
+	uint32_t fragment_block_offset;
+	/**
+	 * @brief the index of the extended attributes or SQSH_INODE_NO_XATTR.
+	 */
+	uint32_t xattr_index;
+	/**
+	 * @brief the permission bits of the file.
+	 */
+	uint16_t permission;
+};
+
+/**
+ * @memberof SqshFile
+ * @brief Retrieves the attributes of an inode without opening it.
+ *
+ * The attributes of recently used inodes are kept by the archive, so
+ * repeated calls for the same inode do not read the inode table again. The
+ * number of inodes kept is set by `SqshConfig.file_stat_cache_size`.
+ *
+ * @param[in] archive The sqsh archive context.
+ * @param[in] inode_ref The inode reference of the file.
+ * @param[out] stat The attributes of the file.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_UNUSED int sqsh_file_stat(
+		struct SqshArchive *archive, uint64_t inode_ref,
+		struct SqshFileStat *stat);
+
 /**
  * @memberof SqshFile
  * @brief returns whether the file is an extended structure.
@@ -474,6 +552,22 @@ uint64_t sqsh_file_block_count2(const struct SqshFile *context);
  */
 uint32_t sqsh_file_block_size2(const struct SqshFile *context, uint64_t index);
 
+/**
+ * @memberof SqshFile
+ * @brief Retrieves the address of a data block within the archive. Together
+ * with sqsh_file_block_size2() and sqsh_file_block_is_compressed2() this
+ * allows reading uncompressed blocks straight from the archive file.
+ *
+ * @param[in]  context The file context.
+ * @param[in]  index   The index of the block.
+ * @param[out] address The address of the block, relative to the start of the
+ *                     archive.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_UNUSED int sqsh_file_block_address(
+		const struct SqshFile *context, uint64_t index, uint64_t *address);
+
 /**
  * @deprecated Since 1.6.0. Use sqsh_file_block_size2() instead.
  * @memberof SqshFile
@@ -53,7 +53,10 @@ struct SqshMapper;
 struct SqshMemoryMapperImpl {
 	/**
 	 * @brief A hint to libsqsh to use this block size if the user did not
-	 * specify one.
+	 * specify one. Mappers setting `SIZE_MAX` expose the whole input at once
+	 * and keep it valid until they are cleaned up. Unless a smaller block
+	 * size is configured, libsqsh then maps the input as a single chunk that
+	 * stays mapped while the archive is open.
 	 */
 	size_t block_size_hint;
 	/**
@@ -170,6 +173,27 @@ extern const struct SqshMemoryMapperImpl *const sqsh_mapper_impl_curl;
  */
 extern const struct SqshMemoryMapperImpl *const sqsh_mapper_impl_mmap;
 
+/**
+ * @brief a mapper that maps the whole file into memory at once. Mapped
+ * chunks are served as pointers into that mapping, which avoids a `mmap()`
+ * call per chunk and the reference counting of the chunks. It needs an
+ * address space large enough for the whole archive, so it is meant for 64
+ * bit hosts.
+ */
+extern const struct SqshMemoryMapperImpl *const sqsh_mapper_impl_mmap_full;
+
+/***************************************
+ * posix/uring_mapper.c
+ */
+
+/**
+ * @brief a mapper that reads the file into memory. Ranges are split into
+ * several reads that are submitted to io_uring together. If libsqsh is
+ * built without liburing or the kernel refuses io_uring, the mapper reads
+ * with `pread()`.
+ */
+extern const struct SqshMemoryMapperImpl *const sqsh_mapper_impl_uring;
+
 /***************************************
  * mapper/static_mapper.c
  */
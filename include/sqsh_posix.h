@@ -44,8 +44,10 @@ extern "C" {
 
 struct SqshFile;
 struct SqshFileIterator;
+struct SqshFileReader;
 
 struct SqshThreadpool;
+struct SqshFileIteratorMt;
 
 typedef void (*sqsh_file_iterator_mt_cb)(
 		const struct SqshFile *file, const struct SqshFileIterator *iterator,
@@ -78,6 +80,51 @@ SQSH_NO_UNUSED int sqsh_file_to_stream_mt(
 		const struct SqshFile *file, struct SqshThreadpool *threadpool,
 		FILE *stream, sqsh_file_to_stream_mt_cb cb, void *data);
 
+/**
+ * @memberof SqshFile
+ * @brief writes the contents of a file to a stream in order, while
+ * decompressing the blocks in parallel.
+ *
+ * Unlike sqsh_file_to_stream_mt(), the stream doesn't need to be seekable,
+ * so pipes, sockets and stdout can be used. Up to `window` decompressed
+ * blocks are buffered until the preceding blocks have been written, which
+ * bounds the memory use to `window` times the block size of the archive.
+ *
+ * This function blocks until the file is written.
+ *
+ * @param[in] file The file context.
+ * @param[in] threadpool The threadpool to decompress the blocks on.
+ * @param[in] window The number of blocks to decompress ahead of the writer.
+ * Use 0 for the default.
+ * @param[in] stream The stream to write the file contents to.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_UNUSED int sqsh_file_to_stream_ordered(
+		const struct SqshFile *file, struct SqshThreadpool *threadpool,
+		size_t window, FILE *stream);
+
+/**
+ * @memberof SqshFile
+ * @brief reads a range of a file into a buffer, decompressing the covered
+ * blocks in parallel.
+ *
+ * This is meant for large reads that span several blocks. The blocks are
+ * decompressed on the threadpool and copied straight to their place in
+ * `buffer`. This function blocks until all of them are done.
+ *
+ * @param[in] file The file context.
+ * @param[in] threadpool The threadpool to decompress the blocks on.
+ * @param[in] offset The offset in the file to start reading at.
+ * @param[in] size The number of bytes to read.
+ * @param[out] buffer The buffer to read into. Must hold `size` bytes.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_UNUSED int sqsh_file_read_mt(
+		const struct SqshFile *file, struct SqshThreadpool *threadpool,
+		uint64_t offset, size_t size, uint8_t *buffer);
+
 /**
  * @memberof SqshFile
  * @brief creates a file descriptor from a file and calls a callback for each
@@ -92,6 +139,101 @@ void sqsh_file_iterator_mt(
 		const struct SqshFile *file, struct SqshThreadpool *threadpool,
 		sqsh_file_iterator_mt_cb cb, void *data);
 
+/**
+ * @memberof SqshFile
+ * @brief decompresses the blocks of a file on a threadpool and calls a
+ * callback for each block.
+ *
+ * At most `window` blocks are in flight at any time, so memory use doesn't
+ * depend on the size of the file. A block only leaves the window once the
+ * callback for it returned, so a consumer that is slower than the
+ * decompression holds back the following blocks.
+ *
+ * The callback is called from the worker threads, in no particular order
+ * and possibly before this function returns. Once all blocks are done, it
+ * is called a last time with `iterator` set to NULL and the result of the
+ * operation in `err`.
+ *
+ * The returned handle must be released with sqsh_file_iterator_mt_release().
+ *
+ * @param[in] file The file context.
+ * @param[in] threadpool The threadpool to use.
+ * @param[in] window The maximum number of blocks in flight. Use 0 for the
+ * default.
+ * @param[in] cb The callback to call for each block.
+ * @param[in] data The data to pass to the callback.
+ * @param[out] err The error code.
+ *
+ * @return A handle to the running operation on success, NULL on error. On
+ * error, the callback is not called.
+ */
+SQSH_NO_UNUSED struct SqshFileIteratorMt *sqsh_file_iterator_mt2(
+		const struct SqshFile *file, struct SqshThreadpool *threadpool,
+		size_t window, sqsh_file_iterator_mt_cb cb, void *data, int *err);
+
+/**
+ * @memberof SqshFileIteratorMt
+ * @brief cancels a running operation.
+ *
+ * Blocks that have not been started yet are skipped. Callbacks that are
+ * already running are not interrupted. The final callback is called with
+ * `-SQSH_ERROR_CANCELLED` unless all blocks were already done.
+ *
+ * @param[in] mt The handle returned by sqsh_file_iterator_mt2().
+ */
+void sqsh_file_iterator_mt_cancel(struct SqshFileIteratorMt *mt);
+
+/**
+ * @memberof SqshFileIteratorMt
+ * @brief releases the handle of an operation. The operation itself keeps
+ * running until it is done or cancelled.
+ *
+ * @param[in] mt The handle returned by sqsh_file_iterator_mt2().
+ */
+void sqsh_file_iterator_mt_release(struct SqshFileIteratorMt *mt);
+
+/**
+ * @memberof SqshFileIterator
+ * @brief enables readahead on a file iterator.
+ *
+ * While the iterator advances sequentially, the next `block_count` data
+ * blocks are decompressed on the threadpool in the background, so they are
+ * already cached once the iterator reaches them. Readahead pauses after the
+ * iterator skipped to a different position and resumes when it moves
+ * sequentially again.
+ *
+ * The prefetched blocks are kept in the data block cache of the archive, so
+ * `block_count` should not exceed `SqshConfig::data_lru_size`.
+ *
+ * The threadpool must outlive the iterator.
+ *
+ * @param[in] iterator The file iterator.
+ * @param[in] threadpool The threadpool to use.
+ * @param[in] block_count The number of blocks to read ahead. 0 disables
+ * readahead.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_UNUSED int sqsh_file_iterator_readahead(
+		struct SqshFileIterator *iterator, struct SqshThreadpool *threadpool,
+		size_t block_count);
+
+/**
+ * @memberof SqshFileReader
+ * @brief enables readahead on a file reader. See
+ * sqsh_file_iterator_readahead().
+ *
+ * @param[in] reader The file reader.
+ * @param[in] threadpool The threadpool to use.
+ * @param[in] block_count The number of blocks to read ahead. 0 disables
+ * readahead.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_UNUSED int sqsh_file_reader_readahead(
+		struct SqshFileReader *reader, struct SqshThreadpool *threadpool,
+		size_t block_count);
+
 /**
  * @memberof SqshThreadpool
  * @brief creates a new threadpool.
@@ -59,6 +59,22 @@ struct SqshTable;
 int
 sqsh_table_get(const struct SqshTable *table, sqsh_index_t index, void *target);
 
+/**
+ * @memberof SqshTable
+ * @brief Retrieves a range of consecutive elements from the table.
+ *
+ * @param[in]  table The table to retrieve the elements from.
+ * @param[in]  start The index of the first element to retrieve.
+ * @param[in]  count The number of elements to retrieve.
+ * @param[out] target The buffer to store the elements in. It must be large
+ * enough to hold `count` elements.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+int sqsh_table_get_range(
+		const struct SqshTable *table, sqsh_index_t start, size_t count,
+		void *target);
+
 /***************************************
  * table/id_table.c
  */
@@ -36,8 +36,10 @@
 
 #include "sqsh_archive.h"
 
+#include "sqsh_directory_private.h"
 #include "sqsh_error.h"
 #include "sqsh_file_private.h"
+#include "sqsh_tree_private.h"
 #include "sqsh_utils_private.h"
 #include "sqsh_xattr_private.h"
 
@@ -240,6 +242,10 @@ struct SqshArchive {
 	struct SqshConfig config;
 	sqsh__mutex_t lock;
 	uint8_t *zero_block;
+	struct SqshCacheBudget cache_budget;
+	struct SqshDirectoryLookupCache directory_lookup_cache;
+	struct SqshPathCache path_cache;
+	struct SqshFileStatCache file_stat_cache;
 };
 
 /**
@@ -272,6 +278,57 @@ SQSH_NO_EXPORT int sqsh__archive_data_extract_manager(
 		struct SqshArchive *archive,
 		struct SqshExtractManager **data_extract_manager);
 
+/**
+ * @internal
+ * @memberof SqshArchive
+ * @brief sqsh__archive_cache_budget retrieves the byte budget shared by the
+ * caches of the archive.
+ *
+ * @param archive the SqshArchive to retrieve the budget from.
+ *
+ * @return the budget or NULL if the caches are limited by entry counts.
+ */
+SQSH_NO_EXPORT struct SqshCacheBudget *
+sqsh__archive_cache_budget(struct SqshArchive *archive);
+
+/**
+ * @internal
+ * @memberof SqshArchive
+ * @brief sqsh__archive_directory_lookup_cache retrieves the cache of the name
+ * lookup tables of large directories.
+ *
+ * @param archive the SqshArchive to retrieve the cache from.
+ *
+ * @return the directory lookup cache.
+ */
+SQSH_NO_EXPORT struct SqshDirectoryLookupCache *
+sqsh__archive_directory_lookup_cache(struct SqshArchive *archive);
+
+/**
+ * @internal
+ * @memberof SqshArchive
+ * @brief sqsh__archive_path_cache retrieves the cache of resolved paths.
+ *
+ * @param archive the SqshArchive to retrieve the cache from.
+ *
+ * @return the path cache.
+ */
+SQSH_NO_EXPORT struct SqshPathCache *
+sqsh__archive_path_cache(struct SqshArchive *archive);
+
+/**
+ * @internal
+ * @memberof SqshArchive
+ * @brief sqsh__archive_file_stat_cache retrieves the cache of decoded inode
+ * attributes.
+ *
+ * @param archive the SqshArchive to retrieve the cache from.
+ *
+ * @return the file stat cache.
+ */
+SQSH_NO_EXPORT struct SqshFileStatCache *
+sqsh__archive_file_stat_cache(struct SqshArchive *archive);
+
 /**
  * @internal
  * @memberof SqshArchive
@@ -38,11 +38,18 @@
 
 #include "sqsh_file_private.h"
 #include "sqsh_metablock_private.h"
+#include "sqsh_utils_private.h"
+
+#include <cextras/memory.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct SqshDataDirectoryEntry;
+struct SqshDirectoryLookupTable;
+struct SqshDirectoryLookupRecord;
+
 /***************************************
  * directory/directory_iterator.c
  */
@@ -64,6 +71,9 @@ struct SqshDirectoryIterator {
 
 	uint32_t start_base;
 	uint32_t inode_base;
+
+	struct SqshDirectoryLookupTable *lookup_table;
+	const struct SqshDirectoryLookupRecord *lookup_record;
 };
 
 /**
@@ -91,6 +101,165 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__directory_iterator_init(
 SQSH_NO_EXPORT int
 sqsh__directory_iterator_cleanup(struct SqshDirectoryIterator *iterator);
 
+/**
+ * @internal
+ * @memberof SqshDirectoryIterator
+ * @brief Retrieves the raw directory entry the iterator points to. The name
+ * of the entry directly follows it.
+ *
+ * @param[in] iterator The iterator to use.
+ *
+ * @return The current directory entry.
+ */
+SQSH_NO_EXPORT const struct SqshDataDirectoryEntry *
+sqsh__directory_iterator_entry(const struct SqshDirectoryIterator *iterator);
+
+/***************************************
+ * directory/directory_lookup.c
+ */
+
+/**
+ * @brief The position of a single entry inside of a directory listing.
+ */
+struct SqshDirectoryLookupRecord {
+	/**
+	 * @privatesection
+	 */
+	uint32_t hash;
+	uint32_t entry_offset;
+	uint32_t position;
+	uint32_t remaining_entries;
+	uint32_t start_base;
+	uint32_t inode_base;
+};
+
+/**
+ * @brief A hash table over all names of a single directory.
+ */
+struct SqshDirectoryLookupTable {
+	/**
+	 * @privatesection
+	 */
+	uint64_t inode_ref;
+	uint64_t last_use;
+	int references;
+	struct SqshCacheBudgetEntry budget_entry;
+	size_t size;
+	struct CxBuffer entries;
+	struct CxBuffer records;
+	uint32_t *slots;
+	size_t slot_mask;
+};
+
+/**
+ * @brief A bounded cache of the lookup tables of the largest directories of
+ * an archive.
+ */
+struct SqshDirectoryLookupCache {
+	/**
+	 * @privatesection
+	 */
+	sqsh__mutex_t lock;
+	struct SqshDirectoryLookupTable **tables;
+	size_t size;
+	uint64_t min_size;
+	uint64_t clock;
+	struct SqshCacheBudgetList budget_list;
+};
+
+/**
+ * @internal
+ * @memberof SqshDirectoryLookupCache
+ * @brief Initializes a directory lookup cache.
+ *
+ * @param[out] cache    The cache to initialize.
+ * @param[in]  size     The number of directories to keep. If 0, no
+ * directories are cached.
+ * @param[in]  min_size The minimum size of a directory listing in bytes to
+ * build a lookup table for it.
+ * @param[in]  budget   The budget the tables are charged to or NULL if the
+ * cache is only limited by `size`.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__directory_lookup_cache_init(
+		struct SqshDirectoryLookupCache *cache, size_t size, uint64_t min_size,
+		struct SqshCacheBudget *budget);
+
+/**
+ * @internal
+ * @memberof SqshDirectoryLookupCache
+ * @brief Retrieves the lookup table of a directory. The table is built from
+ * the directory listing if it is not cached yet.
+ *
+ * @param[in]  cache     The cache to use.
+ * @param[in]  directory The directory to retrieve the table for.
+ * @param[out] table     The table or NULL if the directory is too small to be
+ * cached. The table must be released with
+ * sqsh__directory_lookup_table_release().
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__directory_lookup_cache_get(
+		struct SqshDirectoryLookupCache *cache,
+		const struct SqshFile *directory,
+		struct SqshDirectoryLookupTable **table);
+
+/**
+ * @internal
+ * @memberof SqshDirectoryLookupCache
+ * @brief Cleans up a directory lookup cache.
+ *
+ * @param[in] cache The cache to clean up.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int
+sqsh__directory_lookup_cache_cleanup(struct SqshDirectoryLookupCache *cache);
+
+/**
+ * @internal
+ * @memberof SqshDirectoryLookupTable
+ * @brief Finds an entry by its name.
+ *
+ * @param[in] table    The table to search.
+ * @param[in] name     The name of the entry.
+ * @param[in] name_len The length of the name.
+ *
+ * @return The record of the entry or NULL if there is no such entry.
+ */
+SQSH_NO_EXPORT const struct SqshDirectoryLookupRecord *
+sqsh__directory_lookup_table_find(
+		const struct SqshDirectoryLookupTable *table, const char *name,
+		size_t name_len);
+
+/**
+ * @internal
+ * @memberof SqshDirectoryLookupTable
+ * @brief Retrieves the copy of the raw directory entry of a record.
+ *
+ * @param[in] table  The table the record belongs to.
+ * @param[in] record The record.
+ *
+ * @return The directory entry, followed by its name.
+ */
+SQSH_NO_EXPORT const struct SqshDataDirectoryEntry *
+sqsh__directory_lookup_table_entry(
+		const struct SqshDirectoryLookupTable *table,
+		const struct SqshDirectoryLookupRecord *record);
+
+/**
+ * @internal
+ * @memberof SqshDirectoryLookupTable
+ * @brief Releases a table retrieved from sqsh__directory_lookup_cache_get().
+ *
+ * @param[in] table The table to release.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int
+sqsh__directory_lookup_table_release(struct SqshDirectoryLookupTable *table);
+
 /***************************************
  * inode/directory_index_iterator.c
  */
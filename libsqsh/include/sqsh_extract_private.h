@@ -36,6 +36,7 @@
 
 #include <cextras/collection.h>
 
+#include <sqsh_archive.h>
 #include <sqsh_data.h>
 #include <sqsh_utils_private.h>
 
@@ -45,6 +46,8 @@ extern "C" {
 
 struct SqshArchive;
 struct SqshMapReader;
+struct SqshExtractInflight;
+struct SqshExtractorPoolEntry;
 
 /***************************************
  * extract/extractor2.c
@@ -83,6 +86,44 @@ struct SqshExtractorImpl {
 	 * @brief Function that is called to finish the extraction.
 	 */
 	int (*finish)(void *context, uint8_t *target, size_t *target_size);
+	/**
+	 * @brief Optional. Finishes the extraction like `finish`, but keeps
+	 * the resources of the context alive, so that it can be reused with
+	 * `reset`.
+	 */
+	int (*finish_keep)(void *context, uint8_t *target, size_t *target_size);
+	/**
+	 * @brief Optional. Prepares a context that was finished with
+	 * `finish_keep` for the extraction of another block.
+	 */
+	int (*reset)(void *context, uint8_t *target, size_t target_size);
+	/**
+	 * @brief Optional. Releases a context that was finished with
+	 * `finish_keep`.
+	 */
+	void (*destroy)(void *context);
+	/**
+	 * @brief Optional. Decompresses a complete block in a single call.
+	 * This replaces `write` and `finish_keep` on an initialized context,
+	 * which can afterwards be reused with `reset`. `target_size` holds the
+	 * capacity of `target` and receives the decompressed size.
+	 */
+	int (*decompress_once)(
+			void *context, const uint8_t *compressed, size_t compressed_size,
+			uint8_t *target, size_t *target_size);
+};
+
+/**
+ * @brief A pool of extractor contexts that are kept alive between
+ * extractions. This avoids setting up the decompressor for every block.
+ */
+struct SqshExtractorPool {
+	/**
+	 * @privatesection
+	 */
+	const struct SqshExtractorImpl *impl;
+	struct SqshExtractorPoolEntry *entries;
+	sqsh__mutex_t lock;
 };
 
 /**
@@ -95,6 +136,8 @@ struct SqshExtractor {
 	struct CxBuffer *buffer;
 	const struct SqshExtractorImpl *impl;
 	sqsh__extractor_context_t context;
+	struct SqshExtractorPool *pool;
+	struct SqshExtractorPoolEntry *pool_entry;
 	uint8_t *target;
 	size_t block_size;
 };
@@ -128,6 +171,27 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extractor_init(
 		struct SqshExtractor *extractor, struct CxBuffer *buffer,
 		const struct SqshExtractorImpl *impl, size_t block_size);
 
+/**
+ * @internal
+ * @memberof SqshExtractor
+ * @brief Initializes a extractor context with a decompressor taken from a
+ * pool. The decompressor is returned to the pool by
+ * sqsh__extractor_finish().
+ *
+ * Falls back to sqsh__extractor_init() if the implementation of the pool
+ * does not support reusing contexts.
+ *
+ * @param[out] extractor      The context to initialize.
+ * @param[out] buffer         The buffer to store the decompressed data.
+ * @param[in]  pool           The pool to take the decompressor from.
+ * @param[in]  block_size     The block size to use for the extraction.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extractor_init_from_pool(
+		struct SqshExtractor *extractor, struct CxBuffer *buffer,
+		struct SqshExtractorPool *pool, size_t block_size);
+
 /**
  * @internal
  * @memberof SqshExtractor
@@ -154,6 +218,25 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extractor_write(
  */
 SQSH_NO_EXPORT int sqsh__extractor_finish(struct SqshExtractor *extractor);
 
+/**
+ * @internal
+ * @memberof SqshExtractor
+ * @brief Decompresses a complete block and finishes the extractor.
+ *
+ * Uses the single call decompression of the implementation if available
+ * and falls back to sqsh__extractor_write() and sqsh__extractor_finish()
+ * otherwise.
+ *
+ * @param[in]     extractor       The extractor context to use.
+ * @param[in]     compressed      The compressed block.
+ * @param[in]     compressed_size The size of the compressed block.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extractor_decompress_once(
+		struct SqshExtractor *extractor, const uint8_t *compressed,
+		const size_t compressed_size);
+
 /**
  * @internal
  * @memberof SqshExtractor
@@ -165,10 +248,57 @@ SQSH_NO_EXPORT int sqsh__extractor_finish(struct SqshExtractor *extractor);
  */
 SQSH_NO_EXPORT int sqsh__extractor_cleanup(struct SqshExtractor *extractor);
 
+/**
+ * @internal
+ * @memberof SqshExtractorPool
+ * @brief Initializes an extractor pool.
+ *
+ * @param[out] pool The pool to initialize.
+ * @param[in]  impl The implementation of the extraction algorithm.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__extractor_pool_init(
+		struct SqshExtractorPool *pool, const struct SqshExtractorImpl *impl);
+
+/**
+ * @internal
+ * @memberof SqshExtractorPool
+ * @brief Releases all contexts of an extractor pool.
+ *
+ * @param[in] pool The pool to clean up.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__extractor_pool_cleanup(struct SqshExtractorPool *pool);
+
 /***************************************
  * extract/extract_manager.c
  */
 
+struct SqshExtractManager;
+
+/**
+ * @brief A part of the extract manager cache with its own lock.
+ */
+struct SqshExtractManagerShard {
+	/**
+	 * @privatesection
+	 */
+	struct SqshExtractManager *manager;
+	struct CxRcRadixTree cache;
+	struct CxLru lru;
+	sqsh__mutex_t lock;
+	/**
+	 * Blocks of this shard that are currently being decompressed. Threads
+	 * missing the cache on one of these addresses wait on `inflight_cond`
+	 * instead of decompressing the same block again.
+	 */
+	struct SqshExtractInflight *inflight;
+	sqsh__cond_t inflight_cond;
+	struct SqshCacheBudgetList budget_list;
+};
+
 /**
  * @brief Manages chunks of compressed areas from an archive.
  */
@@ -177,11 +307,17 @@ struct SqshExtractManager {
 	 * @privatesection
 	 */
 	const struct SqshExtractorImpl *extractor_impl;
+	struct SqshExtractorPool extractor_pool;
 	struct SqshMapManager *map_manager;
-	struct CxRcRadixTree cache;
+	/**
+	 * The cache is split into shards by a hash of the block address. Each
+	 * shard is protected by its own lock.
+	 */
+	struct SqshExtractManagerShard *shards;
+	size_t shard_count;
 	uint32_t block_size;
-	struct CxLru lru;
-	sqsh__mutex_t lock;
+	struct SqshCacheStats stats;
+	struct SqshCacheBudget *budget;
 };
 
 /**
@@ -192,7 +328,8 @@ struct SqshExtractManager {
  * @param[in]     manager     The manager to initialize.
  * @param[in]     archive     The archive to use.
  * @param[in]     block_size  The block size to use.
- * @param[in]     lru_size    The size of the lru cache.
+ * @param[in]     lru_size    The size of the lru cache. It is divided
+ *                            between the shards configured in the archive.
  *
  * @return 0 on success, a negative value on error.
  */
@@ -241,6 +378,18 @@ SQSH_NO_EXPORT int sqsh__extract_manager_retain_buffer(
 SQSH_NO_EXPORT int sqsh__extract_manager_release(
 		struct SqshExtractManager *manager, uint64_t address);
 
+/**
+ * @internal
+ * @memberof SqshExtractManager
+ * @brief Retrieves a snapshot of the counters of the manager.
+ *
+ * @param[in]  manager The manager to use.
+ * @param[out] stats   The counters.
+ */
+SQSH_NO_EXPORT void sqsh__extract_manager_stats(
+		const struct SqshExtractManager *manager,
+		struct SqshCacheStats *stats);
+
 /**
  * @internal
  * @memberof SqshExtractManager
@@ -48,6 +48,8 @@ extern "C" {
 
 struct SqshArchive;
 struct SqshDataInode;
+struct SqshFileReadahead;
+struct CxThreadpool;
 
 /***************************************
  * file/fragment_view.c
@@ -150,6 +152,7 @@ struct SqshFileIterator {
 	uint64_t block_index;
 	const uint8_t *data;
 	size_t size;
+	struct SqshFileReadahead *readahead;
 };
 
 /**
@@ -229,6 +232,97 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__file_reader_init(
  */
 SQSH_NO_EXPORT int sqsh__file_reader_cleanup(struct SqshFileReader *reader);
 
+/***************************************
+ * file/file_readahead.c
+ */
+
+/**
+ * @brief Decompresses the data blocks following the current position of a
+ * file iterator in the background.
+ */
+struct SqshFileReadahead {
+	/**
+	 * @privatesection
+	 */
+	struct CxThreadpool *threadpool;
+	struct SqshExtractManager *extract_manager;
+	struct SqshMapManager *map_manager;
+	size_t window;
+	uint64_t last_block_index;
+	uint64_t scheduled_until;
+	size_t scheduled_count;
+	sqsh__mutex_t lock;
+	sqsh__cond_t cond;
+	size_t pending;
+	bool cancelled;
+};
+
+/**
+ * @internal
+ * @memberof SqshFileReadahead
+ * @brief Initializes readahead for a file iterator.
+ *
+ * @param[out] readahead  The readahead context to initialize.
+ * @param[in]  iterator   The iterator to read ahead for.
+ * @param[in]  threadpool The threadpool to decompress the blocks on.
+ * @param[in]  window     The number of blocks to decompress in advance.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__file_readahead_init(
+		struct SqshFileReadahead *readahead,
+		const struct SqshFileIterator *iterator,
+		struct CxThreadpool *threadpool, size_t window);
+
+/**
+ * @internal
+ * @memberof SqshFileReadahead
+ * @brief Informs the readahead context that the iterator has moved. If the
+ * iterator moves forward within the readahead window, the blocks up to the
+ * end of the window are scheduled for decompression. Other moves restart
+ * the window at the new position.
+ *
+ * Errors are not reported: readahead is only a hint, and failing blocks are
+ * decompressed again once the iterator reaches them.
+ *
+ * @param[in] readahead The readahead context.
+ * @param[in] iterator  The iterator that has moved.
+ */
+SQSH_NO_EXPORT void sqsh__file_readahead_update(
+		struct SqshFileReadahead *readahead,
+		const struct SqshFileIterator *iterator);
+
+/**
+ * @internal
+ * @memberof SqshFileReadahead
+ * @brief Cancels pending readahead and waits until every scheduled job has
+ * been taken off the threadpool. Jobs that start after the cancellation
+ * return without decompressing their block.
+ *
+ * @param[in] readahead The readahead context to clean up.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT int sqsh__file_readahead_cleanup(
+		struct SqshFileReadahead *readahead);
+
+/**
+ * @internal
+ * @memberof SqshFileIterator
+ * @brief Enables readahead on a file iterator. Any previous readahead
+ * configuration is replaced.
+ *
+ * @param[in] iterator   The iterator.
+ * @param[in] threadpool The threadpool to decompress the blocks on.
+ * @param[in] window     The number of blocks to decompress in advance. 0
+ * disables readahead.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__file_iterator_readahead(
+		struct SqshFileIterator *iterator, struct CxThreadpool *threadpool,
+		size_t window);
+
 /***************************************
  * file/file.c
  */
@@ -278,6 +372,7 @@ struct SqshFile {
 	const struct SqshInodeImpl *impl;
 	enum SqshFileType type;
 	uint64_t parent_inode_ref;
+	uint64_t *block_offsets;
 };
 
 /**
@@ -299,6 +394,23 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__file_init(
 SQSH_NO_EXPORT SQSH_NO_UNUSED int
 sqsh__file_copy(struct SqshFile *context, const struct SqshFile *other);
 
+/**
+ * @internal
+ * @memberof SqshFile
+ * @brief Retrieves the offset of a data block relative to the start of the
+ * file's data blocks. The offsets of all blocks are calculated once on first
+ * use and are cached in the file context, so that subsequent lookups are O(1).
+ *
+ * @param[in]  context The file context.
+ * @param[in]  index   The index of the block. Passing the block count
+ *                     retrieves the end of the last block.
+ * @param[out] offset  The offset of the block.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__file_block_offset(
+		const struct SqshFile *context, uint64_t index, uint64_t *offset);
+
 /**
  * @memberof SqshFile
  * @brief sets the parent inode reference.
@@ -332,6 +444,77 @@ sqsh__file_parent_inode_ref(struct SqshFile *context, int *err);
  */
 SQSH_NO_EXPORT int sqsh__file_cleanup(struct SqshFile *context);
 
+/***************************************
+ * file/file_stat_cache.c
+ */
+
+/**
+ * @brief A bounded cache of decoded inode attributes. Each inode reference
+ * maps to exactly one slot, a new inode replaces the one stored in its slot.
+ */
+struct SqshFileStatCache {
+	/**
+	 * @privatesection
+	 */
+	sqsh__mutex_t lock;
+	struct SqshFileStat *slots;
+	size_t slot_mask;
+};
+
+/**
+ * @internal
+ * @memberof SqshFileStatCache
+ * @brief Initializes a file stat cache.
+ *
+ * @param[out] cache The cache to initialize.
+ * @param[in] size The number of inodes to keep. The cache is disabled if
+ * this is 0.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int
+sqsh__file_stat_cache_init(struct SqshFileStatCache *cache, size_t size);
+
+/**
+ * @internal
+ * @memberof SqshFileStatCache
+ * @brief Looks up the attributes of an inode.
+ *
+ * @param[in] cache The cache to look up the inode in.
+ * @param[in] inode_ref The inode reference to look up.
+ * @param[out] stat Receives the attributes if the inode is cached.
+ *
+ * @return true if the inode is cached, false otherwise.
+ */
+SQSH_NO_EXPORT bool sqsh__file_stat_cache_get(
+		struct SqshFileStatCache *cache, uint64_t inode_ref,
+		struct SqshFileStat *stat);
+
+/**
+ * @internal
+ * @memberof SqshFileStatCache
+ * @brief Stores the attributes of an inode.
+ *
+ * @param[in] cache The cache to store the inode in.
+ * @param[in] stat The attributes to store, keyed by `stat->inode_ref`.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT int sqsh__file_stat_cache_put(
+		struct SqshFileStatCache *cache, const struct SqshFileStat *stat);
+
+/**
+ * @internal
+ * @memberof SqshFileStatCache
+ * @brief Cleans up a file stat cache.
+ *
+ * @param[in] cache The cache to clean up.
+ *
+ * @return 0 on success, less than 0 on error.
+ */
+SQSH_NO_EXPORT int
+sqsh__file_stat_cache_cleanup(struct SqshFileStatCache *cache);
+
 /***************************************
  * file/inode_directory.c
  */
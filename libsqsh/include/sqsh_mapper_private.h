@@ -34,6 +34,7 @@
 #ifndef SQSH_PRIVATE_MAPPER_H
 #define SQSH_PRIVATE_MAPPER_H
 
+#include <sqsh_archive.h>
 #include <sqsh_mapper.h>
 
 #include "sqsh_reader_private.h"
@@ -63,6 +64,11 @@ struct SqshMapper {
 	size_t block_size;
 	uint64_t archive_size;
 	void *user_data;
+	/**
+	 * The configuration of the archive. Only set while the implementation
+	 * is initialized.
+	 */
+	const struct SqshConfig *config;
 };
 
 /**
@@ -158,10 +164,121 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__map_slice_init(
 		struct SqshMapSlice *mapping, struct SqshMapper *mapper,
 		uint64_t address, uint64_t offset, size_t size);
 
+/***************************************
+ * mapper/curl_cache.c
+ */
+
+/**
+ * @brief A directory of blocks downloaded by the curl mapper. The directory
+ * can be shared by several archives and processes. Files are evicted by
+ * their modification time, which is updated on every hit.
+ */
+struct SqshCurlCache {
+	/**
+	 * @privatesection
+	 */
+	char *dir;
+	char *header;
+	size_t header_size;
+	uint64_t key;
+	uint64_t max_bytes;
+	uint64_t used_bytes;
+	sqsh__mutex_t lock;
+};
+
+/**
+ * @internal
+ * @memberof SqshCurlCache
+ * @brief Opens a cache directory for a remote file. The directory is
+ * created if it does not exist.
+ *
+ * @param[out] cache     The cache to initialize.
+ * @param[in]  dir       The directory to store the blocks in.
+ * @param[in]  max_bytes The maximum size of all files in the directory.
+ * @param[in]  url       The URL of the remote file.
+ * @param[in]  file_time The modification time reported for the remote file.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__curl_cache_init(
+		struct SqshCurlCache *cache, const char *dir, uint64_t max_bytes,
+		const char *url, uint64_t file_time);
+
+/**
+ * @internal
+ * @memberof SqshCurlCache
+ * @brief Reads a block from the cache.
+ *
+ * @param[in]  cache  The cache to use.
+ * @param[in]  offset The offset of the block in the remote file.
+ * @param[in]  size   The size of the block.
+ * @param[out] data   The block, allocated with malloc().
+ *
+ * @return 1 if the block was found, 0 if it was not.
+ */
+SQSH_NO_EXPORT int sqsh__curl_cache_get(
+		struct SqshCurlCache *cache, uint64_t offset, size_t size,
+		uint8_t **data);
+
+/**
+ * @internal
+ * @memberof SqshCurlCache
+ * @brief Checks whether a block is in the cache without reading it.
+ *
+ * @param[in] cache  The cache to use.
+ * @param[in] offset The offset of the block in the remote file.
+ * @param[in] size   The size of the block.
+ *
+ * @return true if the block was found, false if it was not.
+ */
+SQSH_NO_EXPORT bool sqsh__curl_cache_contains(
+		const struct SqshCurlCache *cache, uint64_t offset, size_t size);
+
+/**
+ * @internal
+ * @memberof SqshCurlCache
+ * @brief Stores a block in the cache and evicts the least recently used
+ * files if the cache grows beyond its limit. Failures are ignored, the
+ * cache only ever misses.
+ *
+ * @param[in] cache  The cache to use.
+ * @param[in] offset The offset of the block in the remote file.
+ * @param[in] data   The block.
+ * @param[in] size   The size of the block.
+ */
+SQSH_NO_EXPORT void sqsh__curl_cache_put(
+		struct SqshCurlCache *cache, uint64_t offset, const uint8_t *data,
+		size_t size);
+
+/**
+ * @internal
+ * @memberof SqshCurlCache
+ * @brief Cleans up a cache. The files are kept.
+ *
+ * @param[in] cache The cache to clean up.
+ */
+SQSH_NO_EXPORT void sqsh__curl_cache_cleanup(struct SqshCurlCache *cache);
+
 /***************************************
  * mapper/map_manager.c
  */
 
+struct SqshMapManager;
+
+/**
+ * @brief A part of the map manager cache with its own lock.
+ */
+struct SqshMapManagerShard {
+	/**
+	 * @privatesection
+	 */
+	struct SqshMapManager *manager;
+	struct CxLru lru;
+	struct CxRcRadixTree maps;
+	sqsh__mutex_t lock;
+	struct SqshCacheBudgetList budget_list;
+};
+
 /**
  * @brief The map manager.
  */
@@ -170,11 +287,29 @@ struct SqshMapManager {
 	 * @privatesection
 	 */
 	struct SqshMapper mapper;
-	struct CxLru lru;
-	struct CxRcRadixTree maps;
+	/**
+	 * The cache is split into shards by block index. Each shard is protected
+	 * by its own lock.
+	 */
+	struct SqshMapManagerShard *shards;
+	size_t shard_count;
+	/**
+	 * If the mapper exposes the whole archive as a single chunk, that chunk
+	 * is mapped once during initialization and handed out without locking
+	 * or reference counting.
+	 */
+	struct SqshMapSlice pinned;
+	bool is_pinned;
+	/**
+	 * Chunks that were loaded by sqsh__map_manager_prefetch(). They are
+	 * retained until the manager is cleaned up.
+	 */
+	const struct SqshMapSlice **prefetched;
+	size_t prefetched_count;
 	uint64_t archive_offset;
 	uint64_t block_count;
-	sqsh__mutex_t lock;
+	struct SqshCacheStats stats;
+	struct SqshCacheBudget *budget;
 };
 
 /**
@@ -216,6 +351,21 @@ sqsh__map_manager_size(const struct SqshMapManager *manager);
 SQSH_NO_EXPORT size_t
 sqsh__map_manager_block_size(const struct SqshMapManager *manager);
 
+/**
+ * @internal
+ * @memberof SqshMapManager
+ * @brief Makes the manager account its mappings in a byte budget. Mappings
+ * that are not in use are evicted by the budget instead of the entry based
+ * LRU.
+ *
+ * @param[in] manager The SqshMapManager instance.
+ * @param[in] budget The budget to use.
+ *
+ * @return Returns 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__map_manager_use_budget(
+		struct SqshMapManager *manager, struct SqshCacheBudget *budget);
+
 /**
  * @internal
  * @memberof SqshMapManager
@@ -255,6 +405,34 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__map_manager_retain(
  */
 SQSH_NO_EXPORT int sqsh__map_manager_release(
 		struct SqshMapManager *manager, const struct SqshMapSlice *mapping);
+
+/**
+ * @internal
+ * @memberof SqshMapManager
+ * @brief Loads all chunks covering a range of the archive in ascending
+ * order and keeps them in the cache until the manager is cleaned up. The
+ * chunks are not charged to the cache budget.
+ *
+ * @param[in] manager The manager to use.
+ * @param[in] start   The first byte of the range.
+ * @param[in] end     The end of the range, exclusive.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__map_manager_prefetch(
+		struct SqshMapManager *manager, uint64_t start, uint64_t end);
+
+/**
+ * @internal
+ * @memberof SqshMapManager
+ * @brief Retrieves a snapshot of the counters of the manager.
+ *
+ * @param[in] manager The SqshMapManager instance.
+ * @param[out] stats The counters.
+ */
+SQSH_NO_EXPORT void sqsh__map_manager_stats(
+		const struct SqshMapManager *manager, struct SqshCacheStats *stats);
+
 /**
  * @internal
  * @memberof SqshMapManager
@@ -50,6 +50,41 @@ struct SqshDataXattrLookupTable;
  * table/table.c
  */
 
+/**
+ * @brief The number of decompressed metablocks a table keeps. Tables that
+ * span more metablocks drop the least recently used ones.
+ */
+#define SQSH_TABLE_METABLOCK_CACHE_SIZE 32
+
+/**
+ * @brief A decompressed metablock of a table.
+ */
+struct SqshTableMetablock {
+	/**
+	 * @privatesection
+	 */
+	struct SqshCacheBudgetEntry budget_entry;
+	uint8_t *data;
+	size_t size;
+};
+
+/**
+ * @brief The decompressed metablocks of a table. If the archive has a cache
+ * budget, they are charged to it and can be evicted by it.
+ */
+struct SqshTableMetablockCache {
+	/**
+	 * @privatesection
+	 */
+	sqsh__mutex_t lock;
+	/**
+	 * Indexed like the lookup table and populated on first access.
+	 */
+	struct SqshTableMetablock *metablocks;
+	size_t count;
+	struct SqshCacheBudgetList budget_list;
+};
+
 /**
  * @brief A generic table as used in an archive.
  */
@@ -63,6 +98,8 @@ struct SqshTable {
 	uint64_t start_block;
 	size_t element_size;
 	size_t element_count;
+	size_t metablock_count;
+	struct SqshTableMetablockCache *cache;
 };
 
 /**
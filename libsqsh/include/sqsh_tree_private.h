@@ -35,6 +35,7 @@
 #define SQSH_TREE_PRIVATE_H
 
 #include "sqsh_directory_private.h"
+#include "sqsh_utils_private.h"
 #include <sqsh_tree.h>
 
 #include <cextras/memory.h>
@@ -45,6 +46,120 @@ extern "C" {
 
 struct SqshArchive;
 
+/***************************************
+ * tree/path_cache.c
+ */
+
+/**
+ * @brief The result of resolving a path from the root directory.
+ */
+struct SqshPathCacheValue {
+	/**
+	 * @privatesection
+	 */
+	uint64_t inode_ref;
+	uint64_t parent_inode_ref;
+	size_t symlink_depth;
+	int error;
+};
+
+struct SqshPathCacheEntry;
+
+/**
+ * @brief A bounded cache that maps paths to the inodes they resolve to.
+ */
+struct SqshPathCache {
+	/**
+	 * @privatesection
+	 */
+	sqsh__mutex_t lock;
+	struct SqshPathCacheEntry **buckets;
+	size_t bucket_mask;
+	struct SqshPathCacheEntry *lru_head;
+	struct SqshPathCacheEntry *lru_tail;
+	size_t size;
+	size_t count;
+};
+
+/**
+ * @internal
+ * @memberof SqshPathCache
+ * @brief Initializes a path cache.
+ *
+ * @param[out] cache The cache to initialize.
+ * @param[in]  size  The maximum number of paths to keep. If 0, no paths are
+ * cached.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int
+sqsh__path_cache_init(struct SqshPathCache *cache, size_t size);
+
+/**
+ * @internal
+ * @memberof SqshPathCache
+ * @brief Retrieves the cached result of resolving a path.
+ *
+ * @param[in]  cache           The cache to use.
+ * @param[in]  path            The path, relative to the root directory.
+ * @param[in]  path_len        The length of the path.
+ * @param[in]  follow_symlinks Whether a symlink at the end of the path was
+ * followed.
+ * @param[out] value           The cached result.
+ *
+ * @return true if the path is cached, false otherwise.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED bool sqsh__path_cache_get(
+		struct SqshPathCache *cache, const char *path, size_t path_len,
+		bool follow_symlinks, struct SqshPathCacheValue *value);
+
+/**
+ * @internal
+ * @memberof SqshPathCache
+ * @brief Retrieves the longest cached proper prefix of a path. Only prefixes
+ * that end before a slash are considered.
+ *
+ * @param[in]  cache    The cache to use.
+ * @param[in]  path     The path, relative to the root directory.
+ * @param[in]  path_len The length of the path.
+ * @param[out] value    The cached result of the prefix.
+ *
+ * @return The length of the prefix in `path` or 0 if no prefix is cached.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED size_t sqsh__path_cache_get_prefix(
+		struct SqshPathCache *cache, const char *path, size_t path_len,
+		struct SqshPathCacheValue *value);
+
+/**
+ * @internal
+ * @memberof SqshPathCache
+ * @brief Stores the result of resolving a path. If the cache is full, the
+ * least recently used path is dropped.
+ *
+ * @param[in] cache           The cache to use.
+ * @param[in] path            The path, relative to the root directory.
+ * @param[in] path_len        The length of the path.
+ * @param[in] follow_symlinks Whether a symlink at the end of the path was
+ * followed.
+ * @param[in] value           The result to store.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__path_cache_put(
+		struct SqshPathCache *cache, const char *path, size_t path_len,
+		bool follow_symlinks, const struct SqshPathCacheValue *value);
+
+/**
+ * @internal
+ * @memberof SqshPathCache
+ * @brief Cleans up a path cache.
+ *
+ * @param[in] cache The cache to clean up.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT int sqsh__path_cache_cleanup(struct SqshPathCache *cache);
+
 /***************************************
  * tree/path_resolver.c
  */
@@ -88,6 +203,25 @@ SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__path_resolver_resolve_nt(
 		struct SqshPathResolver *resolver, const char *path, size_t path_len,
 		bool follow_symlinks);
 
+/**
+ * @internal
+ * @memberof SqshPathResolver
+ * @brief Resolves a path relative to the root directory. The walk starts at
+ * the longest prefix of the path found in the path cache of the archive.
+ * The directories passed on the way are added to the cache.
+ *
+ * @param[in,out] resolver        The resolver to use.
+ * @param[in]     path            The path to resolve.
+ * @param[in]     path_len        The length of the path.
+ * @param[in]     follow_symlinks Whether to follow a symlink at the end of
+ * the path.
+ *
+ * @return 0 on success, a negative value on error.
+ */
+SQSH_NO_EXPORT SQSH_NO_UNUSED int sqsh__path_resolver_resolve_from_root(
+		struct SqshPathResolver *resolver, const char *path, size_t path_len,
+		bool follow_symlinks);
+
 SQSH_NO_EXPORT int
 sqsh__path_resolver_cleanup(struct SqshPathResolver *resolver);
 
@@ -114,13 +114,27 @@ sqsh__archive_init(
 	config = sqsh_archive_config(archive);
 	const int default_lru_size =
 			(int)SQSH_CONFIG_DEFAULT(config->compression_lru_size, 128);
-	const size_t metablock_lru_size =
-			SQSH_CONFIG_DEFAULT(config->metablock_lru_size, default_lru_size);
+	const size_t metablock_lru_size = config->max_cache_bytes != 0
+			? 0
+			: SQSH_CONFIG_DEFAULT(config->metablock_lru_size, default_lru_size);
+
+	rv = sqsh__cache_budget_init(
+			&archive->cache_budget, config->max_cache_bytes);
+	if (rv < 0) {
+		goto out;
+	}
 
 	rv = sqsh__map_manager_init(&archive->map_manager, source, config);
 	if (rv < 0) {
 		goto out;
 	}
+	if (sqsh__archive_cache_budget(archive) != NULL) {
+		rv = sqsh__map_manager_use_budget(
+				&archive->map_manager, sqsh__archive_cache_budget(archive));
+		if (rv < 0) {
+			goto out;
+		}
+	}
 
 	rv = sqsh__superblock_init(
 			&archive->superblock, sqsh_archive_map_manager(archive));
@@ -137,12 +151,50 @@ sqsh__archive_init(
 		goto out;
 	}
 
+	if (config->prefetch_metadata) {
+		// mksquashfs places all tables behind the inode table, so this
+		// range covers the inodes, directories, fragments, ids, the export
+		// table and xattrs.
+		rv = sqsh__map_manager_prefetch(
+				&archive->map_manager,
+				sqsh_superblock_inode_table_start(&archive->superblock),
+				sqsh_superblock_bytes_used(&archive->superblock));
+		if (rv < 0) {
+			goto out;
+		}
+	}
+
 	rv = sqsh__extract_manager_init(
 			&archive->metablock_extract_manager, archive,
 			SQSH_METABLOCK_BLOCK_SIZE, metablock_lru_size);
 	if (rv < 0) {
 		goto out;
 	}
+
+	rv = sqsh__directory_lookup_cache_init(
+			&archive->directory_lookup_cache,
+			SQSH_CONFIG_DEFAULT(config->directory_cache_size, 16),
+			SQSH_CONFIG_DEFAULT(
+					config->directory_cache_min_size,
+					SQSH_METABLOCK_BLOCK_SIZE),
+			sqsh__archive_cache_budget(archive));
+	if (rv < 0) {
+		goto out;
+	}
+
+	rv = sqsh__path_cache_init(
+			&archive->path_cache,
+			SQSH_CONFIG_DEFAULT(config->path_cache_size, 0));
+	if (rv < 0) {
+		goto out;
+	}
+
+	rv = sqsh__file_stat_cache_init(
+			&archive->file_stat_cache,
+			SQSH_CONFIG_DEFAULT(config->file_stat_cache_size, 256));
+	if (rv < 0) {
+		goto out;
+	}
 out:
 	if (rv < 0) {
 		sqsh__archive_cleanup(archive);
@@ -160,6 +212,29 @@ sqsh_archive_superblock(const struct SqshArchive *archive) {
 	return &archive->superblock;
 }
 
+struct SqshCacheBudget *
+sqsh__archive_cache_budget(struct SqshArchive *archive) {
+	if (archive->config.max_cache_bytes == 0) {
+		return NULL;
+	}
+	return &archive->cache_budget;
+}
+
+struct SqshDirectoryLookupCache *
+sqsh__archive_directory_lookup_cache(struct SqshArchive *archive) {
+	return &archive->directory_lookup_cache;
+}
+
+struct SqshPathCache *
+sqsh__archive_path_cache(struct SqshArchive *archive) {
+	return &archive->path_cache;
+}
+
+struct SqshFileStatCache *
+sqsh__archive_file_stat_cache(struct SqshArchive *archive) {
+	return &archive->file_stat_cache;
+}
+
 struct SqshExtractManager *
 sqsh__archive_metablock_extract_manager(struct SqshArchive *archive) {
 	return &archive->metablock_extract_manager;
@@ -173,8 +248,9 @@ sqsh__archive_data_extract_manager(
 	const struct SqshConfig *config = sqsh_archive_config(archive);
 	const int default_lru_size =
 			(int)SQSH_CONFIG_DEFAULT(config->compression_lru_size, 128);
-	const size_t data_lru_size =
-			SQSH_CONFIG_DEFAULT(config->data_lru_size, default_lru_size);
+	const size_t data_lru_size = config->max_cache_bytes != 0
+			? 0
+			: SQSH_CONFIG_DEFAULT(config->data_lru_size, default_lru_size);
 
 	rv = sqsh__mutex_lock(&archive->lock);
 	if (rv < 0) {
@@ -344,6 +420,32 @@ sqsh__archive_zero_block_size(const struct SqshArchive *archive) {
 	return ZERO_BLOCK_SIZE;
 }
 
+int
+sqsh_archive_stats(
+		struct SqshArchive *archive, struct SqshArchiveStats *stats) {
+	int rv = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->compression_id =
+			sqsh_superblock_compression_id(&archive->superblock);
+	sqsh__map_manager_stats(&archive->map_manager, &stats->mapper);
+	sqsh__extract_manager_stats(
+			&archive->metablock_extract_manager, &stats->metablock);
+
+	rv = sqsh__mutex_lock(&archive->lock);
+	if (rv < 0) {
+		goto out;
+	}
+	if (is_initialized(archive, INITIALIZED_DATA_COMPRESSION_MANAGER)) {
+		sqsh__extract_manager_stats(
+				&archive->data_extract_manager, &stats->data);
+	}
+	sqsh__mutex_unlock(&archive->lock);
+
+out:
+	return rv;
+}
+
 int
 sqsh__archive_cleanup(struct SqshArchive *archive) {
 	int rv = 0;
@@ -366,9 +468,13 @@ sqsh__archive_cleanup(struct SqshArchive *archive) {
 	if (is_initialized(archive, INITIALIZED_INODE_MAP)) {
 		sqsh__inode_map_cleanup(&archive->inode_map);
 	}
+	sqsh__file_stat_cache_cleanup(&archive->file_stat_cache);
+	sqsh__path_cache_cleanup(&archive->path_cache);
+	sqsh__directory_lookup_cache_cleanup(&archive->directory_lookup_cache);
 	sqsh__extract_manager_cleanup(&archive->metablock_extract_manager);
 	sqsh__superblock_cleanup(&archive->superblock);
 	sqsh__map_manager_cleanup(&archive->map_manager);
+	sqsh__cache_budget_cleanup(&archive->cache_budget);
 
 	sqsh__mutex_destroy(&archive->lock);
 
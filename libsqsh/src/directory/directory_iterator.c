@@ -34,7 +34,7 @@
 #include <sqsh_directory_private.h>
 
 #include <cextras/memory.h>
-#include <sqsh_archive.h>
+#include <sqsh_archive_private.h>
 #include <sqsh_common_private.h>
 #include <sqsh_data_private.h>
 #include <sqsh_error.h>
@@ -74,6 +74,10 @@ load_metablock(
 
 static const struct SqshDataDirectoryEntry *
 get_entry(const struct SqshDirectoryIterator *iterator) {
+	if (iterator->lookup_record != NULL) {
+		return sqsh__directory_lookup_table_entry(
+				iterator->lookup_table, iterator->lookup_record);
+	}
 	const uint8_t *data = sqsh__metablock_reader_data(&iterator->metablock);
 	return (const struct SqshDataDirectoryEntry *)data;
 }
@@ -84,6 +88,17 @@ get_fragment(const struct SqshDirectoryIterator *iterator) {
 	return (const struct SqshDataDirectoryFragment *)data;
 }
 
+static int
+compare_name(
+		const char *name, const size_t name_len, const char *other,
+		const size_t other_len) {
+	const int rv = memcmp(name, other, SQSH_MIN(name_len, other_len));
+	if (rv != 0 || name_len == other_len) {
+		return rv;
+	}
+	return name_len < other_len ? -1 : 1;
+}
+
 static int
 directory_iterator_index_lookup(
 		struct SqshDirectoryIterator *iterator, const char *name,
@@ -106,9 +121,7 @@ directory_iterator_index_lookup(
 		const uint32_t index_name_size =
 				sqsh__directory_index_iterator_name_size(&index_iterator);
 
-		const size_t cmp_size = SQSH_MIN(index_name_size, name_len);
-		/* BUG: the branch could be taken too early when the name is a prefix */
-		if (strncmp(name, index_name, cmp_size) < 0) {
+		if (compare_name(name, name_len, index_name, index_name_size) < 0) {
 			break;
 		}
 		outer_offset = sqsh__directory_index_iterator_start(&index_iterator);
@@ -182,12 +195,42 @@ process_fragment(struct SqshDirectoryIterator *iterator) {
 	return rv;
 }
 
+static bool
+is_at_start(const struct SqshDirectoryIterator *iterator) {
+	return iterator->lookup_record == NULL &&
+			iterator->remaining_entries == 0 &&
+			(uint64_t)iterator->remaining_size + 3 ==
+			sqsh_file_size(iterator->file);
+}
+
+static void
+leave_lookup_table(struct SqshDirectoryIterator *iterator) {
+	const struct SqshDirectoryLookupRecord *record = iterator->lookup_record;
+
+	if (record == NULL) {
+		return;
+	}
+
+	/* Entries found through the lookup table are served from the table, so
+	 * the metablock reader still points to the start of the listing. Move
+	 * the iterator behind the entry to continue from there. */
+	iterator->next_offset += record->position;
+	iterator->remaining_size -= record->position;
+	iterator->remaining_entries = record->remaining_entries;
+
+	iterator->lookup_record = NULL;
+	sqsh__directory_lookup_table_release(iterator->lookup_table);
+	iterator->lookup_table = NULL;
+}
+
 static bool
 directory_iterator_next(struct SqshDirectoryIterator *iterator, int *err) {
 	int rv = 0;
 	size_t size;
 	bool has_next = false;
 
+	leave_lookup_table(iterator);
+
 	if (iterator->remaining_size == 0) {
 		if (iterator->remaining_entries != 0) {
 			rv = -SQSH_ERROR_CORRUPTED_DIRECTORY_HEADER;
@@ -299,13 +342,52 @@ out:
 	return rv;
 }
 
+static int
+directory_iterator_table_lookup(
+		struct SqshDirectoryIterator *iterator,
+		struct SqshDirectoryLookupTable *table, const char *name,
+		const size_t name_len) {
+	const struct SqshDirectoryLookupRecord *record =
+			sqsh__directory_lookup_table_find(table, name, name_len);
+	if (record == NULL) {
+		sqsh__directory_lookup_table_release(table);
+		return -SQSH_ERROR_NO_SUCH_FILE;
+	}
+
+	iterator->lookup_table = table;
+	iterator->lookup_record = record;
+	iterator->start_base = record->start_base;
+	iterator->inode_base = record->inode_base;
+
+	/* The entry was already checked while the table was built. */
+	return update_inode(iterator);
+}
+
 int
 sqsh_directory_iterator_lookup(
 		struct SqshDirectoryIterator *iterator, const char *name,
 		const size_t name_len) {
 	int rv = 0;
 
-	if (sqsh_file_is_extended(iterator->file)) {
+	leave_lookup_table(iterator);
+	const bool at_start = is_at_start(iterator);
+
+	if (at_start) {
+		struct SqshDirectoryLookupTable *table = NULL;
+		rv = sqsh__directory_lookup_cache_get(
+				sqsh__archive_directory_lookup_cache(iterator->file->archive),
+				iterator->file, &table);
+		if (rv < 0) {
+			return rv;
+		}
+		if (table != NULL) {
+			return directory_iterator_table_lookup(
+					iterator, table, name, name_len);
+		}
+	}
+
+	/* The directory index points into the listing relative to its start. */
+	if (at_start && sqsh_file_is_extended(iterator->file)) {
 		rv = directory_iterator_index_lookup(iterator, name, name_len);
 		if (rv < 0) {
 			return rv;
@@ -341,6 +423,8 @@ sqsh__directory_iterator_init(
 	}
 
 	iterator->file = file;
+	iterator->lookup_table = NULL;
+	iterator->lookup_record = NULL;
 
 	if (SQSH_SUB_OVERFLOW(sqsh_file_size(file), 3, &iterator->remaining_size)) {
 		return -SQSH_ERROR_INTEGER_OVERFLOW;
@@ -481,8 +565,16 @@ sqsh_directory_iterator_name_dup(const struct SqshDirectoryIterator *iterator) {
 	return cx_memdup(entry_name, size);
 }
 
+const struct SqshDataDirectoryEntry *
+sqsh__directory_iterator_entry(const struct SqshDirectoryIterator *iterator) {
+	return get_entry(iterator);
+}
+
 int
 sqsh__directory_iterator_cleanup(struct SqshDirectoryIterator *iterator) {
+	iterator->lookup_record = NULL;
+	sqsh__directory_lookup_table_release(iterator->lookup_table);
+	iterator->lookup_table = NULL;
 	return sqsh__metablock_reader_cleanup(&iterator->metablock);
 }
 
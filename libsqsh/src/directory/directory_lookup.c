@@ -0,0 +1,453 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         directory_lookup.c
+ */
+
+#include <sqsh_directory_private.h>
+
+#include <sqsh_archive.h>
+#include <sqsh_common_private.h>
+#include <sqsh_data_private.h>
+#include <sqsh_error.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint32_t EMPTY_SLOT = UINT32_MAX;
+
+static uint32_t
+hash_name(const char *name, size_t name_len) {
+	return (uint32_t)sqsh__hash_fnv1a(SQSH_HASH_FNV1A_INIT, name, name_len);
+}
+
+static const struct SqshDirectoryLookupRecord *
+get_records(const struct SqshDirectoryLookupTable *table) {
+	return (const struct SqshDirectoryLookupRecord *)cx_buffer_data(
+			&table->records);
+}
+
+static size_t
+record_count(const struct SqshDirectoryLookupTable *table) {
+	return cx_buffer_size(&table->records) /
+			sizeof(struct SqshDirectoryLookupRecord);
+}
+
+static bool
+record_matches(
+		const struct SqshDirectoryLookupTable *table,
+		const struct SqshDirectoryLookupRecord *record, uint32_t hash,
+		const char *name, size_t name_len) {
+	if (record->hash != hash) {
+		return false;
+	}
+	const struct SqshDataDirectoryEntry *entry =
+			sqsh__directory_lookup_table_entry(table, record);
+	const size_t entry_name_len =
+			(size_t)sqsh__data_directory_entry_name_size(entry) + 1;
+	return entry_name_len == name_len &&
+			memcmp(sqsh__data_directory_entry_name(entry), name, name_len) ==
+			0;
+}
+
+static int
+lookup_table_add(
+		struct SqshDirectoryLookupTable *table,
+		const struct SqshDirectoryIterator *iterator, uint32_t position) {
+	int rv = 0;
+	size_t name_size;
+	const char *name = sqsh_directory_iterator_name2(iterator, &name_size);
+	const size_t entry_size =
+			sizeof(struct SqshDataDirectoryEntry) + name_size;
+	const size_t entry_offset = cx_buffer_size(&table->entries);
+	if (entry_offset > UINT32_MAX - entry_size) {
+		return -SQSH_ERROR_INTEGER_OVERFLOW;
+	}
+
+	rv = cx_buffer_append(
+			&table->entries,
+			(const uint8_t *)sqsh__directory_iterator_entry(iterator),
+			entry_size);
+	if (rv < 0) {
+		return rv;
+	}
+
+	const struct SqshDirectoryLookupRecord record = {
+			.hash = hash_name(name, name_size),
+			.entry_offset = (uint32_t)entry_offset,
+			.position = position,
+			.remaining_entries = (uint32_t)iterator->remaining_entries,
+			.start_base = iterator->start_base,
+			.inode_base = iterator->inode_base,
+	};
+	return cx_buffer_append(
+			&table->records, (const uint8_t *)&record, sizeof(record));
+}
+
+static int
+lookup_table_index(struct SqshDirectoryLookupTable *table) {
+	const struct SqshDirectoryLookupRecord *records = get_records(table);
+	const size_t count = record_count(table);
+	size_t slot_count = 2;
+
+	if (count >= EMPTY_SLOT) {
+		return -SQSH_ERROR_INTEGER_OVERFLOW;
+	}
+	// Keep the table at most half full so probe sequences stay short.
+	while (slot_count < count * 2) {
+		slot_count *= 2;
+	}
+	table->slots = malloc(slot_count * sizeof(uint32_t));
+	if (table->slots == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	memset(table->slots, 0xFF, slot_count * sizeof(uint32_t));
+	table->slot_mask = slot_count - 1;
+
+	for (uint32_t i = 0; i < count; i++) {
+		const struct SqshDirectoryLookupRecord *record = &records[i];
+		const struct SqshDataDirectoryEntry *entry =
+				sqsh__directory_lookup_table_entry(table, record);
+		const char *name = (const char *)sqsh__data_directory_entry_name(entry);
+		const size_t name_len =
+				(size_t)sqsh__data_directory_entry_name_size(entry) + 1;
+
+		size_t slot = record->hash & table->slot_mask;
+		for (; table->slots[slot] != EMPTY_SLOT;
+			 slot = (slot + 1) & table->slot_mask) {
+			// A corrupted listing may contain a name twice. Like a linear
+			// scan, lookups return the first of them.
+			if (record_matches(
+						table, &records[table->slots[slot]], record->hash,
+						name, name_len)) {
+				break;
+			}
+		}
+		if (table->slots[slot] == EMPTY_SLOT) {
+			table->slots[slot] = i;
+		}
+	}
+	return 0;
+}
+
+static int
+lookup_table_cleanup(struct SqshDirectoryLookupTable *table) {
+	free(table->slots);
+	cx_buffer_cleanup(&table->records);
+	cx_buffer_cleanup(&table->entries);
+	return 0;
+}
+
+static int
+lookup_table_init(
+		struct SqshDirectoryLookupTable *table,
+		const struct SqshFile *directory) {
+	int rv = 0;
+	struct SqshDirectoryIterator iterator = {0};
+
+	table->inode_ref = sqsh_file_inode_ref(directory);
+	rv = cx_buffer_init(&table->entries);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = cx_buffer_init(&table->records);
+	if (rv < 0) {
+		goto out;
+	}
+
+	rv = sqsh__directory_iterator_init(&iterator, directory);
+	if (rv < 0) {
+		goto out;
+	}
+	const uint32_t listing_size = iterator.remaining_size;
+	while (sqsh_directory_iterator_next(&iterator, &rv)) {
+		rv = lookup_table_add(
+				table, &iterator, listing_size - iterator.remaining_size);
+		if (rv < 0) {
+			goto out;
+		}
+	}
+	if (rv < 0) {
+		goto out;
+	}
+
+	rv = lookup_table_index(table);
+	if (rv < 0) {
+		goto out;
+	}
+	table->size = sizeof(*table) + cx_buffer_size(&table->entries) +
+			cx_buffer_size(&table->records) +
+			(table->slot_mask + 1) * sizeof(uint32_t);
+out:
+	sqsh__directory_iterator_cleanup(&iterator);
+	if (rv < 0) {
+		lookup_table_cleanup(table);
+	}
+	return rv;
+}
+
+static struct SqshDirectoryLookupTable *
+lookup_table_new(const struct SqshFile *directory, int *err) {
+	SQSH_NEW_IMPL(
+			lookup_table_init, struct SqshDirectoryLookupTable, directory);
+}
+
+const struct SqshDirectoryLookupRecord *
+sqsh__directory_lookup_table_find(
+		const struct SqshDirectoryLookupTable *table, const char *name,
+		size_t name_len) {
+	const struct SqshDirectoryLookupRecord *records = get_records(table);
+	const uint32_t hash = hash_name(name, name_len);
+
+	for (size_t slot = hash & table->slot_mask;
+		 table->slots[slot] != EMPTY_SLOT;
+		 slot = (slot + 1) & table->slot_mask) {
+		const struct SqshDirectoryLookupRecord *record =
+				&records[table->slots[slot]];
+		if (record_matches(table, record, hash, name, name_len)) {
+			return record;
+		}
+	}
+	return NULL;
+}
+
+const struct SqshDataDirectoryEntry *
+sqsh__directory_lookup_table_entry(
+		const struct SqshDirectoryLookupTable *table,
+		const struct SqshDirectoryLookupRecord *record) {
+	const uint8_t *data = cx_buffer_data(&table->entries);
+	return (const struct SqshDataDirectoryEntry *)&data[record->entry_offset];
+}
+
+int
+sqsh__directory_lookup_table_release(struct SqshDirectoryLookupTable *table) {
+	if (table == NULL) {
+		return 0;
+	}
+	if (__atomic_sub_fetch(&table->references, 1, __ATOMIC_ACQ_REL) == 0) {
+		lookup_table_cleanup(table);
+		free(table);
+	}
+	return 0;
+}
+
+static void
+cache_remove(struct SqshDirectoryLookupCache *cache, size_t index) {
+	struct SqshDirectoryLookupTable *table = cache->tables[index];
+	struct SqshCacheBudget *budget = cache->budget_list.budget;
+
+	// The budget list shares the reference of the slot. The bytes are
+	// uncharged once the cache drops the table, even if a directory
+	// iterator still holds on to it.
+	if (budget != NULL) {
+		(void)sqsh__cache_budget_list_remove(
+				&cache->budget_list, &table->budget_entry);
+		sqsh__cache_budget_uncharge(budget, table->size);
+	}
+	cache->tables[index] = NULL;
+	sqsh__directory_lookup_table_release(table);
+}
+
+static int
+budget_evict(struct SqshCacheBudgetList *list) {
+	const size_t offset =
+			offsetof(struct SqshDirectoryLookupCache, budget_list);
+	struct SqshDirectoryLookupCache *cache =
+			(struct SqshDirectoryLookupCache *)((uint8_t *)list - offset);
+
+	int rv = sqsh__mutex_lock(&cache->lock);
+	if (rv < 0) {
+		goto out;
+	}
+	struct SqshCacheBudgetEntry *entry = sqsh__cache_budget_list_pop(list);
+	if (entry != NULL) {
+		cache_remove(cache, (size_t)entry->index);
+		rv = 1;
+	}
+	sqsh__mutex_unlock(&cache->lock);
+
+out:
+	return rv;
+}
+
+int
+sqsh__directory_lookup_cache_init(
+		struct SqshDirectoryLookupCache *cache, size_t size, uint64_t min_size,
+		struct SqshCacheBudget *budget) {
+	int rv = 0;
+
+	cache->size = size;
+	cache->min_size = min_size;
+	cache->clock = 0;
+	cache->tables = NULL;
+	cache->budget_list.budget = NULL;
+	if (size > 0) {
+		cache->tables = calloc(size, sizeof(*cache->tables));
+		if (cache->tables == NULL) {
+			return -SQSH_ERROR_MALLOC_FAILED;
+		}
+	}
+	rv = sqsh__mutex_init(&cache->lock);
+	if (rv < 0) {
+		free(cache->tables);
+		cache->tables = NULL;
+		return rv;
+	}
+	if (budget != NULL && size > 0) {
+		rv = sqsh__cache_budget_register(
+				budget, &cache->budget_list, budget_evict);
+		if (rv < 0) {
+			sqsh__directory_lookup_cache_cleanup(cache);
+		}
+	}
+	return rv;
+}
+
+static struct SqshDirectoryLookupTable *
+cache_find(struct SqshDirectoryLookupCache *cache, uint64_t inode_ref) {
+	for (size_t i = 0; i < cache->size; i++) {
+		struct SqshDirectoryLookupTable *table = cache->tables[i];
+		if (table != NULL && table->inode_ref == inode_ref) {
+			table->last_use = ++cache->clock;
+			if (cache->budget_list.budget != NULL) {
+				(void)sqsh__cache_budget_list_touch(
+						&cache->budget_list, &table->budget_entry, i);
+			}
+			__atomic_add_fetch(&table->references, 1, __ATOMIC_RELAXED);
+			return table;
+		}
+	}
+	return NULL;
+}
+
+static void
+cache_insert(
+		struct SqshDirectoryLookupCache *cache,
+		struct SqshDirectoryLookupTable *table) {
+	size_t victim = 0;
+	for (size_t i = 0; i < cache->size; i++) {
+		if (cache->tables[i] == NULL) {
+			victim = i;
+			break;
+		} else if (
+				cache->tables[i]->last_use <
+				cache->tables[victim]->last_use) {
+			victim = i;
+		}
+	}
+	if (cache->tables[victim] != NULL) {
+		cache_remove(cache, victim);
+	}
+
+	// one reference is held by the cache, the other one by the caller.
+	table->references = 2;
+	table->last_use = ++cache->clock;
+	cache->tables[victim] = table;
+	if (cache->budget_list.budget != NULL) {
+		sqsh__cache_budget_charge(cache->budget_list.budget, table->size);
+		(void)sqsh__cache_budget_list_touch(
+				&cache->budget_list, &table->budget_entry, victim);
+	}
+}
+
+int
+sqsh__directory_lookup_cache_get(
+		struct SqshDirectoryLookupCache *cache,
+		const struct SqshFile *directory,
+		struct SqshDirectoryLookupTable **table) {
+	int rv = 0;
+	struct SqshDirectoryLookupTable *new_table = NULL;
+	const uint64_t inode_ref = sqsh_file_inode_ref(directory);
+
+	*table = NULL;
+	if (cache->size == 0 || sqsh_file_size(directory) < cache->min_size) {
+		return 0;
+	}
+
+	rv = sqsh__mutex_lock(&cache->lock);
+	if (rv < 0) {
+		return rv;
+	}
+	*table = cache_find(cache, inode_ref);
+	sqsh__mutex_unlock(&cache->lock);
+	if (*table != NULL) {
+		return 0;
+	}
+
+	// The table is built without holding the lock, so lookups in other
+	// directories are not blocked by reading a large listing.
+	new_table = lookup_table_new(directory, &rv);
+	if (rv < 0) {
+		return rv;
+	}
+
+	rv = sqsh__mutex_lock(&cache->lock);
+	if (rv < 0) {
+		lookup_table_cleanup(new_table);
+		free(new_table);
+		return rv;
+	}
+	*table = cache_find(cache, inode_ref);
+	if (*table == NULL) {
+		cache_insert(cache, new_table);
+		*table = new_table;
+		new_table = NULL;
+	}
+	sqsh__mutex_unlock(&cache->lock);
+
+	if (new_table != NULL) {
+		// Another thread built the same table in the meantime.
+		lookup_table_cleanup(new_table);
+		free(new_table);
+	} else if (cache->budget_list.budget != NULL) {
+		rv = sqsh__cache_budget_enforce(cache->budget_list.budget);
+		if (rv < 0) {
+			sqsh__directory_lookup_table_release(*table);
+			*table = NULL;
+		}
+	}
+	return rv;
+}
+
+int
+sqsh__directory_lookup_cache_cleanup(struct SqshDirectoryLookupCache *cache) {
+	for (size_t i = 0; cache->tables != NULL && i < cache->size; i++) {
+		if (cache->tables[i] != NULL) {
+			cache_remove(cache, i);
+		}
+	}
+	sqsh__cache_budget_unregister(&cache->budget_list);
+	free(cache->tables);
+	cache->tables = NULL;
+	sqsh__mutex_destroy(&cache->lock);
+	return 0;
+}
@@ -33,17 +33,144 @@
 
 #include <sqsh_extract_private.h>
 
-#include <sqsh_archive.h>
+#include <sqsh_archive_private.h>
 #include <sqsh_common_private.h>
 #include <sqsh_error.h>
 
 #include <cextras/collection.h>
 #include <sqsh_mapper.h>
 #include <sqsh_mapper_private.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct SqshExtractInflight {
+	uint64_t address;
+	struct SqshExtractInflight *next;
+};
+
+/* The cache stores the decompressed buffer together with its shard, so
+ * evictions can be accounted for. `buffer` must stay the first member as
+ * the rest of the library treats cache entries as `struct CxBuffer`. */
+struct SqshExtractCacheEntry {
+	struct CxBuffer buffer;
+	struct SqshExtractManagerShard *shard;
+	struct SqshCacheBudgetEntry budget_entry;
+};
+
+static void
+buffer_cleanup(void *data) {
+	struct SqshExtractCacheEntry *entry = data;
+	struct SqshExtractManager *manager = entry->shard->manager;
+	__atomic_fetch_add(&manager->stats.evictions, 1, __ATOMIC_RELAXED);
+	if (manager->budget != NULL) {
+		sqsh__cache_budget_uncharge(
+				manager->budget, cx_buffer_size(&entry->buffer));
+	}
+	cx_buffer_cleanup(&entry->buffer);
+}
+
+static struct SqshExtractManagerShard *
+get_shard(const struct SqshExtractManager *manager, uint64_t address) {
+	// Block addresses are byte offsets into the archive and share their low
+	// bits depending on the block sizes. Mix them before picking a shard.
+	const uint64_t hash = sqsh__hash_mix(address);
+	return &manager->shards[hash % manager->shard_count];
+}
+
+static int
+lock_shard(struct SqshExtractManagerShard *shard) {
+	return sqsh__mutex_lock_counted(
+			&shard->lock, &shard->manager->stats.lock_contentions,
+			&shard->manager->stats.lock_wait_ns);
+}
+
+static int
+budget_evict(struct SqshCacheBudgetList *list) {
+	const size_t offset = offsetof(struct SqshExtractManagerShard, budget_list);
+	struct SqshExtractManagerShard *shard =
+			(struct SqshExtractManagerShard *)((uint8_t *)list - offset);
+
+	int rv = lock_shard(shard);
+	if (rv < 0) {
+		goto out;
+	}
+	struct SqshCacheBudgetEntry *entry = sqsh__cache_budget_list_pop(list);
+	if (entry != NULL) {
+		cx_rc_radix_tree_release(&shard->cache, entry->index);
+		rv = 1;
+	}
+	sqsh__mutex_unlock(&shard->lock);
+
+out:
+	return rv;
+}
+
+static void
+budget_touch(
+		struct SqshExtractManagerShard *shard, struct CxBuffer *buffer,
+		uint64_t address) {
+	struct SqshExtractCacheEntry *entry =
+			(struct SqshExtractCacheEntry *)buffer;
+	if (shard->budget_list.budget == NULL) {
+		return;
+	}
+
+	if (sqsh__cache_budget_list_touch(
+				&shard->budget_list, &entry->budget_entry, address)) {
+		cx_rc_radix_tree_retain_value(&shard->cache, entry);
+	}
+}
+
+static int
+shard_init(
+		struct SqshExtractManagerShard *shard,
+		struct SqshExtractManager *manager, size_t lru_size) {
+	int rv;
+
+	shard->manager = manager;
+	shard->inflight = NULL;
+	rv = sqsh__mutex_init(&shard->lock);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = sqsh__cond_init(&shard->inflight_cond);
+	if (rv < 0) {
+		goto out_lock;
+	}
+	rv = cx_rc_radix_tree_init(
+			&shard->cache, sizeof(struct SqshExtractCacheEntry),
+			buffer_cleanup);
+	if (rv < 0) {
+		goto out_cond;
+	}
+	rv = cx_lru_init(
+			&shard->lru, lru_size, &cx_lru_rc_radix_tree, &shard->cache);
+	if (rv < 0) {
+		cx_rc_radix_tree_cleanup(&shard->cache);
+		goto out_cond;
+	}
+	return 0;
+
+out_cond:
+	sqsh__cond_destroy(&shard->inflight_cond);
+out_lock:
+	sqsh__mutex_destroy(&shard->lock);
+out:
+	return rv;
+}
 
 static void
-buffer_cleanup(void *buffer) {
-	cx_buffer_cleanup(buffer);
+shard_cleanup(struct SqshExtractManagerShard *shard) {
+	struct SqshCacheBudgetEntry *entry;
+	sqsh__cache_budget_unregister(&shard->budget_list);
+	while ((entry = sqsh__cache_budget_list_pop(&shard->budget_list))) {
+		cx_rc_radix_tree_release(&shard->cache, entry->index);
+	}
+	cx_lru_cleanup(&shard->lru);
+	cx_rc_radix_tree_cleanup(&shard->cache);
+	sqsh__cond_destroy(&shard->inflight_cond);
+	sqsh__mutex_destroy(&shard->lock);
 }
 
 SQSH_NO_UNUSED int
@@ -54,30 +181,54 @@ sqsh__extract_manager_init(
 	const struct SqshSuperblock *superblock = sqsh_archive_superblock(archive);
 	enum SqshSuperblockCompressionId compression_id =
 			sqsh_superblock_compression_id(superblock);
+	const struct SqshConfig *config = sqsh_archive_config(archive);
+	const size_t shard_count =
+			SQSH_MAX(SQSH_CONFIG_DEFAULT(config->cache_shards, 1), 1);
 
 	manager->extractor_impl = sqsh__extractor_impl_from_id(compression_id);
 	if (manager->extractor_impl == NULL) {
 		return -SQSH_ERROR_COMPRESSION_UNSUPPORTED;
 	}
 
-	rv = sqsh__mutex_init(&manager->lock);
+	memset(&manager->stats, 0, sizeof(manager->stats));
+	manager->budget = NULL;
+	manager->shards = NULL;
+	manager->shard_count = 0;
+	rv = sqsh__extractor_pool_init(
+			&manager->extractor_pool, manager->extractor_impl);
 	if (rv < 0) {
 		goto out;
 	}
-	rv = cx_rc_radix_tree_init(
-			&manager->cache, sizeof(struct CxBuffer), buffer_cleanup);
-	if (rv < 0) {
+	manager->shards = calloc(shard_count, sizeof(*manager->shards));
+	if (manager->shards == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
 		goto out;
 	}
-	rv = cx_lru_init(
-			&manager->lru, lru_size, &cx_lru_rc_radix_tree, &manager->cache);
-	if (rv < 0) {
-		goto out;
+	for (size_t i = 0; i < shard_count; i++) {
+		rv = shard_init(
+				&manager->shards[i], manager,
+				SQSH_DIVIDE_CEIL(lru_size, shard_count));
+		if (rv < 0) {
+			goto out;
+		}
+		manager->shard_count++;
 	}
 	manager->map_manager = sqsh_archive_map_manager(archive);
 
 	manager->block_size = block_size;
 
+	struct SqshCacheBudget *budget = sqsh__archive_cache_budget(archive);
+	if (budget != NULL) {
+		for (size_t i = 0; i < shard_count; i++) {
+			rv = sqsh__cache_budget_register(
+					budget, &manager->shards[i].budget_list, budget_evict);
+			if (rv < 0) {
+				goto out;
+			}
+		}
+		manager->budget = budget;
+	}
+
 out:
 	if (rv < 0) {
 		sqsh__extract_manager_cleanup(manager);
@@ -90,7 +241,6 @@ extract(struct SqshExtractManager *manager, const struct SqshMapReader *reader,
 		struct CxBuffer *buffer) {
 	int rv = 0;
 	struct SqshExtractor extractor = {0};
-	const struct SqshExtractorImpl *extractor_impl = manager->extractor_impl;
 	const uint32_t block_size = manager->block_size;
 	const size_t size = sqsh__map_reader_size(reader);
 
@@ -100,17 +250,13 @@ extract(struct SqshExtractManager *manager, const struct SqshMapReader *reader,
 	}
 	const uint8_t *data = sqsh__map_reader_data(reader);
 
-	rv = sqsh__extractor_init(&extractor, buffer, extractor_impl, block_size);
+	rv = sqsh__extractor_init_from_pool(
+			&extractor, buffer, &manager->extractor_pool, block_size);
 	if (rv < 0) {
 		goto out;
 	}
 
-	rv = sqsh__extractor_write(&extractor, data, size);
-	if (rv < 0) {
-		goto out;
-	}
-
-	rv = sqsh__extractor_finish(&extractor);
+	rv = sqsh__extractor_decompress_once(&extractor, data, size);
 	if (rv < 0) {
 		goto out;
 	}
@@ -123,6 +269,28 @@ out:
 	return rv;
 }
 
+static bool
+is_inflight(const struct SqshExtractManagerShard *shard, uint64_t address) {
+	for (const struct SqshExtractInflight *inflight = shard->inflight;
+		 inflight != NULL; inflight = inflight->next) {
+		if (inflight->address == address) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+remove_inflight(
+		struct SqshExtractManagerShard *shard,
+		struct SqshExtractInflight *inflight) {
+	struct SqshExtractInflight **it = &shard->inflight;
+	while (*it != inflight) {
+		it = &(*it)->next;
+	}
+	*it = inflight->next;
+}
+
 int
 sqsh__extract_manager_uncompress(
 		struct SqshExtractManager *manager, const struct SqshMapReader *reader,
@@ -130,44 +298,85 @@ sqsh__extract_manager_uncompress(
 	int rv = 0;
 	bool locked = false;
 	struct CxBuffer *buffer = NULL;
+	const uint64_t address = sqsh__map_reader_address(reader);
+	struct SqshExtractManagerShard *shard = get_shard(manager, address);
 
-	rv = sqsh__mutex_lock(&manager->lock);
+	rv = lock_shard(shard);
 	if (rv < 0) {
 		goto out;
 	}
 	locked = true;
 
-	const uint64_t address = sqsh__map_reader_address(reader);
-
-	buffer = cx_rc_radix_tree_retain(&manager->cache, address);
+	// If another thread is already decompressing this block, wait for it
+	// to publish the result instead of doing the same work again. If that
+	// thread fails, the block is not in the cache afterwards and this
+	// thread tries itself.
+	for (;;) {
+		buffer = cx_rc_radix_tree_retain(&shard->cache, address);
+		if (buffer != NULL || !is_inflight(shard, address)) {
+			break;
+		}
+		rv = sqsh__cond_wait(&shard->inflight_cond, &shard->lock);
+		if (rv < 0) {
+			goto out;
+		}
+	}
 
 	if (buffer == NULL) {
-		struct CxBuffer tmp_buffer = {0};
-		rv = sqsh__mutex_unlock(&manager->lock);
+		struct SqshExtractCacheEntry entry = {.shard = shard};
+		struct SqshExtractInflight inflight = {
+				.address = address,
+				.next = shard->inflight,
+		};
+		shard->inflight = &inflight;
+
+		rv = sqsh__mutex_unlock(&shard->lock);
 		if (rv < 0) {
 			goto out;
 		}
 		locked = false;
 
-		rv = extract(manager, reader, &tmp_buffer);
+		__atomic_fetch_add(&manager->stats.misses, 1, __ATOMIC_RELAXED);
+		const int extract_rv = extract(manager, reader, &entry.buffer);
+
+		rv = lock_shard(shard);
 		if (rv < 0) {
 			goto out;
 		}
+		locked = true;
+
+		remove_inflight(shard, &inflight);
+		sqsh__cond_broadcast(&shard->inflight_cond);
 
-		rv = sqsh__mutex_lock(&manager->lock);
+		rv = extract_rv;
 		if (rv < 0) {
 			goto out;
 		}
-		locked = true;
 
-		buffer = cx_rc_radix_tree_put(&manager->cache, address, &tmp_buffer);
+		__atomic_fetch_add(
+				&manager->stats.bytes_in, sqsh__map_reader_size(reader),
+				__ATOMIC_RELAXED);
+		__atomic_fetch_add(
+				&manager->stats.bytes_out, cx_buffer_size(&entry.buffer),
+				__ATOMIC_RELAXED);
+		if (manager->budget != NULL) {
+			sqsh__cache_budget_charge(
+					manager->budget, cx_buffer_size(&entry.buffer));
+		}
+		buffer = cx_rc_radix_tree_put(&shard->cache, address, &entry);
+	} else {
+		__atomic_fetch_add(&manager->stats.hits, 1, __ATOMIC_RELAXED);
 	}
-	rv = cx_lru_touch_value(&manager->lru, address, buffer);
+	budget_touch(shard, buffer, address);
+	rv = cx_lru_touch_value(&shard->lru, address, buffer);
 	*target = buffer;
 
 out:
 	if (locked) {
-		sqsh__mutex_unlock(&manager->lock);
+		sqsh__mutex_unlock(&shard->lock);
+	}
+	if (rv >= 0 && manager->budget != NULL) {
+		rv = sqsh__cache_budget_enforce(manager->budget);
 	}
 	return rv;
 }
@@ -175,30 +384,53 @@ out:
 int
 sqsh__extract_manager_retain_buffer(
 		struct SqshExtractManager *manager, struct CxBuffer *buffer) {
-	cx_rc_radix_tree_retain_value(&manager->cache, buffer);
+	(void)manager;
+	struct SqshExtractCacheEntry *entry =
+			(struct SqshExtractCacheEntry *)buffer;
+	cx_rc_radix_tree_retain_value(&entry->shard->cache, buffer);
 	return 0;
 }
 
 int
 sqsh__extract_manager_release(
 		struct SqshExtractManager *manager, uint64_t address) {
-	int rv = sqsh__mutex_lock(&manager->lock);
+	struct SqshExtractManagerShard *shard = get_shard(manager, address);
+	int rv = lock_shard(shard);
 	if (rv < 0) {
 		goto out;
 	}
 
-	rv = cx_rc_radix_tree_release(&manager->cache, address);
+	rv = cx_rc_radix_tree_release(&shard->cache, address);
 
-	sqsh__mutex_unlock(&manager->lock);
+	sqsh__mutex_unlock(&shard->lock);
 out:
 	return rv;
 }
 
+void
+sqsh__extract_manager_stats(
+		const struct SqshExtractManager *manager,
+		struct SqshCacheStats *stats) {
+	const struct SqshCacheStats *src = &manager->stats;
+	stats->hits = __atomic_load_n(&src->hits, __ATOMIC_RELAXED);
+	stats->misses = __atomic_load_n(&src->misses, __ATOMIC_RELAXED);
+	stats->evictions = __atomic_load_n(&src->evictions, __ATOMIC_RELAXED);
+	stats->bytes_in = __atomic_load_n(&src->bytes_in, __ATOMIC_RELAXED);
+	stats->bytes_out = __atomic_load_n(&src->bytes_out, __ATOMIC_RELAXED);
+	stats->lock_contentions =
+			__atomic_load_n(&src->lock_contentions, __ATOMIC_RELAXED);
+	stats->lock_wait_ns = __atomic_load_n(&src->lock_wait_ns, __ATOMIC_RELAXED);
+}
+
 int
 sqsh__extract_manager_cleanup(struct SqshExtractManager *manager) {
-	cx_lru_cleanup(&manager->lru);
-	cx_rc_radix_tree_cleanup(&manager->cache);
-	sqsh__mutex_destroy(&manager->lock);
+	for (size_t i = 0; i < manager->shard_count; i++) {
+		shard_cleanup(&manager->shards[i]);
+	}
+	free(manager->shards);
+	manager->shards = NULL;
+	manager->shard_count = 0;
+	sqsh__extractor_pool_cleanup(&manager->extractor_pool);
 
 	return 0;
 }
@@ -36,6 +36,12 @@
 #include <cextras/collection.h>
 #include <sqsh_archive.h>
 #include <sqsh_error.h>
+#include <stdlib.h>
+
+struct SqshExtractorPoolEntry {
+	struct SqshExtractorPoolEntry *next;
+	sqsh__extractor_context_t context;
+};
 
 // sqsh__impl_lzo needs to be declared `volatile`. Otherwise when compiled with
 // `-O2` this value might get inlined which breaks a) the the tests and b) the
@@ -63,11 +69,36 @@ sqsh__extractor_impl_from_id(enum SqshSuperblockCompressionId id) {
 	}
 }
 
+static bool
+is_reusable(const struct SqshExtractorImpl *impl) {
+	return impl->finish_keep != NULL && impl->reset != NULL &&
+			impl->destroy != NULL;
+}
+
+static void *
+extractor_context(struct SqshExtractor *extractor) {
+	if (extractor->pool_entry != NULL) {
+		return extractor->pool_entry->context;
+	} else {
+		return extractor->context;
+	}
+}
+
+static void
+pool_entry_destroy(
+		const struct SqshExtractorImpl *impl,
+		struct SqshExtractorPoolEntry *entry) {
+	impl->destroy(entry->context);
+	free(entry);
+}
+
 int
 sqsh__extractor_init(
 		struct SqshExtractor *extractor, struct CxBuffer *buffer,
 		const struct SqshExtractorImpl *impl, size_t block_size) {
 	int rv = 0;
+	extractor->pool = NULL;
+	extractor->pool_entry = NULL;
 	if (impl == NULL) {
 		rv = -SQSH_ERROR_COMPRESSION_UNSUPPORTED;
 		goto out;
@@ -89,13 +120,72 @@ out:
 	return rv;
 }
 
+int
+sqsh__extractor_init_from_pool(
+		struct SqshExtractor *extractor, struct CxBuffer *buffer,
+		struct SqshExtractorPool *pool, size_t block_size) {
+	int rv = 0;
+	const struct SqshExtractorImpl *impl = pool->impl;
+	struct SqshExtractorPoolEntry *entry = NULL;
+
+	if (impl == NULL || !is_reusable(impl)) {
+		return sqsh__extractor_init(extractor, buffer, impl, block_size);
+	}
+
+	extractor->impl = NULL;
+	extractor->pool = pool;
+	extractor->pool_entry = NULL;
+	extractor->block_size = block_size;
+	extractor->buffer = buffer;
+	rv = cx_buffer_add_capacity(buffer, &extractor->target, block_size);
+	if (rv < 0) {
+		goto out;
+	}
+
+	rv = sqsh__mutex_lock(&pool->lock);
+	if (rv < 0) {
+		goto out;
+	}
+	entry = pool->entries;
+	if (entry != NULL) {
+		pool->entries = entry->next;
+	}
+	sqsh__mutex_unlock(&pool->lock);
+
+	if (entry != NULL) {
+		rv = impl->reset(entry->context, extractor->target, block_size);
+		if (rv < 0) {
+			pool_entry_destroy(impl, entry);
+			entry = NULL;
+		}
+	}
+	if (entry == NULL) {
+		entry = calloc(1, sizeof(*entry));
+		if (entry == NULL) {
+			rv = -SQSH_ERROR_MALLOC_FAILED;
+			goto out;
+		}
+		rv = impl->init(entry->context, extractor->target, block_size);
+		if (rv < 0) {
+			free(entry);
+			goto out;
+		}
+	}
+
+	extractor->pool_entry = entry;
+	extractor->impl = impl;
+
+out:
+	return rv;
+}
+
 int
 sqsh__extractor_write(
 		struct SqshExtractor *extractor, const uint8_t *compressed,
 		const size_t compressed_size) {
 	int rv = 0;
 	const struct SqshExtractorImpl *impl = extractor->impl;
-	sqsh__extractor_context_t *context = &extractor->context;
+	void *context = extractor_context(extractor);
 	if (impl == NULL) {
 		rv = -SQSH_ERROR_COMPRESSION_FINISHED;
 		goto out;
@@ -106,10 +196,37 @@ out:
 	return rv;
 }
 
+static int
+extractor_complete(struct SqshExtractor *extractor, size_t size) {
+	const struct SqshExtractorImpl *impl = extractor->impl;
+	struct SqshExtractorPool *pool = extractor->pool;
+	struct SqshExtractorPoolEntry *entry = extractor->pool_entry;
+	int rv = 0;
+
+	rv = cx_buffer_add_size(extractor->buffer, size);
+	if (rv < 0) {
+		goto out;
+	}
+	extractor->impl = NULL;
+
+	if (entry != NULL) {
+		extractor->pool_entry = NULL;
+		if (sqsh__mutex_lock(&pool->lock) < 0) {
+			pool_entry_destroy(impl, entry);
+			goto out;
+		}
+		entry->next = pool->entries;
+		pool->entries = entry;
+		sqsh__mutex_unlock(&pool->lock);
+	}
+out:
+	return rv;
+}
+
 int
 sqsh__extractor_finish(struct SqshExtractor *extractor) {
 	const struct SqshExtractorImpl *impl = extractor->impl;
-	sqsh__extractor_context_t *context = &extractor->context;
+	void *context = extractor_context(extractor);
 	int rv = 0;
 	size_t size = extractor->block_size;
 	if (impl == NULL) {
@@ -117,16 +234,51 @@ sqsh__extractor_finish(struct SqshExtractor *extractor) {
 		goto out;
 	}
 
-	rv = impl->finish(context, extractor->target, &size);
+	if (extractor->pool_entry != NULL) {
+		rv = impl->finish_keep(context, extractor->target, &size);
+	} else {
+		rv = impl->finish(context, extractor->target, &size);
+	}
 	if (rv < 0) {
 		goto out;
 	}
 
-	rv = cx_buffer_add_size(extractor->buffer, size);
+	rv = extractor_complete(extractor, size);
+out:
+	return rv;
+}
+
+int
+sqsh__extractor_decompress_once(
+		struct SqshExtractor *extractor, const uint8_t *compressed,
+		const size_t compressed_size) {
+	const struct SqshExtractorImpl *impl = extractor->impl;
+	int rv = 0;
+	size_t size = extractor->block_size;
+	if (impl == NULL) {
+		rv = -SQSH_ERROR_COMPRESSION_FINISHED;
+		goto out;
+	}
+
+	// Single call decompression leaves the context in the same state as
+	// finish_keep, so it is only used for pooled contexts.
+	if (impl->decompress_once == NULL || extractor->pool_entry == NULL) {
+		rv = sqsh__extractor_write(extractor, compressed, compressed_size);
+		if (rv < 0) {
+			goto out;
+		}
+		rv = sqsh__extractor_finish(extractor);
+		goto out;
+	}
+
+	rv = impl->decompress_once(
+			extractor->pool_entry->context, compressed, compressed_size,
+			extractor->target, &size);
 	if (rv < 0) {
 		goto out;
 	}
-	extractor->impl = NULL;
+
+	rv = extractor_complete(extractor, size);
 out:
 	return rv;
 }
@@ -134,15 +286,40 @@ out:
 int
 sqsh__extractor_cleanup(struct SqshExtractor *extractor) {
 	const struct SqshExtractorImpl *impl = extractor->impl;
-	sqsh__extractor_context_t *context = &extractor->context;
+	struct SqshExtractorPoolEntry *entry = extractor->pool_entry;
 	int rv = 0;
-	// Make sure we cleanup the compressor in an error case.
-	if (extractor->impl != NULL) {
+	// Make sure we cleanup the compressor in an error case. Contexts that
+	// failed are not returned to the pool.
+	if (entry != NULL) {
+		pool_entry_destroy(impl, entry);
+	} else if (impl != NULL) {
 		size_t dummy_size = 0;
-		rv = impl->finish(context, extractor->target, &dummy_size);
+		rv = impl->finish(extractor->context, extractor->target, &dummy_size);
 	}
 	extractor->impl = NULL;
+	extractor->pool = NULL;
+	extractor->pool_entry = NULL;
 	extractor->block_size = 0;
 	extractor->buffer = NULL;
 	return rv;
 }
+
+int
+sqsh__extractor_pool_init(
+		struct SqshExtractorPool *pool, const struct SqshExtractorImpl *impl) {
+	pool->impl = impl;
+	pool->entries = NULL;
+	return sqsh__mutex_init(&pool->lock);
+}
+
+int
+sqsh__extractor_pool_cleanup(struct SqshExtractorPool *pool) {
+	struct SqshExtractorPoolEntry *entry = pool->entries;
+	while (entry != NULL) {
+		struct SqshExtractorPoolEntry *next = entry->next;
+		pool_entry_destroy(pool->impl, entry);
+		entry = next;
+	}
+	pool->entries = NULL;
+	return sqsh__mutex_destroy(&pool->lock);
+}
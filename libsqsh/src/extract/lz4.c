@@ -77,19 +77,63 @@ sqsh_lz4_decompress(
 }
 
 static int
-sqsh_lz4_finish(void *context, uint8_t *target, size_t *target_size) {
+sqsh_lz4_reset(void *context, uint8_t *target, size_t target_size) {
+	struct SqshLz4Context *ctx = context;
+	if (LZ4_setStreamDecode(ctx->stream, NULL, 0) == 0) {
+		return -SQSH_ERROR_COMPRESSION_INIT;
+	}
+	ctx->target = target;
+	ctx->target_size = target_size;
+	ctx->offset = 0;
+
+	return 0;
+}
+
+static int
+sqsh_lz4_finish_keep(void *context, uint8_t *target, size_t *target_size) {
 	(void)target;
-	(void)target_size;
 	struct SqshLz4Context *ctx = context;
-	LZ4_freeStreamDecode(ctx->stream);
 	*target_size = ctx->offset;
 	return 0;
 }
 
+static void
+sqsh_lz4_destroy(void *context) {
+	struct SqshLz4Context *ctx = context;
+	LZ4_freeStreamDecode(ctx->stream);
+}
+
+static int
+sqsh_lz4_finish(void *context, uint8_t *target, size_t *target_size) {
+	int rv = sqsh_lz4_finish_keep(context, target, target_size);
+	sqsh_lz4_destroy(context);
+	return rv;
+}
+
+static int
+sqsh_lz4_decompress_once(
+		void *context, const uint8_t *compressed, size_t compressed_size,
+		uint8_t *target, size_t *target_size) {
+	struct SqshLz4Context *ctx = context;
+	int size = LZ4_decompress_safe(
+			(const char *)compressed, (char *)target, (int)compressed_size,
+			(int)*target_size);
+	if (size < 0) {
+		return -SQSH_ERROR_COMPRESSION_DECOMPRESS;
+	}
+	ctx->offset = (sqsh_index_t)size;
+	*target_size = (size_t)size;
+	return 0;
+}
+
 static const struct SqshExtractorImpl impl_lz4 = {
 		.init = sqsh_lz4_init,
 		.write = sqsh_lz4_decompress,
 		.finish = sqsh_lz4_finish,
+		.finish_keep = sqsh_lz4_finish_keep,
+		.reset = sqsh_lz4_reset,
+		.destroy = sqsh_lz4_destroy,
+		.decompress_once = sqsh_lz4_decompress_once,
 };
 
 const struct SqshExtractorImpl *const sqsh__impl_lz4 = &impl_lz4;
@@ -50,12 +50,13 @@ enum SqshLzmaType {
 };
 
 static int
-sqsh_lzma_init(
+sqsh_lzma_reset(
 		void *context, uint8_t *target, size_t target_size,
 		enum SqshLzmaType type) {
 	lzma_stream *stream = context;
-	memcpy(stream, &proto_stream, sizeof(lzma_stream));
 
+	// liblzma reuses the memory of the previous decoder if the stream
+	// wasn't ended with lzma_end().
 	lzma_ret ret;
 	if (type == LZMA_TYPE_ALONE) {
 		ret = lzma_alone_decoder(stream, UINT64_MAX);
@@ -73,6 +74,16 @@ sqsh_lzma_init(
 	return 0;
 }
 
+static int
+sqsh_lzma_init(
+		void *context, uint8_t *target, size_t target_size,
+		enum SqshLzmaType type) {
+	lzma_stream *stream = context;
+	memcpy(stream, &proto_stream, sizeof(lzma_stream));
+
+	return sqsh_lzma_reset(context, target, target_size, type);
+}
+
 static int
 sqsh_lzma_init_xz(void *context, uint8_t *target, size_t target_size) {
 	return sqsh_lzma_init(context, target, target_size, LZMA_TYPE_XZ);
@@ -83,6 +94,16 @@ sqsh_lzma_init_alone(void *context, uint8_t *target, size_t target_size) {
 	return sqsh_lzma_init(context, target, target_size, LZMA_TYPE_ALONE);
 }
 
+static int
+sqsh_lzma_reset_xz(void *context, uint8_t *target, size_t target_size) {
+	return sqsh_lzma_reset(context, target, target_size, LZMA_TYPE_XZ);
+}
+
+static int
+sqsh_lzma_reset_alone(void *context, uint8_t *target, size_t target_size) {
+	return sqsh_lzma_reset(context, target, target_size, LZMA_TYPE_ALONE);
+}
+
 static int
 sqsh_lzma_decompress(
 		void *context, const uint8_t *compressed,
@@ -101,7 +122,7 @@ sqsh_lzma_decompress(
 }
 
 static int
-sqsh_lzma_finish(void *context, uint8_t *target, size_t *target_size) {
+sqsh_lzma_finish_keep(void *context, uint8_t *target, size_t *target_size) {
 	(void)target;
 	lzma_stream *stream = context;
 	stream->next_in = NULL;
@@ -109,10 +130,8 @@ sqsh_lzma_finish(void *context, uint8_t *target, size_t *target_size) {
 
 	lzma_ret ret = lzma_code(stream, LZMA_FINISH);
 
-	*target_size = (size_t)stream->total_out;
-	lzma_end(stream);
-
 	if (ret == LZMA_STREAM_END) {
+		*target_size = (size_t)stream->total_out;
 		return 0;
 	} else {
 		*target_size = 0;
@@ -120,10 +139,47 @@ sqsh_lzma_finish(void *context, uint8_t *target, size_t *target_size) {
 	}
 }
 
+static void
+sqsh_lzma_destroy(void *context) {
+	lzma_end(context);
+}
+
+static int
+sqsh_lzma_finish(void *context, uint8_t *target, size_t *target_size) {
+	int rv = sqsh_lzma_finish_keep(context, target, target_size);
+	sqsh_lzma_destroy(context);
+	return rv;
+}
+
+static int
+sqsh_lzma_decompress_once(
+		void *context, const uint8_t *compressed, size_t compressed_size,
+		uint8_t *target, size_t *target_size) {
+	lzma_stream *stream = context;
+
+	// lzma_stream_buffer_decode() would allocate a new decoder for every
+	// block. Running the already initialized decoder once keeps it reusable.
+	stream->next_in = compressed;
+	stream->avail_in = compressed_size;
+	stream->next_out = target;
+	stream->avail_out = *target_size;
+
+	if (lzma_code(stream, LZMA_FINISH) != LZMA_STREAM_END) {
+		return -SQSH_ERROR_COMPRESSION_DECOMPRESS;
+	}
+
+	*target_size = (size_t)stream->total_out;
+	return 0;
+}
+
 static const struct SqshExtractorImpl impl_xz = {
 		.init = sqsh_lzma_init_xz,
 		.write = sqsh_lzma_decompress,
 		.finish = sqsh_lzma_finish,
+		.finish_keep = sqsh_lzma_finish_keep,
+		.reset = sqsh_lzma_reset_xz,
+		.destroy = sqsh_lzma_destroy,
+		.decompress_once = sqsh_lzma_decompress_once,
 };
 
 const struct SqshExtractorImpl *const sqsh__impl_xz = &impl_xz;
@@ -132,6 +188,10 @@ static const struct SqshExtractorImpl impl_lzma = {
 		.init = sqsh_lzma_init_alone,
 		.write = sqsh_lzma_decompress,
 		.finish = sqsh_lzma_finish,
+		.finish_keep = sqsh_lzma_finish_keep,
+		.reset = sqsh_lzma_reset_alone,
+		.destroy = sqsh_lzma_destroy,
+		.decompress_once = sqsh_lzma_decompress_once,
 };
 
 const struct SqshExtractorImpl *const sqsh__impl_lzma = &impl_lzma;
@@ -74,31 +74,73 @@ sqsh_zlib_decompress(
 }
 
 static int
-sqsh_zlib_finish(void *context, uint8_t *target, size_t *target_size) {
+sqsh_zlib_reset(void *context, uint8_t *target, size_t target_size) {
+	z_stream *stream = context;
+
+	if (inflateReset(stream) != Z_OK) {
+		return -SQSH_ERROR_COMPRESSION_INIT;
+	}
+	stream->next_out = target;
+	stream->avail_out = (uInt)target_size;
+
+	return 0;
+}
+
+static int
+sqsh_zlib_finish_keep(void *context, uint8_t *target, size_t *target_size) {
 	(void)target;
 
-	int rv = 0;
 	z_stream *stream = context;
 	stream->next_in = Z_NULL;
 	stream->avail_in = 0;
 
 	int zrv = inflate(stream, Z_FINISH);
 	if (zrv != Z_STREAM_END) {
-		rv = -SQSH_ERROR_COMPRESSION_DECOMPRESS;
-		goto out;
+		return -SQSH_ERROR_COMPRESSION_DECOMPRESS;
 	}
 
 	*target_size = stream->total_out;
+	return 0;
+}
+
+static void
+sqsh_zlib_destroy(void *context) {
+	inflateEnd(context);
+}
 
-out:
-	inflateEnd(stream);
+static int
+sqsh_zlib_finish(void *context, uint8_t *target, size_t *target_size) {
+	int rv = sqsh_zlib_finish_keep(context, target, target_size);
+	sqsh_zlib_destroy(context);
 	return rv;
 }
 
+static int
+sqsh_zlib_decompress_once(
+		void *context, const uint8_t *compressed, size_t compressed_size,
+		uint8_t *target, size_t *target_size) {
+	z_stream *stream = context;
+	stream->next_in = (Bytef *)compressed;
+	stream->avail_in = (uInt)compressed_size;
+	stream->next_out = target;
+	stream->avail_out = (uInt)*target_size;
+
+	if (inflate(stream, Z_FINISH) != Z_STREAM_END) {
+		return -SQSH_ERROR_COMPRESSION_DECOMPRESS;
+	}
+
+	*target_size = stream->total_out;
+	return 0;
+}
+
 static const struct SqshExtractorImpl impl_zlib = {
 		.init = sqsh_zlib_init,
 		.write = sqsh_zlib_decompress,
 		.finish = sqsh_zlib_finish,
+		.finish_keep = sqsh_zlib_finish_keep,
+		.reset = sqsh_zlib_reset,
+		.destroy = sqsh_zlib_destroy,
+		.decompress_once = sqsh_zlib_decompress_once,
 };
 
 const struct SqshExtractorImpl *const sqsh__impl_zlib = &impl_zlib;
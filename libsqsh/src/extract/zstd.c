@@ -84,19 +84,63 @@ sqsh_zstd_decompress(
 }
 
 static int
-sqsh_zstd_finish(void *context, uint8_t *target, size_t *target_size) {
+sqsh_zstd_reset(void *context, uint8_t *target, size_t target_size) {
+	struct SqshZstdContext *ctx = context;
+	size_t rv = ZSTD_DCtx_reset(ctx->stream, ZSTD_reset_session_only);
+	if (ZSTD_isError(rv)) {
+		return -SQSH_ERROR_COMPRESSION_INIT;
+	}
+	ctx->output.dst = target;
+	ctx->output.size = target_size;
+	ctx->output.pos = 0;
+
+	return 0;
+}
+
+static int
+sqsh_zstd_finish_keep(void *context, uint8_t *target, size_t *target_size) {
 	(void)target;
-	(void)target_size;
 	struct SqshZstdContext *ctx = context;
-	ZSTD_freeDCtx(ctx->stream);
 	*target_size = ctx->output.pos;
 	return 0;
 }
 
+static void
+sqsh_zstd_destroy(void *context) {
+	struct SqshZstdContext *ctx = context;
+	ZSTD_freeDCtx(ctx->stream);
+}
+
+static int
+sqsh_zstd_finish(void *context, uint8_t *target, size_t *target_size) {
+	int rv = sqsh_zstd_finish_keep(context, target, target_size);
+	sqsh_zstd_destroy(context);
+	return rv;
+}
+
+static int
+sqsh_zstd_decompress_once(
+		void *context, const uint8_t *compressed, size_t compressed_size,
+		uint8_t *target, size_t *target_size) {
+	struct SqshZstdContext *ctx = context;
+	size_t rv = ZSTD_decompressDCtx(
+			ctx->stream, target, *target_size, compressed, compressed_size);
+	if (ZSTD_isError(rv)) {
+		return -SQSH_ERROR_COMPRESSION_DECOMPRESS;
+	}
+	ctx->output.pos = rv;
+	*target_size = rv;
+	return 0;
+}
+
 static const struct SqshExtractorImpl impl_zstd = {
 		.init = sqsh_zstd_init,
 		.write = sqsh_zstd_decompress,
 		.finish = sqsh_zstd_finish,
+		.finish_keep = sqsh_zstd_finish_keep,
+		.reset = sqsh_zstd_reset,
+		.destroy = sqsh_zstd_destroy,
+		.decompress_once = sqsh_zstd_decompress_once,
 };
 
 const struct SqshExtractorImpl *const sqsh__impl_zstd = &impl_zstd;
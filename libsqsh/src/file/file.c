@@ -34,7 +34,7 @@
 #include <sqsh_file_private.h>
 
 #include <cextras/memory.h>
-#include <sqsh_archive.h>
+#include <sqsh_archive_private.h>
 #include <sqsh_common_private.h>
 #include <sqsh_error.h>
 #include <sqsh_table.h>
@@ -42,6 +42,7 @@
 #include <sqsh_data_private.h>
 #include <sqsh_tree_private.h>
 #include <stdint.h>
+#include <string.h>
 
 #define SQSH_DEFAULT_MAX_SYMLINKS_FOLLOWED 100
 
@@ -147,6 +148,8 @@ sqsh__file_init(
 	int rv = 0;
 	const struct SqshSuperblock *superblock = sqsh_archive_superblock(archive);
 
+	inode->block_offsets = NULL;
+
 	const uint64_t inode_table_start =
 			sqsh_superblock_inode_table_start(superblock);
 
@@ -317,6 +320,29 @@ sqsh_file_block_size2(const struct SqshFile *context, uint64_t index) {
 	return sqsh_datablock_size(size_info);
 }
 
+int
+sqsh_file_block_address(
+		const struct SqshFile *context, uint64_t index, uint64_t *address) {
+	int rv = 0;
+	uint64_t offset;
+
+	if (index >= sqsh_file_block_count2(context)) {
+		rv = -SQSH_ERROR_OUT_OF_BOUNDS;
+		goto out;
+	}
+	rv = sqsh__file_block_offset(context, index, &offset);
+	if (rv < 0) {
+		goto out;
+	}
+	if (SQSH_ADD_OVERFLOW(sqsh_file_blocks_start(context), offset, address)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+
+out:
+	return rv;
+}
+
 uint32_t
 sqsh_file_block_size(const struct SqshFile *context, uint32_t index) {
 	const uint32_t size_info =
@@ -325,6 +351,80 @@ sqsh_file_block_size(const struct SqshFile *context, uint32_t index) {
 	return sqsh_datablock_size(size_info);
 }
 
+static int
+block_offsets_build(const struct SqshFile *context, uint64_t **target) {
+	int rv = 0;
+	uint64_t *block_offsets = NULL;
+	const uint64_t block_count = sqsh_file_block_count2(context);
+	uint64_t offset = 0;
+	size_t alloc_size;
+
+	if (SQSH_ADD_OVERFLOW(block_count, 1, &alloc_size)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+	if (SQSH_MULT_OVERFLOW(alloc_size, sizeof(uint64_t), &alloc_size)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+	block_offsets = malloc(alloc_size);
+	if (block_offsets == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+
+	for (uint64_t i = 0; i < block_count; i++) {
+		block_offsets[i] = offset;
+		if (SQSH_ADD_OVERFLOW(
+					offset, sqsh_file_block_size2(context, i), &offset)) {
+			rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+			goto out;
+		}
+	}
+	block_offsets[block_count] = offset;
+
+	*target = block_offsets;
+	block_offsets = NULL;
+out:
+	free(block_offsets);
+	return rv;
+}
+
+int
+sqsh__file_block_offset(
+		const struct SqshFile *context, uint64_t index, uint64_t *offset) {
+	int rv = 0;
+	/* The offsets are a cache that is lazily attached to an otherwise
+	 * immutable file context. The context may be shared between threads,
+	 * so the first one to finish building the offsets wins. */
+	struct SqshFile *file = (struct SqshFile *)context;
+	uint64_t *block_offsets =
+			__atomic_load_n(&file->block_offsets, __ATOMIC_ACQUIRE);
+
+	if (index > sqsh_file_block_count2(context)) {
+		rv = -SQSH_ERROR_OUT_OF_BOUNDS;
+		goto out;
+	}
+
+	if (block_offsets == NULL) {
+		uint64_t *expected = NULL;
+		rv = block_offsets_build(context, &block_offsets);
+		if (rv < 0) {
+			goto out;
+		}
+		if (!__atomic_compare_exchange_n(
+					&file->block_offsets, &expected, block_offsets, false,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			free(block_offsets);
+			block_offsets = expected;
+		}
+	}
+
+	*offset = block_offsets[index];
+out:
+	return rv;
+}
+
 bool
 sqsh_file_block_is_compressed2(const struct SqshFile *context, uint64_t index) {
 	const uint32_t size_info =
@@ -517,9 +617,84 @@ sqsh_file_xattr_index(const struct SqshFile *context) {
 
 int
 sqsh__file_cleanup(struct SqshFile *inode) {
+	free(inode->block_offsets);
+	inode->block_offsets = NULL;
 	return sqsh__metablock_reader_cleanup(&inode->metablock);
 }
 
+static void
+file_stat(const struct SqshFile *file, struct SqshFileStat *stat) {
+	stat->inode_ref = file->inode_ref;
+	stat->size = sqsh_file_size(file);
+	stat->blocks_start = sqsh_file_blocks_start(file);
+	stat->type = sqsh_file_type(file);
+	stat->inode_number = sqsh_file_inode(file);
+	stat->hard_link_count = sqsh_file_hard_link_count(file);
+	stat->modified_time = sqsh_file_modified_time(file);
+	stat->uid = sqsh_file_uid(file);
+	stat->gid = sqsh_file_gid(file);
+	stat->fragment_block_index = sqsh_file_fragment_block_index(file);
+	stat->fragment_block_offset = sqsh_file_fragment_block_offset(file);
+	stat->xattr_index = sqsh_file_xattr_index(file);
+	stat->permission = sqsh_file_permission(file);
+}
+
+int
+sqsh_file_stat(
+		struct SqshArchive *archive, uint64_t inode_ref,
+		struct SqshFileStat *stat) {
+	int rv = 0;
+	struct SqshFileStatCache *cache = sqsh__archive_file_stat_cache(archive);
+	struct SqshFile file = {0};
+
+	if (sqsh__file_stat_cache_get(cache, inode_ref, stat)) {
+		return 0;
+	}
+
+	rv = sqsh__file_init(&file, archive, inode_ref);
+	if (rv < 0) {
+		goto out;
+	}
+	file_stat(&file, stat);
+
+	rv = sqsh__file_stat_cache_put(cache, stat);
+out:
+	sqsh__file_cleanup(&file);
+	return rv;
+}
+
+static bool
+is_cacheable_error(int rv) {
+	switch (rv) {
+	case -SQSH_ERROR_NO_SUCH_FILE:
+	case -SQSH_ERROR_NOT_A_DIRECTORY:
+	case -SQSH_ERROR_TOO_MANY_SYMLINKS_FOLLOWED:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static struct SqshFile *
+open_cached_file(
+		struct SqshArchive *archive, const struct SqshPathCacheValue *value,
+		int *err) {
+	int rv = value->error;
+	struct SqshFile *inode = NULL;
+	if (rv < 0) {
+		goto out;
+	}
+
+	inode = sqsh_open_by_ref(archive, value->inode_ref, &rv);
+	if (rv < 0) {
+		goto out;
+	}
+	sqsh__file_set_parent_inode_ref(inode, value->parent_inode_ref);
+out:
+	*err = rv;
+	return inode;
+}
+
 static struct SqshFile *
 open_file(
 		struct SqshArchive *archive, const char *path, int *err,
@@ -527,17 +702,27 @@ open_file(
 	int rv;
 	struct SqshPathResolver resolver = {0};
 	struct SqshFile *inode = NULL;
-	rv = sqsh__path_resolver_init(&resolver, archive);
-	if (rv < 0) {
+	struct SqshPathCache *cache = sqsh__archive_path_cache(archive);
+	struct SqshPathCacheValue value = {0};
+	const size_t path_len = strlen(path);
+
+	if (sqsh__path_cache_get(cache, path, path_len, follow_symlink, &value)) {
+		inode = open_cached_file(archive, &value, &rv);
 		goto out;
 	}
 
-	rv = sqsh_path_resolver_to_root(&resolver);
+	rv = sqsh__path_resolver_init(&resolver, archive);
 	if (rv < 0) {
 		goto out;
 	}
 
-	rv = sqsh_path_resolver_resolve(&resolver, path, follow_symlink);
+	rv = sqsh__path_resolver_resolve_from_root(
+			&resolver, path, path_len, follow_symlink);
+	if (is_cacheable_error(rv)) {
+		value.error = rv;
+		(void)sqsh__path_cache_put(
+				cache, path, path_len, follow_symlink, &value);
+	}
 	if (rv < 0) {
 		goto out;
 	}
@@ -552,6 +737,11 @@ open_file(
 		goto out;
 	}
 
+	value.inode_ref = sqsh_file_inode_ref(inode);
+	value.parent_inode_ref = inode->parent_inode_ref;
+	value.symlink_depth = resolver.current_symlink_depth;
+	(void)sqsh__path_cache_put(cache, path, path_len, follow_symlink, &value);
+
 out:
 	if (err != NULL) {
 		*err = rv;
@@ -38,6 +38,7 @@
 #include <sqsh_common_private.h>
 #include <sqsh_error.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #define BLOCK_INDEX_FINISHED UINT32_MAX
 
@@ -86,6 +87,7 @@ sqsh__file_iterator_init(
 	iterator->block_size = sqsh_superblock_block_size(superblock);
 	iterator->file = file;
 	iterator->sparse_size = 0;
+	iterator->readahead = NULL;
 out:
 	return rv;
 }
@@ -115,6 +117,7 @@ sqsh__file_iterator_copy(
 	target->block_index = source->block_index;
 	target->data = source->data;
 	target->size = source->size;
+	target->readahead = NULL;
 out:
 	if (rv < 0) {
 		sqsh__file_iterator_cleanup(target);
@@ -329,6 +332,10 @@ sqsh_file_iterator_next(
 		has_next = false;
 	}
 
+	if (rv > 0 && iterator->readahead != NULL) {
+		sqsh__file_readahead_update(iterator->readahead, iterator);
+	}
+
 	if (err != NULL) {
 		*err = rv;
 	}
@@ -348,44 +355,95 @@ sqsh_file_iterator_skip(
 	return rv;
 }
 
+static int
+seek_block(struct SqshFileIterator *iterator, uint64_t block_index) {
+	int rv = 0;
+	const struct SqshFile *file = iterator->file;
+	struct SqshMapReader *reader = &iterator->map_reader;
+	const uint64_t blocks_start = sqsh_file_blocks_start(file);
+	const uint64_t current_address = sqsh__map_reader_address(reader);
+	uint64_t block_offset, block_address;
+
+	rv = sqsh__file_block_offset(file, block_index, &block_offset);
+	if (rv < 0) {
+		goto out;
+	}
+	if (SQSH_ADD_OVERFLOW(blocks_start, block_offset, &block_address)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+	if (block_address < current_address) {
+		rv = -SQSH_ERROR_INTERNAL;
+		goto out;
+	}
+
+	rv = sqsh__map_reader_advance(reader, block_address - current_address, 0);
+	if (rv < 0) {
+		goto out;
+	}
+	iterator->block_index = block_index;
+	iterator->sparse_size = 0;
+out:
+	return rv;
+}
+
 int
 sqsh_file_iterator_skip2(
 		struct SqshFileIterator *iterator, uint64_t *offset,
 		size_t desired_size) {
 	int rv = 0;
+	const struct SqshFile *file = iterator->file;
 	const size_t block_size = iterator->block_size;
-	const size_t current_block_size = sqsh_file_iterator_size(iterator);
+	const size_t mapped_size = sqsh_file_iterator_size(iterator);
+	const uint64_t block_count = sqsh_file_block_count2(file);
+	const bool has_fragment = sqsh_file_has_fragment(file);
 
-	if (*offset < current_block_size) {
+	if (*offset < mapped_size) {
 		goto out;
 	}
 
-	*offset -= current_block_size;
+	*offset -= mapped_size;
 
-	uint64_t skip_index = *offset / block_size;
-	if (current_block_size != 0) {
-		skip_index += 1;
-	}
+	/* Offsets inside the remaining sparse section of the current block are
+	 * reached by iterating over the zero blocks below. Everything else is
+	 * addressed directly by looking up the offset of the target block.
+	 */
+	if (*offset >= iterator->sparse_size) {
+		if (iterator->block_index > block_count) {
+			rv = -SQSH_ERROR_OUT_OF_BOUNDS;
+			goto out;
+		}
 
-	*offset = *offset % block_size;
+		uint64_t position;
+		if (SQSH_MULT_OVERFLOW(iterator->block_index, block_size, &position)) {
+			rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+			goto out;
+		}
+		position -= iterator->sparse_size;
+		if (SQSH_ADD_OVERFLOW(position, *offset, &position)) {
+			rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+			goto out;
+		}
 
-	if (skip_index == 0 && iterator->block_index != 0) {
-		goto out;
+		const uint64_t block_index = position / block_size;
+		*offset = position % block_size;
+
+		if (block_index < block_count) {
+			rv = seek_block(iterator, block_index);
+			if (rv < 0) {
+				goto out;
+			}
+		} else if (block_index == block_count && has_fragment) {
+			iterator->block_index = block_index;
+			iterator->sparse_size = 0;
+		} else {
+			rv = -SQSH_ERROR_OUT_OF_BOUNDS;
+			goto out;
+		}
 	}
 
-	sqsh_index_t reader_forward = 0;
-	uint64_t block_index = iterator->block_index;
-	const uint64_t block_count = sqsh_file_block_count2(iterator->file);
-	for (sqsh_index_t i = 0; i < skip_index && block_index < block_count; i++) {
-		reader_forward += sqsh_file_block_size2(iterator->file, block_index);
-		block_index += 1;
-	}
-	rv = sqsh__map_reader_advance(&iterator->map_reader, reader_forward, 0);
-	if (rv < 0) {
-		goto out;
-	}
-	iterator->sparse_size = 0;
-	iterator->block_index = block_index;
+	iterator->data = NULL;
+	iterator->size = 0;
 
 	/* In general we will get directly the block containing the offset, but if
 	 * the offset points to a block with sparse sections, we iterate over them
@@ -394,7 +452,7 @@ sqsh_file_iterator_skip2(
 	 * TODO: We could analyze iterator->sparse_size and directly skip to the
 	 *       desired block.
 	 */
-	size_t current_size = sqsh_file_iterator_size(iterator);
+	size_t current_size = 0;
 	while (current_size <= *offset) {
 		*offset -= current_size;
 		bool has_next = sqsh_file_iterator_next(iterator, desired_size, &rv);
@@ -430,6 +488,11 @@ sqsh_file_iterator_size(const struct SqshFileIterator *iterator) {
 
 int
 sqsh__file_iterator_cleanup(struct SqshFileIterator *iterator) {
+	if (iterator->readahead != NULL) {
+		sqsh__file_readahead_cleanup(iterator->readahead);
+		free(iterator->readahead);
+		iterator->readahead = NULL;
+	}
 	sqsh__map_reader_cleanup(&iterator->map_reader);
 	sqsh__extract_view_cleanup(&iterator->extract_view);
 	sqsh__fragment_view_cleanup(&iterator->fragment_view);
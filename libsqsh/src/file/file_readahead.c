@@ -0,0 +1,284 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         file_readahead.c
+ */
+
+#include <sqsh_file_private.h>
+
+#include <cextras/concurrency.h>
+#include <sqsh_archive_private.h>
+#include <sqsh_common_private.h>
+#include <sqsh_error.h>
+#include <stdlib.h>
+
+struct ReadaheadJob {
+	struct SqshFileReadahead *readahead;
+	uint64_t address;
+	uint32_t size;
+};
+
+static void
+readahead_worker(void *data) {
+	int rv = 0;
+	struct ReadaheadJob *job = data;
+	struct SqshFileReadahead *readahead = job->readahead;
+	struct SqshMapReader reader = {0};
+	struct CxBuffer *buffer = NULL;
+	bool cancelled;
+
+	if (sqsh__mutex_lock(&readahead->lock) < 0) {
+		goto out;
+	}
+	cancelled = readahead->cancelled;
+	sqsh__mutex_unlock(&readahead->lock);
+	if (cancelled) {
+		goto out;
+	}
+
+	uint64_t upper_limit;
+	if (SQSH_ADD_OVERFLOW(job->address, job->size, &upper_limit)) {
+		goto out;
+	}
+	rv = sqsh__map_reader_init(
+			&reader, readahead->map_manager, job->address, upper_limit);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = sqsh__map_reader_advance(&reader, 0, job->size);
+	if (rv < 0) {
+		goto out;
+	}
+
+	// The extract manager keeps the block in its LRU cache after the
+	// buffer is released, where the iterator will pick it up.
+	rv = sqsh__extract_manager_uncompress(
+			readahead->extract_manager, &reader, &buffer);
+	if (rv < 0) {
+		goto out;
+	}
+	sqsh__extract_manager_release(readahead->extract_manager, job->address);
+
+out:
+	sqsh__map_reader_cleanup(&reader);
+	free(job);
+
+	if (sqsh__mutex_lock(&readahead->lock) == 0) {
+		readahead->pending--;
+		sqsh__cond_broadcast(&readahead->cond);
+		sqsh__mutex_unlock(&readahead->lock);
+	}
+}
+
+int
+sqsh__file_readahead_init(
+		struct SqshFileReadahead *readahead,
+		const struct SqshFileIterator *iterator,
+		struct CxThreadpool *threadpool, size_t window) {
+	int rv = 0;
+	struct SqshArchive *archive = iterator->file->archive;
+
+	readahead->threadpool = threadpool;
+	readahead->extract_manager = iterator->compression_manager;
+	readahead->map_manager = sqsh_archive_map_manager(archive);
+	readahead->window = window;
+	readahead->last_block_index = iterator->block_index;
+	readahead->scheduled_until = iterator->block_index;
+	readahead->scheduled_count = 0;
+	readahead->pending = 0;
+	readahead->cancelled = false;
+
+	rv = sqsh__mutex_init(&readahead->lock);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = sqsh__cond_init(&readahead->cond);
+	if (rv < 0) {
+		sqsh__mutex_destroy(&readahead->lock);
+		goto out;
+	}
+
+out:
+	return rv;
+}
+
+static int
+schedule_block(
+		struct SqshFileReadahead *readahead, const struct SqshFile *file,
+		uint64_t block_index) {
+	int rv = 0;
+	uint64_t offset;
+	struct ReadaheadJob *job = NULL;
+
+	// Only compressed blocks benefit from readahead. Uncompressed blocks
+	// are mapped directly and sparse blocks aren't stored at all.
+	const uint32_t size = sqsh_file_block_size2(file, block_index);
+	if (size == 0 || !sqsh_file_block_is_compressed2(file, block_index)) {
+		return 0;
+	}
+
+	rv = sqsh__file_block_offset(file, block_index, &offset);
+	if (rv < 0) {
+		goto out;
+	}
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	job->readahead = readahead;
+	job->size = size;
+	if (SQSH_ADD_OVERFLOW(
+				sqsh_file_blocks_start(file), offset, &job->address)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+
+	rv = sqsh__mutex_lock(&readahead->lock);
+	if (rv < 0) {
+		goto out;
+	}
+	readahead->pending++;
+	sqsh__mutex_unlock(&readahead->lock);
+
+	rv = cx_threadpool_schedule(readahead->threadpool, readahead_worker, job);
+	if (rv < 0) {
+		if (sqsh__mutex_lock(&readahead->lock) == 0) {
+			readahead->pending--;
+			sqsh__mutex_unlock(&readahead->lock);
+		}
+		goto out;
+	}
+	job = NULL;
+	readahead->scheduled_count++;
+
+out:
+	free(job);
+	return rv;
+}
+
+void
+sqsh__file_readahead_update(
+		struct SqshFileReadahead *readahead,
+		const struct SqshFileIterator *iterator) {
+	const struct SqshFile *file = iterator->file;
+	const uint64_t block_index = iterator->block_index;
+	const uint64_t block_count = sqsh_file_block_count2(file);
+	const uint64_t last_block_index = readahead->last_block_index;
+
+	// Sparse blocks are returned in several chunks that share the index of
+	// the block.
+	if (block_index == last_block_index) {
+		return;
+	}
+	readahead->last_block_index = block_index;
+
+	// Runs of uncompressed blocks are mapped at once, so a sequential read
+	// may skip blocks, but it stays within the blocks already scheduled.
+	const bool sequential = block_index > last_block_index &&
+			(block_index == last_block_index + 1 ||
+			 block_index <= readahead->scheduled_until);
+	if (!sequential) {
+		// Random access: don't waste work on blocks that might never be
+		// read. Readahead starts again once the access is sequential.
+		readahead->scheduled_until = block_index;
+		return;
+	}
+
+	if (readahead->scheduled_until < block_index) {
+		readahead->scheduled_until = block_index;
+	}
+	uint64_t end = block_index + readahead->window;
+	if (end > block_count) {
+		end = block_count;
+	}
+	for (; readahead->scheduled_until < end; readahead->scheduled_until++) {
+		if (schedule_block(readahead, file, readahead->scheduled_until) < 0) {
+			break;
+		}
+	}
+}
+
+int
+sqsh__file_readahead_cleanup(struct SqshFileReadahead *readahead) {
+	int rv = 0;
+
+	rv = sqsh__mutex_lock(&readahead->lock);
+	if (rv < 0) {
+		goto out;
+	}
+	readahead->cancelled = true;
+	while (readahead->pending > 0) {
+		rv = sqsh__cond_wait(&readahead->cond, &readahead->lock);
+		if (rv < 0) {
+			break;
+		}
+	}
+	sqsh__mutex_unlock(&readahead->lock);
+
+	sqsh__cond_destroy(&readahead->cond);
+	sqsh__mutex_destroy(&readahead->lock);
+out:
+	return rv;
+}
+
+int
+sqsh__file_iterator_readahead(
+		struct SqshFileIterator *iterator, struct CxThreadpool *threadpool,
+		size_t window) {
+	int rv = 0;
+	struct SqshFileReadahead *readahead = NULL;
+
+	if (iterator->readahead != NULL) {
+		sqsh__file_readahead_cleanup(iterator->readahead);
+		free(iterator->readahead);
+		iterator->readahead = NULL;
+	}
+	if (window == 0) {
+		goto out;
+	}
+
+	readahead = calloc(1, sizeof(*readahead));
+	if (readahead == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	rv = sqsh__file_readahead_init(readahead, iterator, threadpool, window);
+	if (rv < 0) {
+		goto out;
+	}
+	iterator->readahead = readahead;
+	readahead = NULL;
+
+out:
+	free(readahead);
+	return rv;
+}
@@ -0,0 +1,122 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         file_stat_cache.c
+ */
+
+#include <sqsh_file_private.h>
+
+#include <sqsh_error.h>
+
+#include <stdlib.h>
+
+static size_t
+slot_index(const struct SqshFileStatCache *cache, uint64_t inode_ref) {
+	// The inner offset in the lower 16 bits of a reference is mostly
+	// aligned, mix the bits before masking them.
+	return (size_t)sqsh__hash_mix(inode_ref) & cache->slot_mask;
+}
+
+int
+sqsh__file_stat_cache_init(struct SqshFileStatCache *cache, size_t size) {
+	int rv = 0;
+	size_t slot_count = 1;
+
+	cache->slots = NULL;
+	cache->slot_mask = 0;
+	if (size > 0) {
+		while (slot_count < size) {
+			slot_count *= 2;
+		}
+		cache->slots = calloc(slot_count, sizeof(*cache->slots));
+		if (cache->slots == NULL) {
+			return -SQSH_ERROR_MALLOC_FAILED;
+		}
+		for (size_t i = 0; i < slot_count; i++) {
+			cache->slots[i].inode_ref = SQSH_INODE_REF_NULL;
+		}
+		cache->slot_mask = slot_count - 1;
+	}
+	rv = sqsh__mutex_init(&cache->lock);
+	if (rv < 0) {
+		free(cache->slots);
+		cache->slots = NULL;
+	}
+	return rv;
+}
+
+bool
+sqsh__file_stat_cache_get(
+		struct SqshFileStatCache *cache, uint64_t inode_ref,
+		struct SqshFileStat *stat) {
+	bool found = false;
+
+	if (cache->slots == NULL || inode_ref == SQSH_INODE_REF_NULL) {
+		return false;
+	}
+
+	if (sqsh__mutex_lock(&cache->lock) < 0) {
+		return false;
+	}
+	const struct SqshFileStat *slot =
+			&cache->slots[slot_index(cache, inode_ref)];
+	if (slot->inode_ref == inode_ref) {
+		*stat = *slot;
+		found = true;
+	}
+	sqsh__mutex_unlock(&cache->lock);
+	return found;
+}
+
+int
+sqsh__file_stat_cache_put(
+		struct SqshFileStatCache *cache, const struct SqshFileStat *stat) {
+	int rv = 0;
+
+	if (cache->slots == NULL || stat->inode_ref == SQSH_INODE_REF_NULL) {
+		return 0;
+	}
+
+	rv = sqsh__mutex_lock(&cache->lock);
+	if (rv < 0) {
+		return rv;
+	}
+	cache->slots[slot_index(cache, stat->inode_ref)] = *stat;
+	sqsh__mutex_unlock(&cache->lock);
+	return rv;
+}
+
+int
+sqsh__file_stat_cache_cleanup(struct SqshFileStatCache *cache) {
+	free(cache->slots);
+	cache->slots = NULL;
+	sqsh__mutex_destroy(&cache->lock);
+	return 0;
+}
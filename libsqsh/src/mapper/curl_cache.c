@@ -0,0 +1,357 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         curl_cache.c
+ */
+
+#define _DEFAULT_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stddef.h>
+
+#ifdef CONFIG_CURL
+
+#	include <sqsh_mapper_private.h>
+
+#	include <sqsh_common_private.h>
+#	include <sqsh_error.h>
+
+#	include <dirent.h>
+#	include <errno.h>
+#	include <fcntl.h>
+#	include <inttypes.h>
+#	include <limits.h>
+#	include <stdio.h>
+#	include <stdlib.h>
+#	include <string.h>
+#	include <sys/stat.h>
+#	include <time.h>
+#	include <unistd.h>
+
+#	define CACHE_MAGIC "sqsh-curl-cache-1"
+/* After exceeding the limit, files are evicted until the cache is below
+ * this fraction of its limit, so eviction does not run on every store. */
+#	define CACHE_LOW_WATERMARK(x) ((x) / 10 * 9)
+/* Blocks are written to temporary files first. These are left behind if a
+ * process dies while writing, and are removed once they reach this age in
+ * seconds. */
+#	define CACHE_TMP_PREFIX ".tmp-"
+#	define CACHE_TMP_MAX_AGE (60 * 60)
+
+struct CacheFile {
+	char name[NAME_MAX + 1];
+	struct timespec mtime;
+	uint64_t size;
+};
+
+static uint64_t
+hash_string(uint64_t hash, const char *str) {
+	return sqsh__hash_fnv1a(hash, str, strlen(str));
+}
+
+static int
+file_name(
+		const struct SqshCurlCache *cache, uint64_t offset, size_t size,
+		char *name, size_t name_size) {
+	int rv = snprintf(
+			name, name_size, "%s/%016" PRIx64 "-%" PRIu64 "-%zu", cache->dir,
+			cache->key, offset, size);
+	if (rv < 0 || (size_t)rv >= name_size) {
+		return -SQSH_ERROR_INTEGER_OVERFLOW;
+	}
+	return 0;
+}
+
+static int
+compare_mtime(const void *a, const void *b) {
+	const struct CacheFile *file_a = a;
+	const struct CacheFile *file_b = b;
+	if (file_a->mtime.tv_sec != file_b->mtime.tv_sec) {
+		return file_a->mtime.tv_sec < file_b->mtime.tv_sec ? -1 : 1;
+	} else if (file_a->mtime.tv_nsec != file_b->mtime.tv_nsec) {
+		return file_a->mtime.tv_nsec < file_b->mtime.tv_nsec ? -1 : 1;
+	}
+	return 0;
+}
+
+/* Scans the directory, removes the least recently used files until the
+ * cache is below `target` bytes and returns the bytes left. Files of other
+ * archives and processes count towards the limit as well. Stale temporary
+ * files are removed on the way. */
+static uint64_t
+evict(struct SqshCurlCache *cache, uint64_t target) {
+	uint64_t total = 0;
+	struct CacheFile *files = NULL;
+	size_t count = 0, capacity = 0;
+	struct dirent *entry;
+	DIR *dir = opendir(cache->dir);
+	if (dir == NULL) {
+		return 0;
+	}
+	const int dir_fd = dirfd(dir);
+	const time_t now = time(NULL);
+
+	while ((entry = readdir(dir)) != NULL) {
+		struct stat st;
+		if (fstatat(dir_fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+			!S_ISREG(st.st_mode)) {
+			continue;
+		}
+		if (strncmp(entry->d_name, CACHE_TMP_PREFIX,
+					strlen(CACHE_TMP_PREFIX)) == 0) {
+			// Younger temporary files may still be written to.
+			if (now - st.st_mtim.tv_sec > CACHE_TMP_MAX_AGE) {
+				unlinkat(dir_fd, entry->d_name, 0);
+			}
+			continue;
+		} else if (entry->d_name[0] == '.') {
+			continue;
+		}
+		if (count == capacity) {
+			capacity = capacity == 0 ? 64 : capacity * 2;
+			struct CacheFile *new_files =
+					realloc(files, capacity * sizeof(*files));
+			if (new_files == NULL) {
+				break;
+			}
+			files = new_files;
+		}
+		struct CacheFile *file = &files[count++];
+		strncpy(file->name, entry->d_name, sizeof(file->name) - 1);
+		file->name[sizeof(file->name) - 1] = '\0';
+		file->mtime = st.st_mtim;
+		file->size = (uint64_t)st.st_size;
+		total += file->size;
+	}
+
+	if (total > target && count > 0) {
+		qsort(files, count, sizeof(*files), compare_mtime);
+		for (size_t i = 0; i < count && total > target; i++) {
+			if (unlinkat(dir_fd, files[i].name, 0) == 0) {
+				total -= files[i].size;
+			}
+		}
+	}
+
+	free(files);
+	closedir(dir);
+	return total;
+}
+
+int
+sqsh__curl_cache_init(
+		struct SqshCurlCache *cache, const char *dir, uint64_t max_bytes,
+		const char *url, uint64_t file_time) {
+	int rv = 0;
+	char time_str[32];
+
+	memset(cache, 0, sizeof(*cache));
+	rv = sqsh__mutex_init(&cache->lock);
+	if (rv < 0) {
+		return rv;
+	}
+
+	if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		rv = -errno;
+		goto out;
+	}
+
+	snprintf(time_str, sizeof(time_str), "%" PRIu64, file_time);
+	cache->key = hash_string(SQSH_HASH_FNV1A_INIT, url);
+	cache->key = hash_string(cache->key, "\n");
+	cache->key = hash_string(cache->key, time_str);
+
+	// Every file starts with the full key, so a hash collision is detected
+	// when the file is read.
+	const size_t header_size = strlen(CACHE_MAGIC) + strlen(url) +
+			strlen(time_str) + 3;
+	cache->dir = strdup(dir);
+	cache->header = malloc(header_size + 1);
+	if (cache->dir == NULL || cache->header == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	snprintf(
+			cache->header, header_size + 1, "%s\n%s\n%s\n", CACHE_MAGIC, url,
+			time_str);
+	cache->header_size = header_size;
+	cache->max_bytes = max_bytes;
+	cache->used_bytes = evict(cache, max_bytes);
+
+out:
+	if (rv < 0) {
+		sqsh__curl_cache_cleanup(cache);
+	}
+	return rv;
+}
+
+static int
+read_all(int fd, void *data, size_t size) {
+	uint8_t *p = data;
+	while (size > 0) {
+		const ssize_t rv = read(fd, p, size);
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		} else if (rv <= 0) {
+			return -1;
+		}
+		p += rv;
+		size -= (size_t)rv;
+	}
+	return 0;
+}
+
+static int
+write_all(int fd, const void *data, size_t size) {
+	const uint8_t *p = data;
+	while (size > 0) {
+		const ssize_t rv = write(fd, p, size);
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		} else if (rv <= 0) {
+			return -1;
+		}
+		p += rv;
+		size -= (size_t)rv;
+	}
+	return 0;
+}
+
+int
+sqsh__curl_cache_get(
+		struct SqshCurlCache *cache, uint64_t offset, size_t size,
+		uint8_t **data) {
+	int rv = 0;
+	char path[PATH_MAX];
+	struct stat st;
+	char *header = NULL;
+	uint8_t *buffer = NULL;
+	int fd = -1;
+
+	if (file_name(cache, offset, size, path, sizeof(path)) < 0) {
+		goto out;
+	}
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 ||
+		(uint64_t)st.st_size != cache->header_size + size) {
+		goto out;
+	}
+
+	header = malloc(cache->header_size);
+	buffer = malloc(size);
+	if (header == NULL || buffer == NULL ||
+		read_all(fd, header, cache->header_size) < 0 ||
+		memcmp(header, cache->header, cache->header_size) != 0 ||
+		read_all(fd, buffer, size) < 0) {
+		goto out;
+	}
+
+	// Mark the file as recently used.
+	futimens(fd, NULL);
+	*data = buffer;
+	buffer = NULL;
+	rv = 1;
+
+out:
+	if (fd >= 0) {
+		close(fd);
+	}
+	free(header);
+	free(buffer);
+	return rv;
+}
+
+bool
+sqsh__curl_cache_contains(
+		const struct SqshCurlCache *cache, uint64_t offset, size_t size) {
+	char path[PATH_MAX];
+	struct stat st;
+
+	if (file_name(cache, offset, size, path, sizeof(path)) < 0) {
+		return false;
+	}
+	return stat(path, &st) == 0 &&
+			(uint64_t)st.st_size == cache->header_size + size;
+}
+
+void
+sqsh__curl_cache_put(
+		struct SqshCurlCache *cache, uint64_t offset, const uint8_t *data,
+		size_t size) {
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX];
+	int fd = -1;
+	bool written = false;
+
+	if (file_name(cache, offset, size, path, sizeof(path)) < 0) {
+		return;
+	}
+	int rv = snprintf(
+			tmp_path, sizeof(tmp_path), "%s/" CACHE_TMP_PREFIX "XXXXXX",
+			cache->dir);
+	if (rv < 0 || (size_t)rv >= sizeof(tmp_path)) {
+		return;
+	}
+
+	// Write to a temporary file first, so other processes never see a
+	// partially written block.
+	fd = mkstemp(tmp_path);
+	if (fd < 0) {
+		return;
+	}
+	written = write_all(fd, cache->header, cache->header_size) == 0 &&
+			write_all(fd, data, size) == 0;
+	close(fd);
+	if (!written || rename(tmp_path, path) < 0) {
+		unlink(tmp_path);
+		return;
+	}
+
+	const uint64_t used = __atomic_add_fetch(
+			&cache->used_bytes, cache->header_size + size, __ATOMIC_RELAXED);
+	if (used > cache->max_bytes && sqsh__mutex_lock(&cache->lock) == 0) {
+		if (__atomic_load_n(&cache->used_bytes, __ATOMIC_RELAXED) >
+			cache->max_bytes) {
+			const uint64_t left =
+					evict(cache, CACHE_LOW_WATERMARK(cache->max_bytes));
+			__atomic_store_n(&cache->used_bytes, left, __ATOMIC_RELAXED);
+		}
+		sqsh__mutex_unlock(&cache->lock);
+	}
+}
+
+void
+sqsh__curl_cache_cleanup(struct SqshCurlCache *cache) {
+	free(cache->dir);
+	free(cache->header);
+	cache->dir = NULL;
+	cache->header = NULL;
+	sqsh__mutex_destroy(&cache->lock);
+}
+#endif
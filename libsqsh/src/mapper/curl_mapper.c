@@ -42,6 +42,7 @@
 #	include <sqsh_error.h>
 #	include <sqsh_common_private.h>
 
+#	include <assert.h>
 #	include <curl/curl.h>
 #	include <inttypes.h>
 #	include <string.h>
@@ -49,11 +50,58 @@
 #	define CONTENT_RANGE "Content-Range"
 #	define CONTENT_RANGE_FORMAT "bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64
 
+/* The maximum number of requests that are in flight at the same time. */
+#	define CURL_MAX_HANDLES 8
+/* The maximum number of blocks fetched with a single request once reads
+ * are detected to be sequential. */
+#	define CURL_MAX_WINDOW 16
+/* The maximum number of fetched blocks that were not requested yet. */
+#	define CURL_MAX_STASH (2 * CURL_MAX_WINDOW)
+
+/* A block that was fetched together with an earlier block and waits to be
+ * mapped. */
+struct SqshCurlStash {
+	uint64_t offset;
+	size_t size;
+	uint8_t *data;
+};
+
+/* A range that is currently being downloaded. */
+struct SqshCurlRange {
+	uint64_t start;
+	uint64_t end;
+	struct SqshCurlRange *next;
+};
+
 struct SqshCurlMapper {
 	char *url;
 	uint64_t expected_time;
-	void *handle;
+	/* Connections, DNS lookups and TLS sessions are shared between all
+	 * handles of the mapper, so parallel requests reuse each other's
+	 * connections. */
+	CURLSH *share;
+	sqsh__mutex_t share_locks[CURL_LOCK_DATA_LAST];
+	/* Handles that are not used by a request right now. Handles are created
+	 * on demand until CURL_MAX_HANDLES exist. */
+	CURL *idle_handles[CURL_MAX_HANDLES];
+	size_t idle_count;
+	size_t handle_count;
+	sqsh__cond_t handle_cond;
 	uint8_t *header_cache;
+	/* Sequential reads grow the number of blocks fetched per request up to
+	 * CURL_MAX_WINDOW. Blocks beyond the requested one are kept in the
+	 * stash until they are mapped. */
+	uint64_t next_offset;
+	size_t window;
+	struct SqshCurlStash stash[CURL_MAX_STASH];
+	size_t stash_count;
+	/* Requests for blocks inside a range in flight wait for that range
+	 * instead of fetching the block again. They are woken through
+	 * `handle_cond`. */
+	struct SqshCurlRange *inflight;
+	/* Blocks are additionally kept on disk if `curl_cache_dir` is set. */
+	struct SqshCurlCache disk_cache;
+	bool has_disk_cache;
 	sqsh__mutex_t lock;
 };
 
@@ -133,14 +181,43 @@ get_file_time(CURL *handle, uint64_t *file_time) {
 	return 0;
 }
 
+/* Used where a request has to be finished even if the lock fails, so that
+ * other threads don't wait for it forever. */
+static void
+lock_mutex(sqsh__mutex_t *mutex) {
+	int rv = sqsh__mutex_lock(mutex);
+	assert(rv == 0);
+	(void)rv;
+}
+
+static void
+share_lock(
+		CURL *handle, curl_lock_data data, curl_lock_access access,
+		void *userptr) {
+	(void)handle;
+	(void)access;
+	struct SqshCurlMapper *mapper = userptr;
+	int rv = sqsh__mutex_lock(&mapper->share_locks[data]);
+	(void)rv;
+}
+
+static void
+share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+	(void)handle;
+	struct SqshCurlMapper *mapper = userptr;
+	sqsh__mutex_unlock(&mapper->share_locks[data]);
+}
+
 static CURL *
-configure_handle(struct SqshCurlMapper *mapper) {
-	CURL *handle = mapper->handle;
+configure_handle(struct SqshCurlMapper *mapper, CURL *handle) {
 	const long tls_versions =
 			CURL_SSLVERSION_TLSv1_2 | CURL_SSLVERSION_MAX_DEFAULT;
 	curl_easy_reset(handle);
 	curl_easy_setopt(handle, CURLOPT_URL, mapper->url);
+	curl_easy_setopt(handle, CURLOPT_SHARE, mapper->share);
+	curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
 	curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 1L);
+	curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
 	curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
 	curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
 	curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
@@ -150,6 +227,46 @@ configure_handle(struct SqshCurlMapper *mapper) {
 	return handle;
 }
 
+static int
+acquire_handle(struct SqshCurlMapper *mapper, CURL **handle) {
+	int rv = sqsh__mutex_lock(&mapper->lock);
+	if (rv < 0) {
+		return rv;
+	}
+
+	while (mapper->idle_count == 0 &&
+		   mapper->handle_count == CURL_MAX_HANDLES) {
+		rv = sqsh__cond_wait(&mapper->handle_cond, &mapper->lock);
+		if (rv < 0) {
+			goto out;
+		}
+	}
+
+	if (mapper->idle_count > 0) {
+		*handle = mapper->idle_handles[--mapper->idle_count];
+	} else {
+		*handle = curl_easy_init();
+		if (*handle == NULL) {
+			rv = -SQSH_ERROR_MAPPER_MAP;
+			goto out;
+		}
+		mapper->handle_count++;
+	}
+	configure_handle(mapper, *handle);
+
+out:
+	sqsh__mutex_unlock(&mapper->lock);
+	return rv;
+}
+
+static void
+release_handle(struct SqshCurlMapper *mapper, CURL *handle) {
+	lock_mutex(&mapper->lock);
+	mapper->idle_handles[mapper->idle_count++] = handle;
+	sqsh__cond_broadcast(&mapper->handle_cond);
+	sqsh__mutex_unlock(&mapper->lock);
+}
+
 static int
 curl_download(
 		CURL *handle, uint64_t offset, size_t size, uint8_t **data,
@@ -206,14 +323,40 @@ curl_download(
 	}
 
 out:
+	if (rv < 0) {
+		free(*data);
+		*data = NULL;
+	}
 	return rv;
 }
 
+static void
+curl_mapper_free(struct SqshCurlMapper *mapper) {
+	for (size_t i = 0; i < mapper->stash_count; i++) {
+		free(mapper->stash[i].data);
+	}
+	if (mapper->has_disk_cache) {
+		sqsh__curl_cache_cleanup(&mapper->disk_cache);
+	}
+	for (size_t i = 0; i < mapper->idle_count; i++) {
+		curl_easy_cleanup(mapper->idle_handles[i]);
+	}
+	curl_share_cleanup(mapper->share);
+	for (size_t i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+		sqsh__mutex_destroy(&mapper->share_locks[i]);
+	}
+	sqsh__cond_destroy(&mapper->handle_cond);
+	sqsh__mutex_destroy(&mapper->lock);
+	free(mapper->url);
+	free(mapper->header_cache);
+	free(mapper);
+}
+
 static int
 sqsh_mapper_curl_init(
 		struct SqshMapper *mapper, const void *input, uint64_t *size) {
-	(void)size;
 	int rv = 0;
+	CURL *handle = NULL;
 	curl_global_init(CURL_GLOBAL_ALL);
 
 	struct SqshCurlMapper *curl_mapper =
@@ -222,22 +365,49 @@ sqsh_mapper_curl_init(
 		rv = -SQSH_ERROR_MALLOC_FAILED;
 		goto out;
 	}
-	curl_mapper->url = strdup(input);
-	curl_mapper->handle = curl_easy_init();
-	sqsh_mapper_set_user_data(mapper, curl_mapper);
+	sqsh_mapper_set_user_data(mapper, NULL);
 
 	rv = sqsh__mutex_init(&curl_mapper->lock);
 	if (rv < 0) {
 		goto out;
 	}
+	rv = sqsh__cond_init(&curl_mapper->handle_cond);
+	if (rv < 0) {
+		goto out;
+	}
+	for (size_t i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+		rv = sqsh__mutex_init(&curl_mapper->share_locks[i]);
+		if (rv < 0) {
+			goto out;
+		}
+	}
 
-	size_t block_size = sqsh_mapper_block_size(mapper);
-	CURL *handle = configure_handle(curl_mapper);
+	curl_mapper->url = strdup(input);
+	curl_mapper->share = curl_share_init();
+	if (curl_mapper->url == NULL || curl_mapper->share == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	curl_share_setopt(curl_mapper->share, CURLSHOPT_LOCKFUNC, share_lock);
+	curl_share_setopt(curl_mapper->share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+	curl_share_setopt(curl_mapper->share, CURLSHOPT_USERDATA, curl_mapper);
+	curl_share_setopt(
+			curl_mapper->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	curl_share_setopt(curl_mapper->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(
+			curl_mapper->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+	rv = acquire_handle(curl_mapper, &handle);
+	if (rv < 0) {
+		goto out;
+	}
 
+	size_t block_size = sqsh_mapper_block_size(mapper);
 	uint64_t size64 = *size;
 	rv = curl_download(
 			handle, 0, block_size, &curl_mapper->header_cache, &size64,
 			&curl_mapper->expected_time);
+	release_handle(curl_mapper, handle);
 	if (rv < 0) {
 		goto out;
 	}
@@ -246,60 +416,243 @@ sqsh_mapper_curl_init(
 		goto out;
 	}
 	*size = (size_t)size64;
+	curl_mapper->next_offset = block_size;
+	curl_mapper->window = 1;
+
+	const struct SqshConfig *config = mapper->config;
+	if (config != NULL && config->curl_cache_dir != NULL) {
+		const uint64_t max_bytes = config->curl_cache_max_bytes != 0
+				? config->curl_cache_max_bytes
+				: 256 * 1024 * 1024;
+		rv = sqsh__curl_cache_init(
+				&curl_mapper->disk_cache, config->curl_cache_dir, max_bytes,
+				curl_mapper->url, curl_mapper->expected_time);
+		if (rv < 0) {
+			goto out;
+		}
+		curl_mapper->has_disk_cache = true;
+	}
+
+	sqsh_mapper_set_user_data(mapper, curl_mapper);
+	curl_mapper = NULL;
 
 out:
+	if (curl_mapper != NULL) {
+		curl_mapper_free(curl_mapper);
+	}
 	return rv;
 }
 
+static uint8_t *
+stash_take(struct SqshCurlMapper *mapper, uint64_t offset, size_t size) {
+	for (size_t i = 0; i < mapper->stash_count; i++) {
+		struct SqshCurlStash *stash = &mapper->stash[i];
+		if (stash->offset == offset && stash->size == size) {
+			uint8_t *data = stash->data;
+			*stash = mapper->stash[--mapper->stash_count];
+			return data;
+		}
+	}
+	return NULL;
+}
+
+static void
+stash_put(
+		struct SqshCurlMapper *mapper, uint64_t offset, size_t size,
+		uint8_t *data) {
+	struct SqshCurlStash *stash = NULL;
+	for (size_t i = 0; i < mapper->stash_count && stash == NULL; i++) {
+		if (mapper->stash[i].offset == offset) {
+			stash = &mapper->stash[i];
+			free(stash->data);
+		}
+	}
+	if (stash == NULL && mapper->stash_count == CURL_MAX_STASH) {
+		// Drop the oldest block. It will be fetched again if it is needed.
+		free(mapper->stash[0].data);
+		memmove(&mapper->stash[0], &mapper->stash[1],
+				(CURL_MAX_STASH - 1) * sizeof(mapper->stash[0]));
+		stash = &mapper->stash[CURL_MAX_STASH - 1];
+	} else if (stash == NULL) {
+		stash = &mapper->stash[mapper->stash_count++];
+	}
+	stash->offset = offset;
+	stash->size = size;
+	stash->data = data;
+}
+
+static bool
+is_inflight(
+		const struct SqshCurlMapper *mapper, uint64_t offset, size_t size) {
+	for (const struct SqshCurlRange *range = mapper->inflight; range != NULL;
+		 range = range->next) {
+		if (range->start <= offset && offset + size <= range->end) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+remove_inflight(struct SqshCurlMapper *mapper, struct SqshCurlRange *range) {
+	struct SqshCurlRange **it = &mapper->inflight;
+	while (*it != range) {
+		it = &(*it)->next;
+	}
+	*it = range->next;
+}
+
+/* Splits a response covering several blocks. The first block stays in
+ * `data`, the following ones are copied to the stash. */
+static void
+split_response(
+		struct SqshCurlMapper *mapper, uint64_t offset, size_t size,
+		size_t block_size, uint8_t **data, size_t fetch_size) {
+	for (size_t pos = size; pos < fetch_size; pos += block_size) {
+		const size_t piece_size = SQSH_MIN(block_size, fetch_size - pos);
+		uint8_t *piece = malloc(piece_size);
+		if (piece == NULL) {
+			break;
+		}
+		memcpy(piece, &(*data)[pos], piece_size);
+		stash_put(mapper, offset + pos, piece_size, piece);
+	}
+	if (fetch_size != size) {
+		uint8_t *shrunk = realloc(*data, size);
+		if (shrunk != NULL) {
+			*data = shrunk;
+		}
+	}
+}
+
 static int
 sqsh_mapper_curl_map(
 		const struct SqshMapper *mapper, uint64_t offset, size_t size,
 		uint8_t **data) {
 	struct SqshCurlMapper *curl_mapper = sqsh_mapper_user_data(mapper);
 	int rv = 0;
+	bool locked = false;
 	uint64_t file_size = 0;
 	uint64_t file_time = 0;
+	CURL *handle = NULL;
+	const size_t block_size = sqsh_mapper_block_size(mapper);
+	const uint64_t archive_size = sqsh_mapper_size2(mapper);
+	struct SqshCurlRange range = {0};
 
-	sqsh__mutex_t *lock = &curl_mapper->lock;
-	rv = sqsh__mutex_lock(lock);
+	rv = sqsh__mutex_lock(&curl_mapper->lock);
 	if (rv < 0) {
 		goto out;
 	}
+	locked = true;
 	if (offset == 0 && curl_mapper->header_cache != NULL) {
 		*data = curl_mapper->header_cache;
 		curl_mapper->header_cache = NULL;
-	} else {
-		CURL *handle = configure_handle(mapper->user_data);
+		goto out;
+	}
 
-		rv = curl_download(handle, offset, size, data, &file_size, &file_time);
+	for (;;) {
+		*data = stash_take(curl_mapper, offset, size);
+		if (*data != NULL || !is_inflight(curl_mapper, offset, size)) {
+			break;
+		}
+		rv = sqsh__cond_wait(&curl_mapper->handle_cond, &curl_mapper->lock);
 		if (rv < 0) {
 			goto out;
 		}
+	}
+	if (*data != NULL) {
+		goto out;
+	}
 
-		if (file_time != curl_mapper->expected_time) {
-			rv = -SQSH_ERROR_MAPPER_MAP;
+	if (curl_mapper->has_disk_cache) {
+		sqsh__mutex_unlock(&curl_mapper->lock);
+		locked = false;
+		const int cached = sqsh__curl_cache_get(
+				&curl_mapper->disk_cache, offset, size, data);
+		lock_mutex(&curl_mapper->lock);
+		locked = true;
+		if (cached == 1) {
+			// Keep the window, so a sequential read continues with large
+			// requests once it leaves the cached part of the archive.
+			curl_mapper->next_offset = offset + size;
 			goto out;
 		}
+	}
 
-		if (file_size != sqsh_mapper_size2(mapper)) {
-			rv = -SQSH_ERROR_MAPPER_MAP;
-			goto out;
+	// Grow the request while the archive is read front to back and fall
+	// back to single blocks as soon as the reads jump around.
+	if (offset == curl_mapper->next_offset) {
+		curl_mapper->window =
+				SQSH_MIN(curl_mapper->window * 2, CURL_MAX_WINDOW);
+	} else {
+		curl_mapper->window = 1;
+	}
+	size_t fetch_size = size;
+	if (size == block_size && curl_mapper->window > 1) {
+		const uint64_t remaining = archive_size - offset;
+		fetch_size = (size_t)SQSH_MIN(
+				(uint64_t)block_size * curl_mapper->window, remaining);
+	}
+	// Don't download blocks again that are already on disk.
+	for (size_t pos = size;
+		 curl_mapper->has_disk_cache && pos < fetch_size; pos += block_size) {
+		if (sqsh__curl_cache_contains(
+					&curl_mapper->disk_cache, offset + pos,
+					SQSH_MIN(block_size, fetch_size - pos))) {
+			fetch_size = pos;
+		}
+	}
+	curl_mapper->next_offset = offset + fetch_size;
+	range.start = offset;
+	range.end = offset + fetch_size;
+	range.next = curl_mapper->inflight;
+	curl_mapper->inflight = &range;
+	sqsh__mutex_unlock(&curl_mapper->lock);
+	locked = false;
+
+	rv = acquire_handle(curl_mapper, &handle);
+	if (rv == 0) {
+		rv = curl_download(
+				handle, offset, fetch_size, data, &file_size, &file_time);
+		release_handle(curl_mapper, handle);
+	}
+	if (rv == 0 && (file_time != curl_mapper->expected_time ||
+					file_size != archive_size)) {
+		free(*data);
+		*data = NULL;
+		rv = -SQSH_ERROR_MAPPER_MAP;
+	}
+	if (rv == 0 && curl_mapper->has_disk_cache) {
+		for (size_t pos = 0; pos < fetch_size; pos += block_size) {
+			sqsh__curl_cache_put(
+					&curl_mapper->disk_cache, offset + pos, &(*data)[pos],
+					SQSH_MIN(block_size, fetch_size - pos));
 		}
 	}
 
+	// The range has to be removed from the inflight list, or threads
+	// waiting for it would block forever.
+	lock_mutex(&curl_mapper->lock);
+	locked = true;
+	if (rv == 0) {
+		split_response(curl_mapper, offset, size, block_size, data, fetch_size);
+	}
+	remove_inflight(curl_mapper, &range);
+	sqsh__cond_broadcast(&curl_mapper->handle_cond);
+
 out:
-	sqsh__mutex_unlock(lock);
+	if (locked) {
+		sqsh__mutex_unlock(&curl_mapper->lock);
+	}
 	return rv;
 }
 
 static int
 sqsh_mapper_curl_cleanup(struct SqshMapper *mapper) {
-	struct SqshCurlMapper *user_data = mapper->user_data;
-
-	free(user_data->url);
-	free(user_data->header_cache);
-	sqsh__mutex_destroy(&user_data->lock);
-	curl_easy_cleanup(user_data->handle);
+	struct SqshCurlMapper *user_data = sqsh_mapper_user_data(mapper);
+	if (user_data != NULL) {
+		curl_mapper_free(user_data);
+	}
 	return 0;
 }
 
@@ -37,10 +37,119 @@
 #include <sqsh_common_private.h>
 #include <sqsh_error.h>
 
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* `slice` must stay the first member as the rest of the library treats
+ * cache entries as `struct SqshMapSlice`. */
+struct SqshMapCacheEntry {
+	struct SqshMapSlice slice;
+	struct SqshMapManager *manager;
+	struct SqshCacheBudgetEntry budget_entry;
+	/* Prefetched entries are kept until the manager is cleaned up. They
+	 * are neither charged to the budget nor evicted by it. */
+	bool pinned;
+};
+
 static void
 map_cleanup_cb(void *data) {
-	struct SqshMapSlice *mapping = data;
-	sqsh__map_slice_cleanup(mapping);
+	struct SqshMapCacheEntry *entry = data;
+	struct SqshMapManager *manager = entry->manager;
+	__atomic_fetch_add(&manager->stats.evictions, 1, __ATOMIC_RELAXED);
+	if (manager->budget != NULL && !entry->pinned) {
+		sqsh__cache_budget_uncharge(manager->budget, entry->slice.size);
+	}
+	sqsh__map_slice_cleanup(&entry->slice);
+}
+
+static struct SqshMapManagerShard *
+get_shard(const struct SqshMapManager *manager, sqsh_index_t index) {
+	return &manager->shards[index % manager->shard_count];
+}
+
+static int
+lock_shard(struct SqshMapManagerShard *shard) {
+	return sqsh__mutex_lock_counted(
+			&shard->lock, &shard->manager->stats.lock_contentions,
+			&shard->manager->stats.lock_wait_ns);
+}
+
+static int
+budget_evict(struct SqshCacheBudgetList *list) {
+	const size_t offset = offsetof(struct SqshMapManagerShard, budget_list);
+	struct SqshMapManagerShard *shard =
+			(struct SqshMapManagerShard *)((uint8_t *)list - offset);
+
+	int rv = lock_shard(shard);
+	if (rv < 0) {
+		goto out;
+	}
+	struct SqshCacheBudgetEntry *entry = sqsh__cache_budget_list_pop(list);
+	if (entry != NULL) {
+		cx_rc_radix_tree_release(&shard->maps, entry->index);
+		rv = 1;
+	}
+	sqsh__mutex_unlock(&shard->lock);
+
+out:
+	return rv;
+}
+
+static void
+budget_touch(
+		struct SqshMapManagerShard *shard, const struct SqshMapSlice *mapping,
+		sqsh_index_t index) {
+	struct SqshMapCacheEntry *entry = (struct SqshMapCacheEntry *)mapping;
+	if (shard->budget_list.budget == NULL || entry->pinned) {
+		return;
+	}
+
+	if (sqsh__cache_budget_list_touch(
+				&shard->budget_list, &entry->budget_entry, index)) {
+		cx_rc_radix_tree_retain_value(&shard->maps, entry);
+	}
+}
+
+static int
+shard_init(
+		struct SqshMapManagerShard *shard, struct SqshMapManager *manager,
+		size_t lru_size) {
+	int rv;
+
+	shard->manager = manager;
+	rv = sqsh__mutex_init(&shard->lock);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = cx_rc_radix_tree_init(
+			&shard->maps, sizeof(struct SqshMapCacheEntry), map_cleanup_cb);
+	if (rv < 0) {
+		sqsh__mutex_destroy(&shard->lock);
+		goto out;
+	}
+	rv = cx_lru_init(
+			&shard->lru, lru_size, &cx_lru_rc_radix_tree, &shard->maps);
+	if (rv < 0) {
+		cx_rc_radix_tree_cleanup(&shard->maps);
+		sqsh__mutex_destroy(&shard->lock);
+		goto out;
+	}
+
+out:
+	return rv;
+}
+
+static void
+shard_cleanup(struct SqshMapManagerShard *shard) {
+	struct SqshCacheBudgetEntry *entry;
+	sqsh__cache_budget_unregister(&shard->budget_list);
+	while ((entry = sqsh__cache_budget_list_pop(&shard->budget_list))) {
+		cx_rc_radix_tree_release(&shard->maps, entry->index);
+	}
+	cx_lru_cleanup(&shard->lru);
+	cx_rc_radix_tree_cleanup(&shard->maps);
+	sqsh__mutex_destroy(&shard->lock);
 }
 
 SQSH_NO_UNUSED static int
@@ -83,13 +192,23 @@ sqsh__map_manager_init(
 		struct SqshMapManager *manager, const void *input,
 		const struct SqshConfig *config) {
 	int rv;
-	const size_t lru_size = SQSH_CONFIG_DEFAULT(config->mapper_lru_size, 32);
+	// With a byte budget, the budget alone decides when mappings are
+	// dropped. An additional entry based LRU would keep evicted mappings
+	// alive.
+	const size_t lru_size = config->max_cache_bytes != 0
+			? 0
+			: SQSH_CONFIG_DEFAULT(config->mapper_lru_size, 32);
+	const size_t shard_count =
+			SQSH_MAX(SQSH_CONFIG_DEFAULT(config->cache_shards, 1), 1);
 	const uint64_t archive_offset = config->archive_offset;
 
-	rv = sqsh__mutex_init(&manager->lock);
-	if (rv < 0) {
-		goto out;
-	}
+	memset(&manager->stats, 0, sizeof(manager->stats));
+	manager->budget = NULL;
+	manager->shards = NULL;
+	manager->shard_count = 0;
+	manager->is_pinned = false;
+	manager->prefetched = NULL;
+	manager->prefetched_count = 0;
 	rv = sqsh__mapper_init(&manager->mapper, input, config);
 	if (rv < 0) {
 		goto out;
@@ -106,14 +225,34 @@ sqsh__map_manager_init(
 			sqsh_mapper_block_size(&manager->mapper));
 
 	manager->archive_offset = archive_offset;
-	rv = cx_rc_radix_tree_init(
-			&manager->maps, sizeof(struct SqshMapSlice), map_cleanup_cb);
-	if (rv < 0) {
+
+	manager->shards = calloc(shard_count, sizeof(*manager->shards));
+	if (manager->shards == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
 		goto out;
 	}
+	for (size_t i = 0; i < shard_count; i++) {
+		rv = shard_init(
+				&manager->shards[i], manager,
+				SQSH_DIVIDE_CEIL(lru_size, shard_count));
+		if (rv < 0) {
+			goto out;
+		}
+		manager->shard_count++;
+	}
+
+	if (manager->block_count == 1 &&
+		manager->mapper.impl->block_size_hint == SIZE_MAX) {
+		rv = load_mapping(&manager->pinned, manager, 0);
+		if (rv < 0) {
+			goto out;
+		}
+		manager->is_pinned = true;
+		manager->stats.misses = 1;
+		manager->stats.bytes_in = manager->stats.bytes_out =
+				manager->pinned.size;
+	}
 
-	rv = cx_lru_init(
-			&manager->lru, lru_size, &cx_lru_rc_radix_tree, &manager->maps);
 out:
 	if (rv < 0) {
 		sqsh__map_manager_cleanup(manager);
@@ -131,55 +270,93 @@ sqsh__map_manager_block_size(const struct SqshMapManager *manager) {
 	return sqsh_mapper_block_size(&manager->mapper);
 }
 
+int
+sqsh__map_manager_use_budget(
+		struct SqshMapManager *manager, struct SqshCacheBudget *budget) {
+	int rv = 0;
+
+	for (size_t i = 0; i < manager->shard_count; i++) {
+		rv = sqsh__cache_budget_register(
+				budget, &manager->shards[i].budget_list, budget_evict);
+		if (rv < 0) {
+			goto out;
+		}
+	}
+	manager->budget = budget;
+
+out:
+	return rv;
+}
+
 int
 sqsh__map_manager_get(
 		struct SqshMapManager *manager, sqsh_index_t index,
 		const struct SqshMapSlice **target) {
 	int rv = 0;
+	struct SqshMapManagerShard *shard = get_shard(manager, index);
 
-	rv = sqsh__mutex_lock(&manager->lock);
+	if (manager->is_pinned && index == 0) {
+		*target = &manager->pinned;
+		return 0;
+	}
+
+	rv = lock_shard(shard);
 	if (rv < 0) {
 		goto out;
 	}
 
-	*target = cx_rc_radix_tree_retain(&manager->maps, index);
+	*target = cx_rc_radix_tree_retain(&shard->maps, index);
 
 	if (*target == NULL) {
-		struct SqshMapSlice mapping = {0};
-		sqsh__mutex_unlock(&manager->lock);
-		rv = load_mapping(&mapping, manager, index);
+		struct SqshMapCacheEntry entry = {.manager = manager};
+		sqsh__mutex_unlock(&shard->lock);
+		__atomic_fetch_add(&manager->stats.misses, 1, __ATOMIC_RELAXED);
+		rv = load_mapping(&entry.slice, manager, index);
 		if (rv < 0) {
 			goto out;
 		}
+		const size_t size = entry.slice.size;
+		__atomic_fetch_add(&manager->stats.bytes_in, size, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&manager->stats.bytes_out, size, __ATOMIC_RELAXED);
+		if (manager->budget != NULL) {
+			sqsh__cache_budget_charge(manager->budget, size);
+		}
 
-		rv = sqsh__mutex_lock(&manager->lock);
+		rv = lock_shard(shard);
 		if (rv < 0) {
 			goto out;
 		}
 
-		*target = cx_rc_radix_tree_put(&manager->maps, index, &mapping);
+		*target = cx_rc_radix_tree_put(&shard->maps, index, &entry);
+	} else {
+		__atomic_fetch_add(&manager->stats.hits, 1, __ATOMIC_RELAXED);
 	}
-	rv = cx_lru_touch(&manager->lru, index);
+	budget_touch(shard, *target, index);
+	rv = cx_lru_touch(&shard->lru, index);
 
 out:
-	sqsh__mutex_unlock(&manager->lock);
+	sqsh__mutex_unlock(&shard->lock);
+	if (rv >= 0 && manager->budget != NULL) {
+		rv = sqsh__cache_budget_enforce(manager->budget);
+	}
 	return rv;
 }
 
 int
 sqsh__map_manager_retain(
 		struct SqshMapManager *manager, const struct SqshMapSlice *mapping) {
-	if (manager == NULL || mapping == NULL) {
+	if (manager == NULL || mapping == NULL || mapping == &manager->pinned) {
 		return 0;
 	}
-	int rv = sqsh__mutex_lock(&manager->lock);
+	struct SqshMapManagerShard *shard = get_shard(manager, mapping->index);
+	int rv = lock_shard(shard);
 	if (rv < 0) {
 		goto out;
 	}
 
-	cx_rc_radix_tree_retain_value(&manager->maps, mapping);
+	cx_rc_radix_tree_retain_value(&shard->maps, mapping);
 
-	sqsh__mutex_unlock(&manager->lock);
+	sqsh__mutex_unlock(&shard->lock);
 out:
 	return rv;
 }
@@ -187,28 +364,123 @@ out:
 int
 sqsh__map_manager_release(
 		struct SqshMapManager *manager, const struct SqshMapSlice *mapping) {
-	if (manager == NULL || mapping == NULL) {
+	if (manager == NULL || mapping == NULL || mapping == &manager->pinned) {
 		return 0;
 	}
-	int rv = sqsh__mutex_lock(&manager->lock);
+	struct SqshMapManagerShard *shard = get_shard(manager, mapping->index);
+	int rv = lock_shard(shard);
 	if (rv < 0) {
 		goto out;
 	}
 
-	cx_rc_radix_tree_release(&manager->maps, mapping->index);
+	cx_rc_radix_tree_release(&shard->maps, mapping->index);
 
-	sqsh__mutex_unlock(&manager->lock);
+	sqsh__mutex_unlock(&shard->lock);
 out:
 	return rv;
 }
 
+static int
+pin_mapping(
+		struct SqshMapManager *manager, const struct SqshMapSlice *mapping) {
+	struct SqshMapCacheEntry *entry = (struct SqshMapCacheEntry *)mapping;
+	struct SqshMapManagerShard *shard = get_shard(manager, mapping->index);
+	int rv = lock_shard(shard);
+	if (rv < 0) {
+		return rv;
+	}
+
+	if (!entry->pinned) {
+		entry->pinned = true;
+		if (manager->budget != NULL) {
+			if (sqsh__cache_budget_list_remove(
+						&shard->budget_list, &entry->budget_entry)) {
+				cx_rc_radix_tree_release(&shard->maps, mapping->index);
+			}
+			sqsh__cache_budget_uncharge(manager->budget, mapping->size);
+		}
+	}
+
+	sqsh__mutex_unlock(&shard->lock);
+	return rv;
+}
+
+int
+sqsh__map_manager_prefetch(
+		struct SqshMapManager *manager, uint64_t start, uint64_t end) {
+	int rv = 0;
+	const size_t block_size = sqsh_mapper_block_size(&manager->mapper);
+	const uint64_t first = start / block_size;
+	const uint64_t last =
+			SQSH_MIN(SQSH_DIVIDE_CEIL(end, block_size), manager->block_count);
+
+	if (manager->is_pinned || first >= last) {
+		return 0;
+	}
+
+	const size_t count = (size_t)(last - first);
+	const struct SqshMapSlice **prefetched = realloc(
+			manager->prefetched,
+			(manager->prefetched_count + count) * sizeof(*prefetched));
+	if (prefetched == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	manager->prefetched = prefetched;
+
+	// Mappers that detect sequential access, like the curl mapper, combine
+	// these loads into larger requests.
+	for (uint64_t index = first; index < last; index++) {
+		const struct SqshMapSlice *slice = NULL;
+		rv = sqsh__map_manager_get(manager, index, &slice);
+		if (rv < 0) {
+			goto out;
+		}
+		manager->prefetched[manager->prefetched_count++] = slice;
+		// The slices can't be released before the manager is cleaned up,
+		// so charging them would leave the budget exceeded for good.
+		rv = pin_mapping(manager, slice);
+		if (rv < 0) {
+			goto out;
+		}
+	}
+
+out:
+	return rv;
+}
+
+void
+sqsh__map_manager_stats(
+		const struct SqshMapManager *manager, struct SqshCacheStats *stats) {
+	const struct SqshCacheStats *src = &manager->stats;
+	stats->hits = __atomic_load_n(&src->hits, __ATOMIC_RELAXED);
+	stats->misses = __atomic_load_n(&src->misses, __ATOMIC_RELAXED);
+	stats->evictions = __atomic_load_n(&src->evictions, __ATOMIC_RELAXED);
+	stats->bytes_in = __atomic_load_n(&src->bytes_in, __ATOMIC_RELAXED);
+	stats->bytes_out = __atomic_load_n(&src->bytes_out, __ATOMIC_RELAXED);
+	stats->lock_contentions =
+			__atomic_load_n(&src->lock_contentions, __ATOMIC_RELAXED);
+	stats->lock_wait_ns = __atomic_load_n(&src->lock_wait_ns, __ATOMIC_RELAXED);
+}
+
 int
 sqsh__map_manager_cleanup(struct SqshMapManager *manager) {
-	cx_lru_cleanup(&manager->lru);
-	cx_rc_radix_tree_cleanup(&manager->maps);
+	for (size_t i = 0; i < manager->prefetched_count; i++) {
+		sqsh__map_manager_release(manager, manager->prefetched[i]);
+	}
+	free(manager->prefetched);
+	manager->prefetched = NULL;
+	manager->prefetched_count = 0;
+	if (manager->is_pinned) {
+		sqsh__map_slice_cleanup(&manager->pinned);
+		manager->is_pinned = false;
+	}
+	for (size_t i = 0; i < manager->shard_count; i++) {
+		shard_cleanup(&manager->shards[i]);
+	}
+	free(manager->shards);
+	manager->shards = NULL;
+	manager->shard_count = 0;
 	sqsh__mapper_cleanup(&manager->mapper);
 
-	sqsh__mutex_destroy(&manager->lock);
-
 	return 0;
 }
@@ -56,6 +56,7 @@ sqsh__mapper_init(
 		mapper->block_size = mapper->impl->block_size_hint;
 	}
 
+	mapper->config = config;
 	if (mapper->impl->init == NULL) {
 		rv = mapper->impl->init2(mapper, source, &size);
 	} else {
@@ -74,6 +75,7 @@ sqsh__mapper_init(
 	mapper->archive_size = size;
 
 out:
+	mapper->config = NULL;
 	return rv;
 }
 
@@ -46,6 +46,23 @@
 #include <sqsh_file_private.h>
 #include <sqsh_posix_private.h>
 
+// Locking and waiting only fail for invalid or deadlocked primitives. The
+// workers below can't report errors anywhere sensible, and the job
+// accounting would be inconsistent anyway, so these are treated as fatal.
+static void
+lock_mutex(sqsh__mutex_t *mutex) {
+	int rv = sqsh__mutex_lock(mutex);
+	assert(rv == 0);
+	(void)rv;
+}
+
+static void
+wait_cond(sqsh__cond_t *cond, sqsh__mutex_t *mutex) {
+	int rv = sqsh__cond_wait(cond, mutex);
+	assert(rv == 0);
+	(void)rv;
+}
+
 int
 sqsh_file_to_stream(const struct SqshFile *file, FILE *stream) {
 	int rv = 0;
@@ -71,24 +88,43 @@ out:
 	return rv;
 }
 
-struct FileIteratorMtBlock {
-	struct FileIteratorMt *mt;
-	uint64_t block_offset;
+/**
+ * The number of blocks that are in flight at the same time if the caller
+ * doesn't choose a window.
+ */
+#define FILE_ITERATOR_MT_DEFAULT_WINDOW 64
+
+struct FileIteratorMtJob {
+	struct SqshFileIteratorMt *mt;
+	uint64_t block_index;
 };
 
-struct FileIteratorMt {
+struct SqshFileIteratorMt {
 	struct SqshFile file;
+	struct CxThreadpool *threadpool;
 	sqsh_file_iterator_mt_cb cb;
-	uint32_t chunk_size;
 	void *data;
-	atomic_int rv;
-	atomic_size_t remaining_blocks;
-
-	struct FileIteratorMtBlock *blocks;
+	// Called with `data` once the job is freed. The job holds references
+	// into the archive until then, so synchronous callers wait for this
+	// rather than for the final callback.
+	void (*free_cb)(void *data);
+	uint32_t block_size;
+	uint64_t first_block;
+	uint64_t end_block;
+	size_t references;
+
+	sqsh__mutex_t lock;
+	uint64_t next_block;
+	uint64_t processed_blocks;
+	size_t in_flight;
+	bool cancelled;
+	int rv;
+
+	struct FileIteratorMtJob *jobs;
 };
 
 struct FileToStreamMt {
-	struct FileIteratorMt mt;
+	struct SqshFileIteratorMt mt;
 	sqsh_file_to_stream_mt_cb cb;
 	void *data;
 	FILE *stream;
@@ -96,109 +132,221 @@ struct FileToStreamMt {
 };
 
 static void
-file_iterator_mt_cleanup(struct FileIteratorMt *mt, int rv) {
-	mt->cb(&mt->file, NULL, 0, mt->data, rv);
+file_iterator_mt_free(struct SqshFileIteratorMt *mt) {
+	void (*free_cb)(void *data) = mt->free_cb;
+	void *data = mt->data;
+
 	sqsh__file_cleanup(&mt->file);
-	free(mt->blocks);
+	free(mt->jobs);
 	free(mt);
+	if (free_cb != NULL) {
+		free_cb(data);
+	}
 }
 
 static void
-iterator_worker(void *data) {
-	int rv = 0, rv2 = 0;
-	struct SqshFileIterator iterator = {0};
+file_iterator_mt_unref(struct SqshFileIteratorMt *mt) {
+	if (__atomic_sub_fetch(&mt->references, 1, __ATOMIC_ACQ_REL) > 0) {
+		return;
+	}
+	sqsh__mutex_destroy(&mt->lock);
+	file_iterator_mt_free(mt);
+}
+
+static void
+file_iterator_mt_fail(struct SqshFileIteratorMt *mt, int rv) {
+	lock_mutex(&mt->lock);
+	if (mt->rv == 0) {
+		mt->rv = rv;
+	}
+	sqsh__mutex_unlock(&mt->lock);
+}
 
-	struct FileIteratorMtBlock *block = data;
-	struct FileIteratorMt *mt = block->mt;
+static void
+file_iterator_mt_finish(struct SqshFileIteratorMt *mt) {
+	int rv = 0;
+
+	lock_mutex(&mt->lock);
+	rv = mt->rv;
+	if (rv == 0 && mt->processed_blocks < mt->end_block - mt->first_block) {
+		// Blocks are only left out when the job was cancelled.
+		rv = -SQSH_ERROR_CANCELLED;
+	}
+	sqsh__mutex_unlock(&mt->lock);
+
+	mt->cb(&mt->file, NULL, 0, mt->data, rv);
+	file_iterator_mt_unref(mt);
+}
+
+static int
+iterator_process_block(struct SqshFileIteratorMt *mt, uint64_t block_index) {
+	int rv = 0;
+	struct SqshFileIterator iterator = {0};
 
 	rv = sqsh__file_iterator_init(&iterator, &mt->file);
 	if (rv < 0) {
 		goto out;
 	}
 
-	uint64_t offset = block->block_offset;
+	const uint64_t block_offset = block_index * mt->block_size;
+	uint64_t offset = block_offset;
 	rv = sqsh_file_iterator_skip2(&iterator, &offset, 1);
 	if (rv < 0) {
 		goto out;
 	}
 	assert(offset == 0);
 
-	mt->cb(&mt->file, &iterator, block->block_offset, mt->data, rv);
+	mt->cb(&mt->file, &iterator, block_offset, mt->data, rv);
 
 out:
 	sqsh__file_iterator_cleanup(&iterator);
+	return rv;
+}
+
+static void
+iterator_worker(void *data) {
+	int rv = 0;
+	struct FileIteratorMtJob *job = data;
+	struct SqshFileIteratorMt *mt = job->mt;
+	bool skip, reschedule = false, finished = false;
 
-	assert(rv2 == 0);
+	lock_mutex(&mt->lock);
+	skip = mt->cancelled || mt->rv < 0;
+	sqsh__mutex_unlock(&mt->lock);
 
-	if (rv < 0) {
-		atomic_store(&mt->rv, rv);
+	if (!skip) {
+		rv = iterator_process_block(mt, job->block_index);
+	}
+
+	// The slot of this job is only handed to the next block once the
+	// callback returned, so a slow consumer holds back the decompression
+	// of further blocks.
+	lock_mutex(&mt->lock);
+	if (rv < 0 && mt->rv == 0) {
+		mt->rv = rv;
+	} else if (!skip) {
+		mt->processed_blocks++;
+	}
+	if (!mt->cancelled && mt->rv == 0 && mt->next_block < mt->end_block) {
+		job->block_index = mt->next_block++;
+		reschedule = true;
+	} else {
+		mt->in_flight--;
+		finished = mt->in_flight == 0;
+	}
+	sqsh__mutex_unlock(&mt->lock);
+
+	if (reschedule) {
+		rv = cx_threadpool_schedule(mt->threadpool, iterator_worker, job);
+		if (rv < 0) {
+			lock_mutex(&mt->lock);
+			if (mt->rv == 0) {
+				mt->rv = rv;
+			}
+			mt->in_flight--;
+			finished = mt->in_flight == 0;
+			sqsh__mutex_unlock(&mt->lock);
+		}
 	}
 
-	size_t remaining_blocks = atomic_fetch_sub(&mt->remaining_blocks, 1);
-	assert(remaining_blocks > 0);
-	if (remaining_blocks == 1) {
-		file_iterator_mt_cleanup(mt, atomic_load(&mt->rv));
+	if (finished) {
+		file_iterator_mt_finish(mt);
 	}
 }
 
-static void
+/**
+ * Prepares the job for the blocks in [first_block, end_block) and schedules
+ * the first `window` of them. `end_block` is limited to the blocks of the
+ * file. If this fails before any block is scheduled, a negative error code
+ * is returned and the caller must report the error and free the job with
+ * file_iterator_mt_free(). Once blocks are scheduled, errors are reported
+ * through the callback.
+ */
+static int
 file_iterator_mt(
-		struct FileIteratorMt *mt, const struct SqshFile *file,
-		struct SqshThreadpool *threadpool, sqsh_file_iterator_mt_cb cb,
-		void *data, int rv) {
-	if (rv < 0) {
-		goto out;
-	}
+		struct SqshFileIteratorMt *mt, const struct SqshFile *file,
+		struct SqshThreadpool *threadpool, uint64_t first_block,
+		uint64_t end_block, size_t window, sqsh_file_iterator_mt_cb cb,
+		void *data) {
+	int rv = 0;
 	const uint64_t inode_ref = sqsh_file_inode_ref(file);
 	const struct SqshSuperblock *superblock =
 			sqsh_archive_superblock(file->archive);
-	uint32_t block_size = sqsh_superblock_block_size(superblock);
-
+	const uint32_t block_size = sqsh_superblock_block_size(superblock);
 	const uint64_t block_count =
 			SQSH_DIVIDE_CEIL(sqsh_file_size(file), block_size);
-	if (block_count > SIZE_MAX) {
-		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
-		goto out;
-	}
 
+	if (end_block > block_count) {
+		end_block = block_count;
+	}
+	if (first_block > end_block) {
+		first_block = end_block;
+	}
+	mt->threadpool = &threadpool->pool;
 	mt->cb = cb;
 	mt->data = data;
-	mt->chunk_size = block_size;
-	atomic_init(&mt->remaining_blocks, (size_t)block_count);
-	atomic_init(&mt->rv, 0);
+	mt->block_size = block_size;
+	mt->first_block = first_block;
+	mt->end_block = end_block;
+
+	if (window == 0) {
+		window = FILE_ITERATOR_MT_DEFAULT_WINDOW;
+	}
+	if (window > end_block - first_block) {
+		window = (size_t)(end_block - first_block);
+	}
 
 	rv = sqsh__file_init(&mt->file, file->archive, inode_ref);
 	if (rv < 0) {
 		goto out;
 	}
 
-	if (block_count == 0) {
+	if (window > 0) {
+		mt->jobs = calloc(window, sizeof(*mt->jobs));
+		if (mt->jobs == NULL) {
+			rv = -SQSH_ERROR_MALLOC_FAILED;
+			goto out;
+		}
+	}
+
+	rv = sqsh__mutex_init(&mt->lock);
+	if (rv < 0) {
 		goto out;
 	}
 
-	mt->blocks =
-			calloc(sizeof(struct FileIteratorMtBlock), (size_t)block_count);
-	if (mt->blocks == NULL) {
-		rv = -SQSH_ERROR_MALLOC_FAILED;
+	if (window == 0) {
+		file_iterator_mt_finish(mt);
 		goto out;
 	}
 
-	size_t block_offset = 0;
-	for (sqsh_index_t i = 0; i < block_count; i++) {
-		mt->blocks[i].mt = mt;
-		mt->blocks[i].block_offset = block_offset;
-		rv = cx_threadpool_schedule(
-				&threadpool->pool, iterator_worker, &mt->blocks[i]);
+	// Account for the whole window up front, so workers that finish while
+	// the remaining jobs are scheduled don't see the job as completed.
+	mt->next_block = first_block + window;
+	mt->in_flight = window;
+	for (sqsh_index_t i = 0; i < window; i++) {
+		struct FileIteratorMtJob *job = &mt->jobs[i];
+		job->mt = mt;
+		job->block_index = first_block + i;
+		rv = cx_threadpool_schedule(mt->threadpool, iterator_worker, job);
 		if (rv < 0) {
-			goto out;
+			bool finished;
+			lock_mutex(&mt->lock);
+			if (mt->rv == 0) {
+				mt->rv = rv;
+			}
+			mt->in_flight -= window - i;
+			finished = mt->in_flight == 0;
+			sqsh__mutex_unlock(&mt->lock);
+			if (finished) {
+				file_iterator_mt_finish(mt);
+			}
+			rv = 0;
+			break;
 		}
-		block_offset += block_size;
 	}
 
 out:
-	if (rv < 0 || block_count == 0) {
-		file_iterator_mt_cleanup(mt, rv);
-	}
+	return rv;
 }
 
 void
@@ -207,12 +355,60 @@ sqsh_file_iterator_mt(
 		sqsh_file_iterator_mt_cb cb, void *data) {
 	int rv = 0;
 
-	struct FileIteratorMt *mt = calloc(sizeof(struct FileIteratorMt), 1);
+	struct SqshFileIteratorMt *mt = calloc(1, sizeof(*mt));
+	if (mt == NULL) {
+		cb(file, NULL, 0, data, -SQSH_ERROR_MALLOC_FAILED);
+		return;
+	}
+	mt->references = 1;
+
+	rv = file_iterator_mt(mt, file, threadpool, 0, UINT64_MAX, 0, cb, data);
+	if (rv < 0) {
+		cb(file, NULL, 0, data, rv);
+		file_iterator_mt_free(mt);
+	}
+}
+
+struct SqshFileIteratorMt *
+sqsh_file_iterator_mt2(
+		const struct SqshFile *file, struct SqshThreadpool *threadpool,
+		size_t window, sqsh_file_iterator_mt_cb cb, void *data, int *err) {
+	int rv = 0;
+
+	struct SqshFileIteratorMt *mt = calloc(1, sizeof(*mt));
 	if (mt == NULL) {
 		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
 	}
+	// One reference for the running job, one for the returned handle.
+	mt->references = 2;
+
+	rv = file_iterator_mt(
+			mt, file, threadpool, 0, UINT64_MAX, window, cb, data);
+	if (rv < 0) {
+		file_iterator_mt_free(mt);
+		mt = NULL;
+	}
+
+out:
+	if (err != NULL) {
+		*err = rv;
+	}
+	return mt;
+}
+
+void
+sqsh_file_iterator_mt_cancel(struct SqshFileIteratorMt *mt) {
+	lock_mutex(&mt->lock);
+	mt->cancelled = true;
+	sqsh__mutex_unlock(&mt->lock);
+}
 
-	file_iterator_mt(mt, file, threadpool, cb, data, rv);
+void
+sqsh_file_iterator_mt_release(struct SqshFileIteratorMt *mt) {
+	if (mt != NULL) {
+		file_iterator_mt_unref(mt);
+	}
 }
 
 static void
@@ -243,7 +439,7 @@ stream_worker(
 
 out:
 	if (rv < 0) {
-		atomic_store(&mt->mt.rv, rv);
+		file_iterator_mt_fail(&mt->mt, rv);
 	}
 }
 
@@ -262,8 +458,383 @@ sqsh_file_to_stream_mt(
 	mt->data = data;
 	mt->stream = stream;
 	mt->fd = fileno(stream);
-	file_iterator_mt(&mt->mt, file, threadpool, stream_worker, mt, rv);
+	mt->mt.references = 1;
+	rv = file_iterator_mt(
+			&mt->mt, file, threadpool, 0, UINT64_MAX, 0, stream_worker, mt);
+	if (rv < 0) {
+		cb(file, stream, data, rv);
+		file_iterator_mt_free(&mt->mt);
+		rv = 0;
+	}
+
+out:
+	return rv;
+}
+
+/**
+ * Returns the end of the block that starts at `offset` within the file. The
+ * iterator handed to a block callback only presents the first chunk of a
+ * block. Sparse blocks and short uncompressed blocks continue with zeros up
+ * to this offset.
+ */
+static uint64_t
+block_end_offset(
+		const struct SqshFile *file, uint64_t offset, uint32_t block_size) {
+	return SQSH_MIN(offset + block_size, sqsh_file_size(file));
+}
+
+/**
+ * The number of blocks that are decompressed ahead of the writer by
+ * sqsh_file_to_stream_ordered() if the caller doesn't choose a window.
+ */
+#define FILE_TO_STREAM_ORDERED_DEFAULT_WINDOW 16
+
+struct FileToStreamSlot {
+	size_t size;
+	bool filled;
+};
+
+struct FileToStreamOrdered {
+	FILE *stream;
+	size_t window;
+	uint32_t block_size;
+	uint8_t *buffer;
+	struct FileToStreamSlot *slots;
+
+	sqsh__mutex_t lock;
+	sqsh__cond_t cond;
+	uint64_t next_block;
+	bool failed;
+	bool done;
+	bool released;
+	int rv;
+};
+
+static void
+ordered_released(void *data) {
+	struct FileToStreamOrdered *ordered = data;
+
+	lock_mutex(&ordered->lock);
+	ordered->released = true;
+	sqsh__cond_broadcast(&ordered->cond);
+	sqsh__mutex_unlock(&ordered->lock);
+}
+
+static void
+ordered_worker(
+		const struct SqshFile *file, const struct SqshFileIterator *iterator,
+		uint64_t offset, void *data, int err) {
+	struct FileToStreamOrdered *ordered = data;
+	lock_mutex(&ordered->lock);
+
+	if (iterator == NULL) {
+		if (err < 0 && ordered->rv == 0) {
+			ordered->rv = err;
+		}
+		ordered->done = true;
+		goto out;
+	}
+
+	const uint64_t block_index = offset / ordered->block_size;
+	struct FileToStreamSlot *slot =
+			&ordered->slots[block_index % ordered->window];
+	uint8_t *slot_buffer = &ordered->buffer
+			[(block_index % ordered->window) * ordered->block_size];
+	const size_t data_size = sqsh_file_iterator_size(iterator);
+	const size_t size =
+			(size_t)(block_end_offset(file, offset, ordered->block_size) -
+					 offset);
+
+	// Wait until the writer has emitted the block that used this slot
+	// before. This bounds the reorder buffer to `window` blocks.
+	while (!ordered->failed &&
+		   block_index >= ordered->next_block + ordered->window) {
+		wait_cond(&ordered->cond, &ordered->lock);
+	}
+	if (ordered->failed) {
+		goto out;
+	}
+	if (size > ordered->block_size || data_size > size) {
+		ordered->rv = -SQSH_ERROR_INTERNAL;
+		ordered->failed = true;
+		goto out;
+	}
+
+	// The slot belongs to this block until it is marked as filled, so the
+	// copy doesn't need to hold the lock.
+	sqsh__mutex_unlock(&ordered->lock);
+	memcpy(slot_buffer, sqsh_file_iterator_data(iterator), data_size);
+	memset(&slot_buffer[data_size], 0, size - data_size);
+	lock_mutex(&ordered->lock);
+
+	slot->size = size;
+	slot->filled = true;
 
 out:
+	sqsh__cond_broadcast(&ordered->cond);
+	sqsh__mutex_unlock(&ordered->lock);
+}
+
+static int
+ordered_write(struct FileToStreamOrdered *ordered, uint64_t block_count) {
+	int rv = 0;
+
+	while (ordered->next_block < block_count) {
+		const size_t index = (size_t)(ordered->next_block % ordered->window);
+		struct FileToStreamSlot *slot = &ordered->slots[index];
+		while (!slot->filled && !ordered->done && !ordered->failed) {
+			wait_cond(&ordered->cond, &ordered->lock);
+		}
+		if (!slot->filled) {
+			break;
+		}
+
+		// Workers never touch a filled slot, so the write doesn't need to
+		// hold the lock.
+		sqsh__mutex_unlock(&ordered->lock);
+		const uint8_t *data = &ordered->buffer[index * ordered->block_size];
+		errno = 0;
+		const size_t written =
+				fwrite(data, sizeof(uint8_t), slot->size, ordered->stream);
+		if (written != slot->size) {
+			// A short write doesn't necessarily set errno.
+			rv = ferror(ordered->stream) && errno != 0 ? -errno : -EIO;
+		}
+		lock_mutex(&ordered->lock);
+		if (rv < 0) {
+			ordered->failed = true;
+			break;
+		}
+
+		slot->filled = false;
+		ordered->next_block++;
+		sqsh__cond_broadcast(&ordered->cond);
+	}
+
+	sqsh__cond_broadcast(&ordered->cond);
 	return rv;
 }
+
+int
+sqsh_file_to_stream_ordered(
+		const struct SqshFile *file, struct SqshThreadpool *threadpool,
+		size_t window, FILE *stream) {
+	int rv = 0;
+	struct FileToStreamOrdered ordered = {0};
+	struct SqshFileIteratorMt *mt = NULL;
+	const struct SqshSuperblock *superblock =
+			sqsh_archive_superblock(file->archive);
+	const uint32_t block_size = sqsh_superblock_block_size(superblock);
+	const uint64_t block_count =
+			SQSH_DIVIDE_CEIL(sqsh_file_size(file), block_size);
+
+	if (window == 0) {
+		window = FILE_TO_STREAM_ORDERED_DEFAULT_WINDOW;
+	}
+	if (window > block_count) {
+		window = SQSH_MAX((size_t)block_count, 1);
+	}
+	ordered.stream = stream;
+	ordered.window = window;
+	ordered.block_size = block_size;
+
+	size_t buffer_size;
+	if (SQSH_MULT_OVERFLOW(window, block_size, &buffer_size)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+	ordered.buffer = malloc(buffer_size);
+	ordered.slots = calloc(window, sizeof(*ordered.slots));
+	if (ordered.buffer == NULL || ordered.slots == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+
+	rv = sqsh__mutex_init(&ordered.lock);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = sqsh__cond_init(&ordered.cond);
+	if (rv < 0) {
+		goto out_mutex;
+	}
+
+	mt = sqsh_file_iterator_mt2(
+			file, threadpool, window, ordered_worker, &ordered, &rv);
+	if (mt == NULL) {
+		goto out_cond;
+	}
+	// The job is only freed once the handle is released below, so the hook
+	// can be set after the workers started.
+	mt->free_cb = ordered_released;
+
+	lock_mutex(&ordered.lock);
+	rv = ordered_write(&ordered, block_count);
+	if (ordered.failed) {
+		sqsh_file_iterator_mt_cancel(mt);
+	}
+	// The workers use the reorder buffer until the final callback.
+	while (!ordered.done) {
+		wait_cond(&ordered.cond, &ordered.lock);
+	}
+	if (rv == 0) {
+		rv = ordered.rv;
+	}
+	sqsh__mutex_unlock(&ordered.lock);
+
+	sqsh_file_iterator_mt_release(mt);
+	lock_mutex(&ordered.lock);
+	while (!ordered.released) {
+		wait_cond(&ordered.cond, &ordered.lock);
+	}
+	sqsh__mutex_unlock(&ordered.lock);
+
+	if (rv == 0 && fflush(stream) != 0) {
+		rv = -errno;
+	}
+
+out_cond:
+	sqsh__cond_destroy(&ordered.cond);
+out_mutex:
+	sqsh__mutex_destroy(&ordered.lock);
+out:
+	free(ordered.slots);
+	free(ordered.buffer);
+	return rv;
+}
+
+struct FileReadMt {
+	uint64_t offset;
+	size_t size;
+	uint8_t *buffer;
+	uint32_t block_size;
+
+	sqsh__mutex_t lock;
+	sqsh__cond_t cond;
+	bool done;
+	int rv;
+};
+
+static void
+read_released(void *data) {
+	struct FileReadMt *request = data;
+
+	lock_mutex(&request->lock);
+	request->done = true;
+	sqsh__cond_broadcast(&request->cond);
+	sqsh__mutex_unlock(&request->lock);
+}
+
+static void
+read_worker(
+		const struct SqshFile *file, const struct SqshFileIterator *iterator,
+		uint64_t offset, void *data, int err) {
+	struct FileReadMt *request = data;
+
+	if (iterator == NULL) {
+		request->rv = err;
+		return;
+	}
+
+	// Every block copies to its own part of the buffer, so no locking is
+	// needed here.
+	const uint8_t *block_data = sqsh_file_iterator_data(iterator);
+	const uint64_t data_end = offset + sqsh_file_iterator_size(iterator);
+	const uint64_t block_end =
+			block_end_offset(file, offset, request->block_size);
+	const uint64_t start = SQSH_MAX(offset, request->offset);
+	const uint64_t end = SQSH_MIN(block_end, request->offset + request->size);
+	const uint64_t copy_end = SQSH_MIN(data_end, end);
+	if (start < copy_end) {
+		memcpy(&request->buffer[start - request->offset],
+			   &block_data[start - offset], (size_t)(copy_end - start));
+	}
+	const uint64_t zero_start = SQSH_MAX(start, data_end);
+	if (zero_start < end) {
+		memset(&request->buffer[zero_start - request->offset], 0,
+			   (size_t)(end - zero_start));
+	}
+}
+
+int
+sqsh_file_read_mt(
+		const struct SqshFile *file, struct SqshThreadpool *threadpool,
+		uint64_t offset, size_t size, uint8_t *buffer) {
+	int rv = 0;
+	struct FileReadMt request = {0};
+	struct SqshFileIteratorMt *mt = NULL;
+	const struct SqshSuperblock *superblock =
+			sqsh_archive_superblock(file->archive);
+	const uint32_t block_size = sqsh_superblock_block_size(superblock);
+
+	uint64_t end_offset;
+	if (SQSH_ADD_OVERFLOW(offset, size, &end_offset)) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+	if (end_offset > sqsh_file_size(file)) {
+		rv = -SQSH_ERROR_OUT_OF_BOUNDS;
+		goto out;
+	}
+	if (size == 0) {
+		goto out;
+	}
+
+	request.offset = offset;
+	request.size = size;
+	request.buffer = buffer;
+	request.block_size = block_size;
+	rv = sqsh__mutex_init(&request.lock);
+	if (rv < 0) {
+		goto out;
+	}
+	rv = sqsh__cond_init(&request.cond);
+	if (rv < 0) {
+		goto out_mutex;
+	}
+
+	mt = calloc(1, sizeof(*mt));
+	if (mt == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out_cond;
+	}
+	mt->references = 1;
+	mt->free_cb = read_released;
+	rv = file_iterator_mt(
+			mt, file, threadpool, offset / block_size,
+			SQSH_DIVIDE_CEIL(end_offset, block_size), 0, read_worker, &request);
+	if (rv < 0) {
+		file_iterator_mt_free(mt);
+		goto out_cond;
+	}
+
+	lock_mutex(&request.lock);
+	while (!request.done) {
+		wait_cond(&request.cond, &request.lock);
+	}
+	rv = request.rv;
+	sqsh__mutex_unlock(&request.lock);
+
+out_cond:
+	sqsh__cond_destroy(&request.cond);
+out_mutex:
+	sqsh__mutex_destroy(&request.lock);
+out:
+	return rv;
+}
+
+int
+sqsh_file_iterator_readahead(
+		struct SqshFileIterator *iterator, struct SqshThreadpool *threadpool,
+		size_t block_count) {
+	return sqsh__file_iterator_readahead(
+			iterator, &threadpool->pool, block_count);
+}
+
+int
+sqsh_file_reader_readahead(
+		struct SqshFileReader *reader, struct SqshThreadpool *threadpool,
+		size_t block_count) {
+	return sqsh__file_iterator_readahead(
+			&reader->iterator, &threadpool->pool, block_count);
+}
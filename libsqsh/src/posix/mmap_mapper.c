@@ -131,3 +131,83 @@ static const struct SqshMemoryMapperImpl impl = {
 		.cleanup = sqsh_mapper_mmap_cleanup,
 };
 const struct SqshMemoryMapperImpl *const sqsh_mapper_impl_mmap = &impl;
+
+static int
+sqsh_mapper_mmap_full_init(
+		struct SqshMapper *mapper, const void *input, uint64_t *size) {
+	int rv = 0;
+	int fd = -1;
+	off_t pos = 0;
+	uint8_t *file_map = NULL;
+
+	fd = open(input, 0);
+	if (fd < 0) {
+		rv = -errno;
+		goto out;
+	}
+
+	pos = lseek(fd, 0, SEEK_END);
+	if (pos < 0) {
+		rv = -errno;
+		goto out;
+	}
+	if ((uint64_t)pos > SIZE_MAX) {
+		rv = -SQSH_ERROR_INTEGER_OVERFLOW;
+		goto out;
+	}
+	*size = (uint64_t)pos;
+
+	if (pos != 0) {
+		file_map = mmap(NULL, (size_t)pos, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (file_map == MAP_FAILED) {
+			rv = -errno;
+			goto out;
+		}
+	}
+
+	sqsh_mapper_set_user_data(mapper, file_map);
+
+out:
+	if (fd >= 0) {
+		close(fd);
+	}
+	return rv;
+}
+
+static int
+sqsh_mapping_mmap_full_map(
+		const struct SqshMapper *mapper, uint64_t offset, size_t size,
+		uint8_t **data) {
+	(void)size;
+	uint8_t *file_map = sqsh_mapper_user_data(mapper);
+	*data = &file_map[offset];
+	return 0;
+}
+
+static int
+sqsh_mapper_mmap_full_cleanup(struct SqshMapper *mapper) {
+	uint8_t *file_map = sqsh_mapper_user_data(mapper);
+	if (file_map == NULL) {
+		return 0;
+	}
+	return munmap(file_map, (size_t)sqsh_mapper_size2(mapper));
+}
+
+static int
+sqsh_mapping_mmap_full_unmap(
+		const struct SqshMapper *mapper, uint8_t *data, size_t size) {
+	(void)mapper;
+	(void)data;
+	(void)size;
+	return 0;
+}
+
+static const struct SqshMemoryMapperImpl impl_full = {
+		.block_size_hint = SIZE_MAX,
+		.init2 = sqsh_mapper_mmap_full_init,
+		.map2 = sqsh_mapping_mmap_full_map,
+		.unmap = sqsh_mapping_mmap_full_unmap,
+		.cleanup = sqsh_mapper_mmap_full_cleanup,
+};
+const struct SqshMemoryMapperImpl *const sqsh_mapper_impl_mmap_full =
+		&impl_full;
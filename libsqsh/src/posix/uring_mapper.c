@@ -0,0 +1,353 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         uring_mapper.c
+ */
+
+#define _DEFAULT_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <sqsh_common_private.h>
+#include <sqsh_error.h>
+#include <sqsh_mapper.h>
+#include <sqsh_utils_private.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef CONFIG_URING
+#	include <liburing.h>
+#endif
+
+/* Number of block sized buffers that are kept for reuse after unmapping. */
+#define URING_POOL_SIZE 16
+/* Ranges are split into reads of this size, which are submitted together,
+ * so a single mapping keeps several requests in flight. */
+#define URING_SEGMENT_SIZE (128 * 1024)
+#define URING_QUEUE_DEPTH 32
+
+struct SqshUringMapper {
+	int fd;
+	size_t block_size;
+	sqsh__mutex_t pool_lock;
+	uint8_t *pool[URING_POOL_SIZE];
+	size_t pool_count;
+#ifdef CONFIG_URING
+	/* The ring is not thread safe. Threads that find it busy read with
+	 * pread() instead of waiting for it. */
+	sqsh__mutex_t ring_lock;
+	bool has_ring;
+	bool ring_failed;
+	struct io_uring ring;
+#endif
+};
+
+static int
+read_pread(
+		const struct SqshUringMapper *uring, uint8_t *data, uint64_t offset,
+		size_t size) {
+	size_t pos = 0;
+
+	while (pos < size) {
+		const ssize_t rv =
+				pread(uring->fd, &data[pos], size - pos, (off_t)(offset + pos));
+		if (rv < 0 && errno == EINTR) {
+			continue;
+		} else if (rv < 0) {
+			return -errno;
+		} else if (rv == 0) {
+			return -SQSH_ERROR_MAPPER_MAP;
+		}
+		pos += (size_t)rv;
+	}
+	return 0;
+}
+
+#ifdef CONFIG_URING
+/* Returns 0 if the range was read and 1 if it has to be read with pread()
+ * instead. A negative value is returned if the ring failed while reads were
+ * still in flight. */
+static int
+read_uring(
+		struct SqshUringMapper *uring, uint8_t *data, uint64_t offset,
+		size_t size) {
+	int rv = 0;
+	struct io_uring *ring = &uring->ring;
+	size_t queued = 0;
+	unsigned int prepared = 0;
+	unsigned int pending = 0;
+	bool short_read = false;
+
+	for (;;) {
+		while (!uring->ring_failed && queued < size) {
+			struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+			if (sqe == NULL) {
+				break;
+			}
+			const size_t len = SQSH_MIN(size - queued, URING_SEGMENT_SIZE);
+			io_uring_prep_read(
+					sqe, uring->fd, &data[queued], (unsigned int)len,
+					offset + queued);
+			io_uring_sqe_set_data(sqe, (void *)(uintptr_t)len);
+			queued += len;
+			prepared++;
+		}
+		if (!uring->ring_failed && prepared > 0) {
+			rv = io_uring_submit(ring);
+			if (rv > 0) {
+				prepared -= (unsigned int)rv;
+				pending += (unsigned int)rv;
+			} else if (rv != -EINTR && (pending == 0 || rv != -EAGAIN)) {
+				// Prepared entries that cannot be submitted would be
+				// picked up by a later call. Stop using the ring, collect
+				// the reads in flight and let pread() do the rest.
+				uring->ring_failed = true;
+			}
+		}
+		if (pending == 0) {
+			if (uring->ring_failed || (queued == size && prepared == 0)) {
+				break;
+			}
+			continue;
+		}
+
+		struct io_uring_cqe *cqe;
+		rv = io_uring_wait_cqe(ring, &cqe);
+		if (rv == -EINTR) {
+			continue;
+		} else if (rv < 0) {
+			uring->ring_failed = true;
+			return rv;
+		}
+		if (cqe->res < 0 ||
+			(uintptr_t)cqe->res != (uintptr_t)io_uring_cqe_get_data(cqe)) {
+			// Short reads and errors are repeated with pread() to get
+			// either the missing bytes or a meaningful error.
+			short_read = true;
+		}
+		io_uring_cqe_seen(ring, cqe);
+		pending--;
+	}
+
+	return uring->ring_failed || short_read ? 1 : 0;
+}
+#endif
+
+/* `in_flight` is set if the buffer may still be written to by the kernel
+ * after an error. */
+static int
+read_range(
+		struct SqshUringMapper *uring, uint8_t *data, uint64_t offset,
+		size_t size, bool *in_flight) {
+	*in_flight = false;
+#ifdef CONFIG_URING
+	int rv = sqsh__mutex_trylock(&uring->ring_lock);
+	if (rv < 0) {
+		return rv;
+	} else if (rv == 0) {
+		rv = uring->has_ring && !uring->ring_failed
+				? read_uring(uring, data, offset, size)
+				: 1;
+		sqsh__mutex_unlock(&uring->ring_lock);
+		if (rv < 0) {
+			*in_flight = true;
+			return -SQSH_ERROR_MAPPER_MAP;
+		} else if (rv == 0) {
+			return 0;
+		}
+	}
+#endif
+	return read_pread(uring, data, offset, size);
+}
+
+static uint8_t *
+buffer_get(struct SqshUringMapper *uring, size_t size) {
+	uint8_t *buffer = NULL;
+
+	if (size != uring->block_size) {
+		return malloc(size);
+	}
+
+	if (sqsh__mutex_lock(&uring->pool_lock) == 0) {
+		if (uring->pool_count > 0) {
+			buffer = uring->pool[--uring->pool_count];
+		}
+		sqsh__mutex_unlock(&uring->pool_lock);
+	}
+	if (buffer == NULL) {
+		buffer = malloc(size);
+	}
+	return buffer;
+}
+
+static void
+buffer_put(struct SqshUringMapper *uring, uint8_t *buffer, size_t size) {
+	if (size == uring->block_size &&
+		sqsh__mutex_lock(&uring->pool_lock) == 0) {
+		if (uring->pool_count < URING_POOL_SIZE) {
+			uring->pool[uring->pool_count++] = buffer;
+			buffer = NULL;
+		}
+		sqsh__mutex_unlock(&uring->pool_lock);
+	}
+	free(buffer);
+}
+
+static int
+sqsh_mapper_uring_init(
+		struct SqshMapper *mapper, const void *input, uint64_t *size) {
+	int rv = 0;
+	off_t pos = 0;
+	struct SqshUringMapper *uring = calloc(1, sizeof(*uring));
+	if (uring == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	uring->fd = -1;
+	uring->block_size = sqsh_mapper_block_size(mapper);
+
+	rv = sqsh__mutex_init(&uring->pool_lock);
+	if (rv < 0) {
+		free(uring);
+		return rv;
+	}
+
+	uring->fd = open(input, O_RDONLY);
+	if (uring->fd < 0) {
+		rv = -errno;
+		goto out;
+	}
+
+	pos = lseek(uring->fd, 0, SEEK_END);
+	if (pos < 0) {
+		rv = -errno;
+		goto out;
+	}
+	*size = (uint64_t)pos;
+
+#ifdef CONFIG_URING
+	rv = sqsh__mutex_init(&uring->ring_lock);
+	if (rv < 0) {
+		goto out;
+	}
+	// io_uring may be missing from the kernel or blocked by a seccomp
+	// policy. Reads fall back to pread() in that case.
+	uring->has_ring =
+			io_uring_queue_init(URING_QUEUE_DEPTH, &uring->ring, 0) == 0;
+#endif
+
+	sqsh_mapper_set_user_data(mapper, uring);
+
+out:
+	if (rv < 0) {
+		if (uring->fd >= 0) {
+			close(uring->fd);
+		}
+		sqsh__mutex_destroy(&uring->pool_lock);
+		free(uring);
+	}
+	return rv;
+}
+
+static int
+sqsh_mapper_uring_map(
+		const struct SqshMapper *mapper, uint64_t offset, size_t size,
+		uint8_t **data) {
+	int rv = 0;
+	struct SqshUringMapper *uring = sqsh_mapper_user_data(mapper);
+	uint8_t *buffer = NULL;
+	bool in_flight = false;
+
+	if (size == 0) {
+		*data = NULL;
+		return 0;
+	}
+
+	buffer = buffer_get(uring, size);
+	if (buffer == NULL) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+
+	rv = read_range(uring, buffer, offset, size, &in_flight);
+	if (rv < 0) {
+		goto out;
+	}
+
+	*data = buffer;
+	buffer = NULL;
+
+out:
+	// If the ring failed with reads in flight, the kernel may still write
+	// into the buffer. Leak it rather than handing it out again.
+	if (buffer != NULL && !in_flight) {
+		buffer_put(uring, buffer, size);
+	}
+	return rv;
+}
+
+static int
+sqsh_mapping_uring_unmap(
+		const struct SqshMapper *mapper, uint8_t *data, size_t size) {
+	struct SqshUringMapper *uring = sqsh_mapper_user_data(mapper);
+	if (data != NULL) {
+		buffer_put(uring, data, size);
+	}
+	return 0;
+}
+
+static int
+sqsh_mapper_uring_cleanup(struct SqshMapper *mapper) {
+	struct SqshUringMapper *uring = sqsh_mapper_user_data(mapper);
+
+#ifdef CONFIG_URING
+	if (uring->has_ring) {
+		io_uring_queue_exit(&uring->ring);
+	}
+	sqsh__mutex_destroy(&uring->ring_lock);
+#endif
+	for (size_t i = 0; i < uring->pool_count; i++) {
+		free(uring->pool[i]);
+	}
+	sqsh__mutex_destroy(&uring->pool_lock);
+	close(uring->fd);
+	free(uring);
+	return 0;
+}
+
+static const struct SqshMemoryMapperImpl impl = {
+		/* 1 MiB */
+		.block_size_hint = 1024 * 1024,
+		.init2 = sqsh_mapper_uring_init,
+		.map2 = sqsh_mapper_uring_map,
+		.unmap = sqsh_mapping_uring_unmap,
+		.cleanup = sqsh_mapper_uring_cleanup,
+};
+const struct SqshMemoryMapperImpl *const sqsh_mapper_impl_uring = &impl;
@@ -34,12 +34,16 @@
 #include <sqsh_table_private.h>
 
 #include <sqsh_archive.h>
+#include <sqsh_archive_private.h>
 #include <sqsh_common_private.h>
 #include <sqsh_data_private.h>
 #include <sqsh_error.h>
 
 #include <sqsh_metablock_private.h>
 
+#include <stddef.h>
+#include <stdlib.h>
+
 typedef const __attribute__((aligned(1))) uint64_t unaligned_uint64_t;
 
 static uint64_t
@@ -50,6 +54,102 @@ lookup_table_get(const struct SqshTable *table, sqsh_index_t index) {
 	return lookup_table[index];
 }
 
+static void
+cache_drop(struct SqshTableMetablockCache *cache, sqsh_index_t index) {
+	struct SqshTableMetablock *metablock = &cache->metablocks[index];
+	struct SqshCacheBudget *budget = cache->budget_list.budget;
+
+	if (budget != NULL) {
+		sqsh__cache_budget_uncharge(budget, metablock->size);
+	}
+	free(metablock->data);
+	metablock->data = NULL;
+	cache->count--;
+}
+
+static void
+cache_store(
+		struct SqshTableMetablockCache *cache, sqsh_index_t index,
+		uint8_t *data, size_t size) {
+	struct SqshTableMetablock *metablock = &cache->metablocks[index];
+	struct SqshCacheBudget *budget = cache->budget_list.budget;
+
+	// The list orders the metablocks by their last use, with or without a
+	// budget.
+	if (cache->count >= SQSH_TABLE_METABLOCK_CACHE_SIZE) {
+		struct SqshCacheBudgetEntry *entry =
+				sqsh__cache_budget_list_pop(&cache->budget_list);
+		cache_drop(cache, entry->index);
+	}
+	metablock->data = data;
+	metablock->size = size;
+	cache->count++;
+	if (budget != NULL) {
+		sqsh__cache_budget_charge(budget, size);
+	}
+	(void)sqsh__cache_budget_list_touch(
+			&cache->budget_list, &metablock->budget_entry, index);
+}
+
+static int
+budget_evict(struct SqshCacheBudgetList *list) {
+	const size_t offset = offsetof(struct SqshTableMetablockCache, budget_list);
+	struct SqshTableMetablockCache *cache =
+			(struct SqshTableMetablockCache *)((uint8_t *)list - offset);
+
+	int rv = sqsh__mutex_lock(&cache->lock);
+	if (rv < 0) {
+		goto out;
+	}
+	struct SqshCacheBudgetEntry *entry = sqsh__cache_budget_list_pop(list);
+	if (entry != NULL) {
+		cache_drop(cache, entry->index);
+		rv = 1;
+	}
+	sqsh__mutex_unlock(&cache->lock);
+
+out:
+	return rv;
+}
+
+static int
+cache_init(
+		struct SqshTableMetablockCache *cache, struct SqshArchive *archive,
+		size_t metablock_count) {
+	int rv = 0;
+	struct SqshCacheBudget *budget = sqsh__archive_cache_budget(archive);
+
+	cache->metablocks = calloc(metablock_count, sizeof(*cache->metablocks));
+	if (cache->metablocks == NULL && metablock_count > 0) {
+		return -SQSH_ERROR_MALLOC_FAILED;
+	}
+	rv = sqsh__mutex_init(&cache->lock);
+	if (rv < 0) {
+		free(cache->metablocks);
+		return rv;
+	}
+	if (budget != NULL) {
+		rv = sqsh__cache_budget_register(
+				budget, &cache->budget_list, budget_evict);
+		if (rv < 0) {
+			sqsh__mutex_destroy(&cache->lock);
+			free(cache->metablocks);
+		}
+	}
+	return rv;
+}
+
+static void
+cache_cleanup(struct SqshTableMetablockCache *cache) {
+	struct SqshCacheBudgetEntry *entry;
+	while ((entry = sqsh__cache_budget_list_pop(&cache->budget_list))) {
+		cache_drop(cache, entry->index);
+	}
+	sqsh__cache_budget_unregister(&cache->budget_list);
+	sqsh__mutex_destroy(&cache->lock);
+	free(cache->metablocks);
+}
+
 int
 sqsh__table_init(
 		struct SqshTable *table, struct SqshArchive *sqsh, uint64_t start_block,
@@ -62,6 +162,7 @@ sqsh__table_init(
 	uint64_t upper_limit;
 	struct SqshMapManager *map_manager = sqsh_archive_map_manager(sqsh);
 
+	table->cache = NULL;
 	if (SQSH_MULT_OVERFLOW(element_size, element_count, &table_size)) {
 		return -SQSH_ERROR_INTEGER_OVERFLOW;
 	}
@@ -96,6 +197,19 @@ sqsh__table_init(
 		goto out;
 	}
 
+	table->metablock_count = lookup_table_count;
+	table->cache = calloc(1, sizeof(*table->cache));
+	if (table->cache == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	rv = cache_init(table->cache, sqsh, lookup_table_count);
+	if (rv < 0) {
+		free(table->cache);
+		table->cache = NULL;
+		goto out;
+	}
+
 out:
 	if (rv < 0) {
 		sqsh__table_cleanup(table);
@@ -103,22 +217,14 @@ out:
 	return rv;
 }
 
-int
-sqsh_table_get(
-		const struct SqshTable *table, sqsh_index_t index, void *target) {
+static int
+metablock_extract(
+		const struct SqshTable *table, sqsh_index_t lookup_index, size_t size,
+		uint8_t **target) {
 	int rv = 0;
-	struct SqshArchive *sqsh = table->sqsh;
 	struct SqshMetablockReader metablock = {0};
-	size_t lookup_table_bytes = sqsh__map_reader_size(&table->lookup_table);
-	sqsh_index_t lookup_index =
-			index * table->element_size / SQSH_METABLOCK_BLOCK_SIZE;
-	if (lookup_index >= table->element_count ||
-		lookup_index * sizeof(uint64_t) >= lookup_table_bytes) {
-		return -SQSH_ERROR_OUT_OF_BOUNDS;
-	}
+	uint8_t *data = NULL;
 	uint64_t metablock_address = lookup_table_get(table, lookup_index);
-	uint64_t element_offset =
-			(index * table->element_size) % SQSH_METABLOCK_BLOCK_SIZE;
 
 	uint64_t upper_limit = SQSH_METABLOCK_BLOCK_SIZE;
 	if (SQSH_ADD_OVERFLOW(metablock_address, upper_limit, &upper_limit)) {
@@ -126,27 +232,140 @@ sqsh_table_get(
 	}
 
 	rv = sqsh__metablock_reader_init(
-			&metablock, sqsh, metablock_address, upper_limit);
+			&metablock, table->sqsh, metablock_address, upper_limit);
 	if (rv < 0) {
 		goto out;
 	}
 
-	rv = sqsh__metablock_reader_advance(
-			&metablock, element_offset, table->element_size);
+	rv = sqsh__metablock_reader_advance(&metablock, 0, size);
 	if (rv < 0) {
 		goto out;
 	}
 
-	memcpy(target, sqsh__metablock_reader_data(&metablock),
-		   table->element_size);
+	data = malloc(size);
+	if (data == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	memcpy(data, sqsh__metablock_reader_data(&metablock), size);
+	*target = data;
 
 out:
 	sqsh__metablock_reader_cleanup(&metablock);
 	return rv;
 }
 
+/* Copies `size` bytes at `offset` of a metablock to `target`. The copy is
+ * made under the lock, as the metablock may be evicted right after. */
+static int
+metablock_copy(
+		const struct SqshTable *table, sqsh_index_t lookup_index,
+		size_t offset, size_t size, uint8_t *target) {
+	int rv = 0;
+	struct SqshTableMetablockCache *cache = table->cache;
+	struct SqshTableMetablock *metablock = &cache->metablocks[lookup_index];
+	uint8_t *data = NULL;
+
+	rv = sqsh__mutex_lock(&cache->lock);
+	if (rv < 0) {
+		return rv;
+	}
+	if (metablock->data != NULL) {
+		(void)sqsh__cache_budget_list_touch(
+				&cache->budget_list, &metablock->budget_entry, lookup_index);
+		memcpy(target, &metablock->data[offset], size);
+		sqsh__mutex_unlock(&cache->lock);
+		return 0;
+	}
+	sqsh__mutex_unlock(&cache->lock);
+
+	// All metablocks but the last one are completely filled.
+	size_t metablock_size = table->element_size * table->element_count -
+			lookup_index * SQSH_METABLOCK_BLOCK_SIZE;
+	metablock_size = SQSH_MIN(metablock_size, SQSH_METABLOCK_BLOCK_SIZE);
+
+	rv = metablock_extract(table, lookup_index, metablock_size, &data);
+	if (rv < 0) {
+		return rv;
+	}
+
+	rv = sqsh__mutex_lock(&cache->lock);
+	if (rv < 0) {
+		free(data);
+		return rv;
+	}
+	// Another thread may have been faster. In that case use its copy.
+	if (metablock->data == NULL) {
+		cache_store(cache, lookup_index, data, metablock_size);
+		data = NULL;
+	} else {
+		(void)sqsh__cache_budget_list_touch(
+				&cache->budget_list, &metablock->budget_entry, lookup_index);
+	}
+	memcpy(target, &metablock->data[offset], size);
+	sqsh__mutex_unlock(&cache->lock);
+	free(data);
+
+	if (cache->budget_list.budget != NULL) {
+		rv = sqsh__cache_budget_enforce(cache->budget_list.budget);
+	}
+	return rv;
+}
+
+int
+sqsh_table_get(
+		const struct SqshTable *table, sqsh_index_t index, void *target) {
+	return sqsh_table_get_range(table, index, 1, target);
+}
+
+int
+sqsh_table_get_range(
+		const struct SqshTable *table, sqsh_index_t start, size_t count,
+		void *target) {
+	int rv = 0;
+	uint8_t *target_bytes = target;
+	const size_t lookup_table_bytes =
+			sqsh__map_reader_size(&table->lookup_table);
+	sqsh_index_t end;
+
+	if (SQSH_ADD_OVERFLOW(start, count, &end) || end > table->element_count) {
+		return -SQSH_ERROR_OUT_OF_BOUNDS;
+	}
+
+	// element_size * element_count is checked for overflows in
+	// sqsh__table_init().
+	uint64_t offset = start * table->element_size;
+	const uint64_t end_offset = end * table->element_size;
+	while (offset < end_offset) {
+		const sqsh_index_t lookup_index = offset / SQSH_METABLOCK_BLOCK_SIZE;
+		const size_t element_offset = offset % SQSH_METABLOCK_BLOCK_SIZE;
+		const size_t size = SQSH_MIN(
+				SQSH_METABLOCK_BLOCK_SIZE - element_offset,
+				end_offset - offset);
+		if (lookup_index >= table->metablock_count ||
+			lookup_index * sizeof(uint64_t) >= lookup_table_bytes) {
+			return -SQSH_ERROR_OUT_OF_BOUNDS;
+		}
+		rv = metablock_copy(
+				table, lookup_index, element_offset, size, target_bytes);
+		if (rv < 0) {
+			return rv;
+		}
+
+		target_bytes += size;
+		offset += size;
+	}
+
+	return rv;
+}
+
 int
 sqsh__table_cleanup(struct SqshTable *table) {
+	if (table->cache != NULL) {
+		cache_cleanup(table->cache);
+		free(table->cache);
+		table->cache = NULL;
+	}
 	sqsh__map_reader_cleanup(&table->lookup_table);
 	return 0;
 }
@@ -0,0 +1,285 @@
+/******************************************************************************
+ *                                                                            *
+ * Copyright (c) 2023-2024, Enno Boland <g@s01.de>                            *
+ *                                                                            *
+ * Redistribution and use in source and binary forms, with or without         *
+ * modification, are permitted provided that the following conditions are     *
+ * met:                                                                       *
+ *                                                                            *
+ * * Redistributions of source code must retain the above copyright notice,   *
+ *   this list of conditions and the following disclaimer.                    *
+ * * Redistributions in binary form must reproduce the above copyright        *
+ *   notice, this list of conditions and the following disclaimer in the      *
+ *   documentation and/or other materials provided with the distribution.     *
+ *                                                                            *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS    *
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,  *
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR     *
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR          *
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,      *
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,        *
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR         *
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF     *
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING       *
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS         *
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.               *
+ *                                                                            *
+ ******************************************************************************/
+
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         path_cache.c
+ */
+
+#include <sqsh_tree_private.h>
+
+#include <sqsh_common_private.h>
+#include <sqsh_error.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+struct SqshPathCacheEntry {
+	struct SqshPathCacheEntry *bucket_next;
+	struct SqshPathCacheEntry *lru_prev;
+	struct SqshPathCacheEntry *lru_next;
+	uint64_t hash;
+	struct SqshPathCacheValue value;
+	bool follow_symlinks;
+	size_t path_len;
+	char path[];
+};
+
+static void
+normalize_path(const char **path, size_t *path_len) {
+	// All paths are resolved from the root directory, so leading slashes
+	// do not change the result. Other redundant parts like `a//b` or `a/./b`
+	// are kept and are cached as separate paths.
+	while (*path_len > 0 && (*path)[0] == '/') {
+		(*path)++;
+		(*path_len)--;
+	}
+}
+
+static uint64_t
+hash_path(const char *path, size_t path_len, bool follow_symlinks) {
+	const uint8_t follow = follow_symlinks;
+	const uint64_t hash =
+			sqsh__hash_fnv1a(SQSH_HASH_FNV1A_INIT, path, path_len);
+	return sqsh__hash_fnv1a(hash, &follow, sizeof(follow));
+}
+
+static void
+lru_unlink(struct SqshPathCache *cache, struct SqshPathCacheEntry *entry) {
+	if (entry->lru_prev != NULL) {
+		entry->lru_prev->lru_next = entry->lru_next;
+	} else {
+		cache->lru_head = entry->lru_next;
+	}
+	if (entry->lru_next != NULL) {
+		entry->lru_next->lru_prev = entry->lru_prev;
+	} else {
+		cache->lru_tail = entry->lru_prev;
+	}
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+static void
+lru_push(struct SqshPathCache *cache, struct SqshPathCacheEntry *entry) {
+	entry->lru_next = cache->lru_head;
+	if (cache->lru_head != NULL) {
+		cache->lru_head->lru_prev = entry;
+	} else {
+		cache->lru_tail = entry;
+	}
+	cache->lru_head = entry;
+}
+
+static struct SqshPathCacheEntry **
+find_slot(
+		struct SqshPathCache *cache, const char *path, size_t path_len,
+		bool follow_symlinks, uint64_t hash) {
+	struct SqshPathCacheEntry **slot =
+			&cache->buckets[hash & cache->bucket_mask];
+	for (; *slot != NULL; slot = &(*slot)->bucket_next) {
+		const struct SqshPathCacheEntry *entry = *slot;
+		if (entry->hash == hash && entry->path_len == path_len &&
+			entry->follow_symlinks == follow_symlinks &&
+			memcmp(entry->path, path, path_len) == 0) {
+			break;
+		}
+	}
+	return slot;
+}
+
+static bool
+cache_get(
+		struct SqshPathCache *cache, const char *path, size_t path_len,
+		bool follow_symlinks, struct SqshPathCacheValue *value) {
+	const uint64_t hash = hash_path(path, path_len, follow_symlinks);
+	struct SqshPathCacheEntry *entry =
+			*find_slot(cache, path, path_len, follow_symlinks, hash);
+	if (entry == NULL) {
+		return false;
+	}
+	lru_unlink(cache, entry);
+	lru_push(cache, entry);
+	*value = entry->value;
+	return true;
+}
+
+static void
+evict(struct SqshPathCache *cache) {
+	struct SqshPathCacheEntry *entry = cache->lru_tail;
+	struct SqshPathCacheEntry **slot = find_slot(
+			cache, entry->path, entry->path_len, entry->follow_symlinks,
+			entry->hash);
+
+	*slot = entry->bucket_next;
+	lru_unlink(cache, entry);
+	cache->count--;
+	free(entry);
+}
+
+int
+sqsh__path_cache_init(struct SqshPathCache *cache, size_t size) {
+	int rv = 0;
+	size_t bucket_count = 1;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->size = size;
+	if (size > 0) {
+		while (bucket_count < size) {
+			bucket_count *= 2;
+		}
+		cache->buckets = calloc(bucket_count, sizeof(*cache->buckets));
+		if (cache->buckets == NULL) {
+			return -SQSH_ERROR_MALLOC_FAILED;
+		}
+		cache->bucket_mask = bucket_count - 1;
+	}
+	rv = sqsh__mutex_init(&cache->lock);
+	if (rv < 0) {
+		free(cache->buckets);
+		cache->buckets = NULL;
+	}
+	return rv;
+}
+
+bool
+sqsh__path_cache_get(
+		struct SqshPathCache *cache, const char *path, size_t path_len,
+		bool follow_symlinks, struct SqshPathCacheValue *value) {
+	bool found = false;
+
+	if (cache->size == 0) {
+		return false;
+	}
+	normalize_path(&path, &path_len);
+
+	if (sqsh__mutex_lock(&cache->lock) < 0) {
+		return false;
+	}
+	found = cache_get(cache, path, path_len, follow_symlinks, value);
+	sqsh__mutex_unlock(&cache->lock);
+	return found;
+}
+
+size_t
+sqsh__path_cache_get_prefix(
+		struct SqshPathCache *cache, const char *path, size_t path_len,
+		struct SqshPathCacheValue *value) {
+	const char *const full_path = path;
+	size_t prefix_len = 0;
+
+	if (cache->size == 0) {
+		return 0;
+	}
+	normalize_path(&path, &path_len);
+
+	if (sqsh__mutex_lock(&cache->lock) < 0) {
+		return 0;
+	}
+	// Directories are stored without trailing slashes. Try the longest
+	// prefix first.
+	for (size_t i = path_len; i > 1; i--) {
+		if (path[i - 1] != '/' || path[i - 2] == '/') {
+			continue;
+		}
+		if (cache_get(cache, path, i - 1, true, value)) {
+			prefix_len = (size_t)(path - full_path) + i - 1;
+			break;
+		}
+	}
+	sqsh__mutex_unlock(&cache->lock);
+	return prefix_len;
+}
+
+int
+sqsh__path_cache_put(
+		struct SqshPathCache *cache, const char *path, size_t path_len,
+		bool follow_symlinks, const struct SqshPathCacheValue *value) {
+	int rv = 0;
+	struct SqshPathCacheEntry *entry = NULL;
+	size_t entry_size;
+
+	if (cache->size == 0) {
+		return 0;
+	}
+	normalize_path(&path, &path_len);
+
+	if (SQSH_ADD_OVERFLOW(sizeof(*entry), path_len, &entry_size)) {
+		return -SQSH_ERROR_INTEGER_OVERFLOW;
+	}
+	const uint64_t hash = hash_path(path, path_len, follow_symlinks);
+
+	rv = sqsh__mutex_lock(&cache->lock);
+	if (rv < 0) {
+		return rv;
+	}
+	struct SqshPathCacheEntry **slot =
+			find_slot(cache, path, path_len, follow_symlinks, hash);
+	if (*slot != NULL) {
+		(*slot)->value = *value;
+		goto out;
+	}
+
+	entry = calloc(1, entry_size);
+	if (entry == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+	entry->hash = hash;
+	entry->value = *value;
+	entry->follow_symlinks = follow_symlinks;
+	entry->path_len = path_len;
+	memcpy(entry->path, path, path_len);
+
+	*slot = entry;
+	lru_push(cache, entry);
+	cache->count++;
+	if (cache->count > cache->size) {
+		evict(cache);
+	}
+out:
+	sqsh__mutex_unlock(&cache->lock);
+	return rv;
+}
+
+int
+sqsh__path_cache_cleanup(struct SqshPathCache *cache) {
+	struct SqshPathCacheEntry *entry = cache->lru_head;
+	while (entry != NULL) {
+		struct SqshPathCacheEntry *next = entry->lru_next;
+		free(entry);
+		entry = next;
+	}
+	cache->lru_head = NULL;
+	cache->lru_tail = NULL;
+	free(cache->buckets);
+	cache->buckets = NULL;
+	sqsh__mutex_destroy(&cache->lock);
+	return 0;
+}
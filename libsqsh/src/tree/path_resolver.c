@@ -45,7 +45,7 @@
 
 static int path_resolve(
 		struct SqshPathResolver *resolver, const char *path, size_t path_len,
-		bool follow_symlinks);
+		bool follow_symlinks, const char *cache_base);
 
 static size_t
 path_segment_len(const char *path, size_t path_len) {
@@ -372,7 +372,7 @@ sqsh__path_resolver_follow_symlink(struct SqshPathResolver *resolver) {
 	const char *target = sqsh_file_symlink(&file);
 	size_t target_size = sqsh_file_symlink_size(&file);
 
-	rv = path_resolve(resolver, target, target_size, true);
+	rv = path_resolve(resolver, target, target_size, true, NULL);
 
 out:
 	sqsh__file_cleanup(&file);
@@ -400,10 +400,25 @@ sqsh_path_resolver_type(const struct SqshPathResolver *walker) {
 	}
 }
 
+static void
+cache_directory(
+		struct SqshPathResolver *resolver, const char *path, size_t path_len) {
+	const struct SqshPathCacheValue value = {
+			.inode_ref = sqsh_file_inode_ref(&resolver->cwd),
+			.parent_inode_ref = SQSH_INODE_REF_NULL,
+			.symlink_depth = resolver->current_symlink_depth,
+	};
+	// The cache only saves work, so a failure to store the directory is not
+	// an error.
+	(void)sqsh__path_cache_put(
+			sqsh__archive_path_cache(resolver->archive), path, path_len, true,
+			&value);
+}
+
 static int
 path_resolve(
 		struct SqshPathResolver *resolver, const char *path, size_t path_len,
-		bool follow_symlinks) {
+		bool follow_symlinks, const char *cache_base) {
 	int rv = 0;
 	const char *segment = path;
 	const char *next_segment = NULL;
@@ -451,6 +466,14 @@ path_resolve(
 		is_dir = sqsh_path_resolver_type(resolver) == SQSH_FILE_TYPE_DIRECTORY;
 		if (is_dir && !is_beginning(resolver)) {
 			rv = sqsh_path_resolver_down(resolver);
+			if (rv < 0) {
+				goto out;
+			}
+		}
+		if (is_dir && next_segment != NULL && cache_base != NULL) {
+			cache_directory(
+					resolver, cache_base,
+					(size_t)(&segment[segment_len] - cache_base));
 		}
 	} while ((segment = next_segment) != NULL);
 out:
@@ -462,7 +485,41 @@ sqsh__path_resolver_resolve_nt(
 		struct SqshPathResolver *resolver, const char *path, size_t path_len,
 		bool follow_symlinks) {
 	resolver->current_symlink_depth = 0;
-	return path_resolve(resolver, path, path_len, follow_symlinks);
+	return path_resolve(resolver, path, path_len, follow_symlinks, NULL);
+}
+
+int
+sqsh__path_resolver_resolve_from_root(
+		struct SqshPathResolver *resolver, const char *path, size_t path_len,
+		bool follow_symlinks) {
+	int rv = 0;
+	struct SqshPathCacheValue prefix = {0};
+	const size_t prefix_len = sqsh__path_cache_get_prefix(
+			sqsh__archive_path_cache(resolver->archive), path, path_len,
+			&prefix);
+
+	if (prefix_len == 0) {
+		rv = sqsh_path_resolver_to_root(resolver);
+	} else if (prefix.error < 0) {
+		rv = prefix.error;
+	} else {
+		rv = sqsh__path_resolver_to_ref(resolver, prefix.inode_ref);
+	}
+	if (rv < 0) {
+		goto out;
+	}
+	resolver->current_symlink_depth = prefix.symlink_depth;
+
+	sqsh_index_t offset = prefix_len;
+	for (; offset < path_len && path[offset] == '/'; offset++) {
+	}
+	if (offset == path_len && prefix_len != 0) {
+		goto out;
+	}
+	rv = path_resolve(
+			resolver, &path[offset], path_len - offset, follow_symlinks, path);
+out:
+	return rv;
 }
 
 int
@@ -40,6 +40,8 @@
 #include <sqsh_data_private.h>
 #include <sqsh_file_private.h>
 
+#include <pthread.h>
+
 // The SqshConfig struct as it was in version 1.0. This is used to perform ABI
 // compatibility checks.
 
@@ -82,4 +84,323 @@ UTEST(config, config_compat_check_v1_0) {
 			sizeof(struct SqshConfigV1_0));
 }
 
+UTEST(archive, stats_count_cache_hits_and_misses) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	struct SqshArchiveStats stats = {0};
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* datablock */
+			[1024] = ZLIB_ABCD,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128), 0, 0, 0,
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, 4),
+			DATA_BLOCK_REF(sizeof((uint8_t[]){ZLIB_ABCD}), 1),
+			/* clang-format on */
+	};
+	mk_stub(&archive, payload, sizeof(payload));
+
+	rv = sqsh_archive_stats(&archive, &stats);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)0, stats.data.misses);
+	ASSERT_EQ((uint64_t)0, stats.data.hits);
+
+	uint64_t inode_ref = sqsh_address_ref_create(0, 3);
+	rv = sqsh__file_init(&file, &archive, inode_ref);
+	ASSERT_EQ(0, rv);
+
+	for (int i = 0; i < 2; i++) {
+		struct SqshFileReader reader = {0};
+		rv = sqsh__file_reader_init(&reader, &file);
+		ASSERT_EQ(0, rv);
+
+		rv = sqsh_file_reader_advance2(&reader, 0, 4);
+		ASSERT_EQ(0, rv);
+		ASSERT_EQ((size_t)4, sqsh_file_reader_size(&reader));
+
+		sqsh__file_reader_cleanup(&reader);
+	}
+
+	rv = sqsh_archive_stats(&archive, &stats);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(SQSH_COMPRESSION_GZIP, (int)stats.compression_id);
+	ASSERT_EQ((uint64_t)1, stats.data.misses);
+	ASSERT_EQ((uint64_t)1, stats.data.hits);
+	ASSERT_EQ((uint64_t)sizeof((uint8_t[]){ZLIB_ABCD}), stats.data.bytes_in);
+	ASSERT_EQ((uint64_t)4, stats.data.bytes_out);
+	ASSERT_EQ((uint64_t)0, stats.data.evictions);
+	/* The inode metablock is stored uncompressed and bypasses the cache. */
+	ASSERT_EQ((uint64_t)0, stats.metablock.misses);
+	ASSERT_LT((uint64_t)0, stats.mapper.misses);
+
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
+static int
+read_abcd_twice(struct SqshArchive *archive) {
+	int rv;
+	struct SqshFile file = {0};
+	uint64_t inode_ref = sqsh_address_ref_create(0, 3);
+	rv = sqsh__file_init(&file, archive, inode_ref);
+	if (rv < 0) {
+		return rv;
+	}
+
+	for (int i = 0; i < 2 && rv == 0; i++) {
+		struct SqshFileReader reader = {0};
+		rv = sqsh__file_reader_init(&reader, &file);
+		if (rv == 0) {
+			rv = sqsh_file_reader_advance2(&reader, 0, 4);
+		}
+		sqsh__file_reader_cleanup(&reader);
+	}
+
+	sqsh__file_cleanup(&file);
+	return rv;
+}
+
+UTEST(archive, cache_budget_evicts_unused_blocks) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshArchiveStats stats = {0};
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* datablock */
+			[1024] = ZLIB_ABCD,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128), 0, 0, 0,
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, 4),
+			DATA_BLOCK_REF(sizeof((uint8_t[]){ZLIB_ABCD}), 1),
+			/* clang-format on */
+	};
+	FILE *farchive = test_sqsh_prepare_archive(payload, sizeof(payload));
+	fclose(farchive);
+
+	struct SqshConfig config = DEFAULT_CONFIG(sizeof(payload));
+	config.max_cache_bytes = 1;
+	rv = sqsh__archive_init(&archive, payload, &config);
+	ASSERT_EQ(0, rv);
+
+	rv = read_abcd_twice(&archive);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_archive_stats(&archive, &stats);
+	ASSERT_EQ(0, rv);
+	// The block does not fit into the budget, so it is dropped as soon as
+	// each reader releases it.
+	ASSERT_EQ((uint64_t)2, stats.data.misses);
+	ASSERT_EQ((uint64_t)0, stats.data.hits);
+	ASSERT_EQ((uint64_t)2, stats.data.evictions);
+	ASSERT_LE(archive.cache_budget.used_bytes, config.max_cache_bytes);
+
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(archive, cache_budget_keeps_blocks_that_fit) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshArchiveStats stats = {0};
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* datablock */
+			[1024] = ZLIB_ABCD,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128), 0, 0, 0,
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, 4),
+			DATA_BLOCK_REF(sizeof((uint8_t[]){ZLIB_ABCD}), 1),
+			/* clang-format on */
+	};
+	FILE *farchive = test_sqsh_prepare_archive(payload, sizeof(payload));
+	fclose(farchive);
+
+	struct SqshConfig config = DEFAULT_CONFIG(sizeof(payload));
+	config.max_cache_bytes = sizeof(payload) + 4;
+	rv = sqsh__archive_init(&archive, payload, &config);
+	ASSERT_EQ(0, rv);
+
+	rv = read_abcd_twice(&archive);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_archive_stats(&archive, &stats);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)1, stats.data.misses);
+	ASSERT_EQ((uint64_t)1, stats.data.hits);
+	ASSERT_EQ((uint64_t)0, stats.data.evictions);
+	ASSERT_LE(archive.cache_budget.used_bytes, config.max_cache_bytes);
+
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(archive, sharded_caches) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshArchiveStats stats = {0};
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* datablock */
+			[1024] = ZLIB_ABCD,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128), 0, 0, 0,
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, 4),
+			DATA_BLOCK_REF(sizeof((uint8_t[]){ZLIB_ABCD}), 1),
+			/* clang-format on */
+	};
+	FILE *farchive = test_sqsh_prepare_archive(payload, sizeof(payload));
+	fclose(farchive);
+
+	struct SqshConfig config = DEFAULT_CONFIG(sizeof(payload));
+	config.cache_shards = 7;
+	config.max_cache_bytes = sizeof(payload) + 4;
+	rv = sqsh__archive_init(&archive, payload, &config);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((size_t)7, archive.map_manager.shard_count);
+
+	rv = read_abcd_twice(&archive);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_archive_stats(&archive, &stats);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)1, stats.data.misses);
+	ASSERT_EQ((uint64_t)1, stats.data.hits);
+	ASSERT_EQ((uint64_t)0, stats.data.evictions);
+	ASSERT_LE(archive.cache_budget.used_bytes, config.max_cache_bytes);
+
+	sqsh__archive_cleanup(&archive);
+}
+
+static int
+evict_nothing(struct SqshCacheBudgetList *list) {
+	(void)list;
+	return 0;
+}
+
+static void *
+enforce_budget(void *data) {
+	struct SqshCacheBudget *budget = data;
+	for (int i = 0; i < 1000; i++) {
+		if (sqsh__cache_budget_enforce(budget) < 0) {
+			return budget;
+		}
+	}
+	return NULL;
+}
+
+UTEST(archive, cache_budget_lists_change_while_enforcing) {
+	int rv;
+	struct SqshCacheBudget budget = {0};
+	struct SqshCacheBudgetList lists[4] = {0};
+	pthread_t thread;
+	void *result;
+
+	rv = sqsh__cache_budget_init(&budget, 1);
+	ASSERT_EQ(0, rv);
+	sqsh__cache_budget_charge(&budget, 2);
+
+	rv = pthread_create(&thread, NULL, enforce_budget, &budget);
+	ASSERT_EQ(0, rv);
+	for (int i = 0; i < 1000; i++) {
+		for (size_t j = 0; j < 4; j++) {
+			rv = sqsh__cache_budget_register(&budget, &lists[j], evict_nothing);
+			ASSERT_EQ(0, rv);
+		}
+		// Lists are dropped in a different order than they were added.
+		sqsh__cache_budget_unregister(&lists[1]);
+		sqsh__cache_budget_unregister(&lists[3]);
+		sqsh__cache_budget_unregister(&lists[0]);
+		sqsh__cache_budget_unregister(&lists[2]);
+	}
+	rv = pthread_join(thread, &result);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(NULL, result);
+	ASSERT_EQ((size_t)0, budget.list_count);
+
+	sqsh__cache_budget_uncharge(&budget, 2);
+	rv = sqsh__cache_budget_cleanup(&budget);
+	ASSERT_EQ(0, rv);
+}
+
+UTEST(archive, prefetch_metadata) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshArchiveStats stats = {0};
+	struct SqshFile file = {0};
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* datablock */
+			[1024] = ZLIB_ABCD,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128), 0, 0, 0,
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, 4),
+			DATA_BLOCK_REF(sizeof((uint8_t[]){ZLIB_ABCD}), 1),
+			/* clang-format on */
+	};
+	FILE *farchive = test_sqsh_prepare_archive(payload, sizeof(payload));
+	fclose(farchive);
+
+	struct SqshConfig config = DEFAULT_CONFIG(sizeof(payload));
+	config.mapper_block_size = 1024;
+	config.prefetch_metadata = 1;
+	rv = sqsh__archive_init(&archive, payload, &config);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_archive_stats(&archive, &stats);
+	ASSERT_EQ(0, rv);
+	const uint64_t misses = stats.mapper.misses;
+	/* The superblock and all blocks from the inode table to the end. */
+	ASSERT_EQ((uint64_t)1 + (sizeof(payload) - INODE_TABLE_OFFSET) / 1024,
+			  misses);
+
+	uint64_t inode_ref = sqsh_address_ref_create(0, 3);
+	rv = sqsh__file_init(&file, &archive, inode_ref);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)4, sqsh_file_size(&file));
+
+	rv = sqsh_archive_stats(&archive, &stats);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(misses, stats.mapper.misses);
+
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(archive, prefetch_metadata_is_not_charged) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshArchiveStats stats = {0};
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* clang-format on */
+	};
+	FILE *farchive = test_sqsh_prepare_archive(payload, sizeof(payload));
+	fclose(farchive);
+
+	struct SqshConfig config = DEFAULT_CONFIG(sizeof(payload));
+	config.mapper_block_size = 1024;
+	config.prefetch_metadata = 1;
+	/* Less than the prefetched metadata, but enough for the superblock. */
+	config.max_cache_bytes = 2048;
+	rv = sqsh__archive_init(&archive, payload, &config);
+	ASSERT_EQ(0, rv);
+
+	ASSERT_LE(archive.cache_budget.used_bytes, config.max_cache_bytes);
+	rv = sqsh_archive_stats(&archive, &stats);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)0, stats.mapper.evictions);
+
+	sqsh__archive_cleanup(&archive);
+}
+
 UTEST_MAIN()
@@ -148,6 +148,13 @@
 	0x78, 0x9c, 0x4b, 0x4c, 0x4a, 0x4e, 0x01, 0x00, 0x03, 0xd8, 0x01, 0x8b
 #define ZLIB_EFGH \
 	0x78, 0x9c, 0x4b, 0x4d, 0x4b, 0xcf, 0x00, 0x00, 0x04, 0x00, 0x01, 0x9b
+/* 32768 times 'a' */
+#define ZLIB_32K_A \
+	0x78, 0xda, 0xed, 0xc1, 0x81, 0x00, 0x00, 0x00, 0x00, 0x80, 0x20, 0xd6, \
+			0xfd, 0x25, 0x16, 0xa9, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, \
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, \
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, \
+			0x00, 0x00, 0x00, 0x18, 0xac, 0x12, 0x82, 0xd1
 
 #define CHUNK_SIZE(...) sizeof((uint8_t[]){__VA_ARGS__})
 
@@ -37,6 +37,7 @@
 #include <utest.h>
 
 #include <sqsh_archive_private.h>
+#include <sqsh_common_private.h>
 #include <sqsh_data_private.h>
 #include <sqsh_directory.h>
 #include <sqsh_directory_private.h>
@@ -397,4 +398,268 @@ UTEST(directory_iterator, iter_inode_to_zero) {
 	sqsh__archive_cleanup(&archive);
 }
 
+UTEST(directory_iterator, lookup_name_prefix_of_index) {
+	int rv;
+	struct SqshArchive archive = {0};
+	uint8_t payload[] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 1024),
+			INODE_HEADER(8, 0, 0, 0, 0, 1),
+			UINT32_BYTES(1), UINT32_BYTES(46), UINT32_BYTES(0),
+			UINT32_BYTES(0), UINT16_BYTES(1), UINT16_BYTES(0),
+			UINT32_BYTES(0xFFFFFFFF),
+			/* index: names starting at "ab" are in the second header */
+			UINT32_BYTES(21), UINT32_BYTES(0), UINT32_BYTES(1),
+			'a', 'b',
+			[DIRECTORY_TABLE_OFFSET] = METABLOCK_HEADER(0, 128),
+			DIRECTORY_HEADER(1, 0, 0),
+			DIRECTORY_ENTRY(128, 2, 2, 1),
+			'a',
+			DIRECTORY_HEADER(1, 0, 0),
+			DIRECTORY_ENTRY(256, 3, 2, 2),
+			'a', 'b',
+			[FRAGMENT_TABLE_OFFSET] = 0,
+			/* clang-format on */
+	};
+	mk_stub(&archive, payload, sizeof(payload));
+
+	struct SqshFile file = {0};
+	rv = sqsh__file_init(&file, &archive, 0);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, sqsh_file_is_extended(&file));
+
+	struct SqshDirectoryIterator iter = {0};
+	rv = sqsh__directory_iterator_init(&iter, &file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_directory_iterator_lookup(&iter, "a", 1);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)2, sqsh_directory_iterator_inode(&iter));
+
+	sqsh__directory_iterator_cleanup(&iter);
+
+	rv = sqsh__directory_iterator_init(&iter, &file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_directory_iterator_lookup(&iter, "ab", 2);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)3, sqsh_directory_iterator_inode(&iter));
+
+	sqsh__directory_iterator_cleanup(&iter);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
+static int
+init_cached_directory(
+		struct SqshArchive *archive, uint8_t *payload, size_t payload_size,
+		int cache_size) {
+	FILE *farchive = test_sqsh_prepare_archive(payload, payload_size);
+	fclose(farchive);
+
+	struct SqshConfig config = DEFAULT_CONFIG(payload_size);
+	config.directory_cache_size = cache_size;
+	config.directory_cache_min_size = 1;
+	return sqsh__archive_init(archive, payload, &config);
+}
+
+#define CACHED_DIRECTORY_PAYLOAD \
+	/* clang-format off */ \
+	SQSH_HEADER, \
+	/* inode */ \
+	[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 1024), \
+	INODE_HEADER(1, 0, 0, 0, 0, 1), \
+	INODE_BASIC_DIR(0, 54, 0, 0), \
+	[DIRECTORY_TABLE_OFFSET] = METABLOCK_HEADER(0, 128), \
+	DIRECTORY_HEADER(2, 0, 0), \
+	DIRECTORY_ENTRY(128, 2, 2, 1), \
+	'a', \
+	DIRECTORY_ENTRY(256, 3, 2, 1), \
+	'b', \
+	DIRECTORY_HEADER(1, 1, 10), \
+	DIRECTORY_ENTRY(384, 2, 2, 1), \
+	'c', \
+	[FRAGMENT_TABLE_OFFSET] = 0 \
+	/* clang-format on */
+
+UTEST(directory_iterator, lookup_with_cached_table) {
+	int rv;
+	struct SqshArchive archive = {0};
+	uint8_t payload[] = {CACHED_DIRECTORY_PAYLOAD};
+	rv = init_cached_directory(&archive, payload, sizeof(payload), 0);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFile file = {0};
+	rv = sqsh__file_init(&file, &archive, 0);
+	ASSERT_EQ(0, rv);
+
+	struct SqshDirectoryIterator iter = {0};
+	rv = sqsh__directory_iterator_init(&iter, &file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_directory_iterator_lookup(&iter, "c", 1);
+	ASSERT_EQ(0, rv);
+	ASSERT_NE(NULL, archive.directory_lookup_cache.tables[0]);
+	ASSERT_EQ((uint32_t)12, sqsh_directory_iterator_inode(&iter));
+	ASSERT_EQ(
+			sqsh_address_ref_create(1, 384),
+			sqsh_directory_iterator_inode_ref(&iter));
+	size_t name_size;
+	const char *name = sqsh_directory_iterator_name2(&iter, &name_size);
+	ASSERT_EQ((size_t)1, name_size);
+	ASSERT_EQ('c', name[0]);
+
+	sqsh__directory_iterator_cleanup(&iter);
+
+	rv = sqsh__directory_iterator_init(&iter, &file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_directory_iterator_lookup(&iter, "d", 1);
+	ASSERT_EQ(-SQSH_ERROR_NO_SUCH_FILE, rv);
+
+	rv = sqsh_directory_iterator_lookup(&iter, "b", 1);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)3, sqsh_directory_iterator_inode(&iter));
+	ASSERT_EQ(
+			sqsh_address_ref_create(0, 256),
+			sqsh_directory_iterator_inode_ref(&iter));
+
+	sqsh__directory_iterator_cleanup(&iter);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(directory_iterator, next_after_cached_lookup) {
+	int rv;
+	struct SqshArchive archive = {0};
+	uint8_t payload[] = {CACHED_DIRECTORY_PAYLOAD};
+	rv = init_cached_directory(&archive, payload, sizeof(payload), 0);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFile file = {0};
+	rv = sqsh__file_init(&file, &archive, 0);
+	ASSERT_EQ(0, rv);
+
+	struct SqshDirectoryIterator iter = {0};
+	rv = sqsh__directory_iterator_init(&iter, &file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_directory_iterator_lookup(&iter, "a", 1);
+	ASSERT_EQ(0, rv);
+
+	bool has_next = sqsh_directory_iterator_next(&iter, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, has_next);
+	ASSERT_EQ('b', sqsh_directory_iterator_name(&iter)[0]);
+	ASSERT_EQ((uint32_t)3, sqsh_directory_iterator_inode(&iter));
+
+	has_next = sqsh_directory_iterator_next(&iter, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(true, has_next);
+	ASSERT_EQ('c', sqsh_directory_iterator_name(&iter)[0]);
+	ASSERT_EQ((uint32_t)12, sqsh_directory_iterator_inode(&iter));
+
+	has_next = sqsh_directory_iterator_next(&iter, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(false, has_next);
+
+	sqsh__directory_iterator_cleanup(&iter);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(directory_iterator, cached_table_is_charged_to_budget) {
+	int rv;
+	struct SqshArchive archive = {0};
+	uint8_t payload[] = {CACHED_DIRECTORY_PAYLOAD};
+	FILE *farchive = test_sqsh_prepare_archive(payload, sizeof(payload));
+	fclose(farchive);
+
+	struct SqshConfig config = DEFAULT_CONFIG(sizeof(payload));
+	config.directory_cache_min_size = 1;
+	config.max_cache_bytes = 1 << 20;
+	rv = sqsh__archive_init(&archive, payload, &config);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFile file = {0};
+	rv = sqsh__file_init(&file, &archive, 0);
+	ASSERT_EQ(0, rv);
+
+	struct SqshDirectoryIterator iter = {0};
+	rv = sqsh__directory_iterator_init(&iter, &file);
+	ASSERT_EQ(0, rv);
+
+	const uint64_t used_bytes = archive.cache_budget.used_bytes;
+	rv = sqsh_directory_iterator_lookup(&iter, "c", 1);
+	ASSERT_EQ(0, rv);
+	const struct SqshDirectoryLookupTable *table =
+			archive.directory_lookup_cache.tables[0];
+	ASSERT_NE(NULL, table);
+	ASSERT_LE(used_bytes + table->size, archive.cache_budget.used_bytes);
+
+	sqsh__directory_iterator_cleanup(&iter);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(directory_iterator, cached_table_is_evicted_by_budget) {
+	int rv;
+	struct SqshArchive archive = {0};
+	uint8_t payload[] = {CACHED_DIRECTORY_PAYLOAD};
+	FILE *farchive = test_sqsh_prepare_archive(payload, sizeof(payload));
+	fclose(farchive);
+
+	// The budget is too small for anything, so the table is dropped as soon
+	// as it was built. Lookups still work with the table of the iterator.
+	struct SqshConfig config = DEFAULT_CONFIG(sizeof(payload));
+	config.directory_cache_min_size = 1;
+	config.max_cache_bytes = 1;
+	rv = sqsh__archive_init(&archive, payload, &config);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFile file = {0};
+	rv = sqsh__file_init(&file, &archive, 0);
+	ASSERT_EQ(0, rv);
+
+	struct SqshDirectoryIterator iter = {0};
+	rv = sqsh__directory_iterator_init(&iter, &file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_directory_iterator_lookup(&iter, "c", 1);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)12, sqsh_directory_iterator_inode(&iter));
+	ASSERT_EQ(NULL, archive.directory_lookup_cache.tables[0]);
+
+	sqsh__directory_iterator_cleanup(&iter);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(directory_iterator, lookup_with_disabled_cache) {
+	int rv;
+	struct SqshArchive archive = {0};
+	uint8_t payload[] = {CACHED_DIRECTORY_PAYLOAD};
+	rv = init_cached_directory(&archive, payload, sizeof(payload), -1);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFile file = {0};
+	rv = sqsh__file_init(&file, &archive, 0);
+	ASSERT_EQ(0, rv);
+
+	struct SqshDirectoryIterator iter = {0};
+	rv = sqsh__directory_iterator_init(&iter, &file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_directory_iterator_lookup(&iter, "c", 1);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(NULL, archive.directory_lookup_cache.tables);
+	ASSERT_EQ((uint32_t)12, sqsh_directory_iterator_inode(&iter));
+
+	sqsh__directory_iterator_cleanup(&iter);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
 UTEST_MAIN()
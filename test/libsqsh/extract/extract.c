@@ -93,6 +93,72 @@ decompress_test_split(
 	}
 }
 
+void
+decompress_test_reuse(
+		const struct SqshExtractorImpl *impl, uint8_t *input, size_t input_size,
+		int *utest_result) {
+	int rv;
+	uint8_t output[16];
+	size_t output_size = sizeof(output);
+	sqsh__extractor_context_t context = {0};
+
+	if (impl == NULL) {
+		puts("skipping test extractor compile time disabled.");
+		return;
+	}
+
+	rv = impl->init(context, output, output_size);
+	ASSERT_EQ(0, rv);
+	for (int i = 0; i < 3; i++) {
+		if (i > 0) {
+			rv = impl->reset(context, output, sizeof(output));
+			ASSERT_EQ(0, rv);
+		}
+		memset(output, 0, sizeof(output));
+		rv = impl->write(context, input, input_size);
+		ASSERT_EQ(0, rv);
+		rv = impl->finish_keep(context, output, &output_size);
+		ASSERT_EQ(0, rv);
+
+		ASSERT_EQ((size_t)4, output_size);
+		ASSERT_EQ(0, memcmp(output, "abcd", 4));
+	}
+	impl->destroy(context);
+}
+
+void
+decompress_test_once(
+		const struct SqshExtractorImpl *impl, uint8_t *input, size_t input_size,
+		int *utest_result) {
+	int rv;
+	uint8_t output[16];
+	size_t output_size;
+	sqsh__extractor_context_t context = {0};
+
+	if (impl == NULL) {
+		puts("skipping test extractor compile time disabled.");
+		return;
+	}
+
+	rv = impl->init(context, output, sizeof(output));
+	ASSERT_EQ(0, rv);
+	for (int i = 0; i < 3; i++) {
+		if (i > 0) {
+			rv = impl->reset(context, output, sizeof(output));
+			ASSERT_EQ(0, rv);
+		}
+		memset(output, 0, sizeof(output));
+		output_size = sizeof(output);
+		rv = impl->decompress_once(
+				context, input, input_size, output, &output_size);
+		ASSERT_EQ(0, rv);
+
+		ASSERT_EQ((size_t)4, output_size);
+		ASSERT_EQ(0, memcmp(output, "abcd", 4));
+	}
+	impl->destroy(context);
+}
+
 UTEST(extract, decompress_lzma) {
 	uint8_t input[] = {0x5d, 0x00, 0x00, 0x80, 0x00, 0xff, 0xff, 0xff, 0xff,
 					   0xff, 0xff, 0xff, 0xff, 0x00, 0x30, 0x98, 0x88, 0x98,
@@ -101,6 +167,24 @@ UTEST(extract, decompress_lzma) {
 	decompress_test(sqsh__impl_lzma, input, sizeof(input), utest_result);
 }
 
+UTEST(extract, decompress_lzma_reuse) {
+	uint8_t input[] = {0x5d, 0x00, 0x00, 0x80, 0x00, 0xff, 0xff, 0xff, 0xff,
+					   0xff, 0xff, 0xff, 0xff, 0x00, 0x30, 0x98, 0x88, 0x98,
+					   0x46, 0x7e, 0x1e, 0xb2, 0xff, 0xfa, 0x1c, 0x80, 0x00};
+
+	decompress_test_reuse(
+			sqsh__impl_lzma, input, sizeof(input), utest_result);
+}
+
+UTEST(extract, decompress_lzma_once) {
+	uint8_t input[] = {0x5d, 0x00, 0x00, 0x80, 0x00, 0xff, 0xff, 0xff, 0xff,
+					   0xff, 0xff, 0xff, 0xff, 0x00, 0x30, 0x98, 0x88, 0x98,
+					   0x46, 0x7e, 0x1e, 0xb2, 0xff, 0xfa, 0x1c, 0x80, 0x00};
+
+	decompress_test_once(
+			sqsh__impl_lzma, input, sizeof(input), utest_result);
+}
+
 UTEST(extract, decompress_lzma_split) {
 	uint8_t input[] = {0x5d, 0x00, 0x00, 0x80, 0x00, 0xff, 0xff, 0xff, 0xff,
 					   0xff, 0xff, 0xff, 0xff, 0x00, 0x30, 0x98, 0x88, 0x98,
@@ -122,6 +206,32 @@ UTEST(extract, decompress_xz) {
 	decompress_test(sqsh__impl_xz, input, sizeof(input), utest_result);
 }
 
+UTEST(extract, decompress_xz_reuse) {
+	uint8_t input[] = {0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x04, 0xe6,
+					   0xd6, 0xb4, 0x46, 0x02, 0x00, 0x21, 0x01, 0x16, 0x00,
+					   0x00, 0x00, 0x74, 0x2f, 0xe5, 0xa3, 0x01, 0x00, 0x03,
+					   0x61, 0x62, 0x63, 0x64, 0x00, 0xba, 0x60, 0x59, 0x6e,
+					   0x59, 0x28, 0x9d, 0x3c, 0x00, 0x01, 0x1c, 0x04, 0x6f,
+					   0x2c, 0x9c, 0xc1, 0x1f, 0xb6, 0xf3, 0x7d, 0x01, 0x00,
+					   0x00, 0x00, 0x00, 0x04, 0x59, 0x5a};
+
+	decompress_test_reuse(
+			sqsh__impl_xz, input, sizeof(input), utest_result);
+}
+
+UTEST(extract, decompress_xz_once) {
+	uint8_t input[] = {0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x04, 0xe6,
+					   0xd6, 0xb4, 0x46, 0x02, 0x00, 0x21, 0x01, 0x16, 0x00,
+					   0x00, 0x00, 0x74, 0x2f, 0xe5, 0xa3, 0x01, 0x00, 0x03,
+					   0x61, 0x62, 0x63, 0x64, 0x00, 0xba, 0x60, 0x59, 0x6e,
+					   0x59, 0x28, 0x9d, 0x3c, 0x00, 0x01, 0x1c, 0x04, 0x6f,
+					   0x2c, 0x9c, 0xc1, 0x1f, 0xb6, 0xf3, 0x7d, 0x01, 0x00,
+					   0x00, 0x00, 0x00, 0x04, 0x59, 0x5a};
+
+	decompress_test_once(
+			sqsh__impl_xz, input, sizeof(input), utest_result);
+}
+
 UTEST(extract, decompress_xz_split) {
 	uint8_t input[] = {0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x04, 0xe6,
 					   0xd6, 0xb4, 0x46, 0x02, 0x00, 0x21, 0x01, 0x16, 0x00,
@@ -140,6 +250,20 @@ UTEST(extract, decompress_lz4) {
 	decompress_test(sqsh__impl_lz4, input, sizeof(input), utest_result);
 }
 
+UTEST(extract, decompress_lz4_reuse) {
+	uint8_t input[] = {0x40, 0x61, 0x62, 0x63, 0x64};
+
+	decompress_test_reuse(
+			sqsh__impl_lz4, input, sizeof(input), utest_result);
+}
+
+UTEST(extract, decompress_lz4_once) {
+	uint8_t input[] = {0x40, 0x61, 0x62, 0x63, 0x64};
+
+	decompress_test_once(
+			sqsh__impl_lz4, input, sizeof(input), utest_result);
+}
+
 UTEST(extract, decompress_lz4_split) {
 	uint8_t input[] = {0x40, 0x61, 0x62, 0x63, 0x64};
 	UTEST_SKIP("lz4 split not supported yet");
@@ -155,6 +279,24 @@ UTEST(extract, decompress_zlib) {
 	decompress_test(sqsh__impl_zlib, input, sizeof(input), utest_result);
 }
 
+UTEST(extract, decompress_zlib_reuse) {
+	uint8_t input[] = {
+			ZLIB_ABCD,
+	};
+
+	decompress_test_reuse(
+			sqsh__impl_zlib, input, sizeof(input), utest_result);
+}
+
+UTEST(extract, decompress_zlib_once) {
+	uint8_t input[] = {
+			ZLIB_ABCD,
+	};
+
+	decompress_test_once(
+			sqsh__impl_zlib, input, sizeof(input), utest_result);
+}
+
 UTEST(extract, decompress_zlib_split) {
 	uint8_t input[] = {
 			ZLIB_ABCD,
@@ -170,6 +312,22 @@ UTEST(extract, decompress_zstd) {
 	decompress_test(sqsh__impl_zstd, input, sizeof(input), utest_result);
 }
 
+UTEST(extract, decompress_zstd_reuse) {
+	uint8_t input[] = {0x28, 0xb5, 0x2f, 0xfd, 0x20, 0x04, 0x21,
+					   0x00, 0x00, 0x61, 0x62, 0x63, 0x64};
+
+	decompress_test_reuse(
+			sqsh__impl_zstd, input, sizeof(input), utest_result);
+}
+
+UTEST(extract, decompress_zstd_once) {
+	uint8_t input[] = {0x28, 0xb5, 0x2f, 0xfd, 0x20, 0x04, 0x21,
+					   0x00, 0x00, 0x61, 0x62, 0x63, 0x64};
+
+	decompress_test_once(
+			sqsh__impl_zstd, input, sizeof(input), utest_result);
+}
+
 UTEST(extract, decompress_zstd_split) {
 	uint8_t input[] = {0x28, 0xb5, 0x2f, 0xfd, 0x20, 0x04, 0x21,
 					   0x00, 0x00, 0x61, 0x62, 0x63, 0x64};
@@ -40,6 +40,8 @@
 #include <sqsh_extract_private.h>
 #include <sqsh_mapper_private.h>
 
+#include <pthread.h>
+
 UTEST(directory_iterator, decompress) {
 	int rv;
 	struct SqshArchive archive = {0};
@@ -114,4 +116,69 @@ UTEST(directory_iterator, decompress_and_cached) {
 	sqsh__archive_cleanup(&archive);
 }
 
+struct ConcurrentDecompress {
+	struct SqshExtractManager *manager;
+	struct SqshMapReader *reader;
+	struct CxBuffer *buffer;
+	int rv;
+};
+
+static void *
+concurrent_decompress(void *data) {
+	struct ConcurrentDecompress *ctx = data;
+	ctx->rv = sqsh__extract_manager_uncompress(
+			ctx->manager, ctx->reader, &ctx->buffer);
+	return NULL;
+}
+
+UTEST(directory_iterator, decompress_concurrently) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshExtractManager manager = {0};
+	pthread_t threads[16] = {0};
+	struct SqshMapReader readers[16] = {0};
+	struct ConcurrentDecompress ctx[16] = {0};
+	uint8_t payload[8192] = {SQSH_HEADER, ZLIB_ABCD};
+
+	mk_stub(&archive, payload, sizeof(payload));
+
+	struct SqshMapManager *map_manager = sqsh_archive_map_manager(&archive);
+
+	rv = sqsh__extract_manager_init(&manager, &archive, 8192, 128);
+	ASSERT_EQ(0, rv);
+
+	for (size_t i = 0; i < LENGTH(threads); i++) {
+		rv = sqsh__map_reader_init(
+				&readers[i], map_manager, sizeof(struct SqshDataSuperblock),
+				sizeof(payload));
+		ASSERT_EQ(0, rv);
+		rv = sqsh__map_reader_advance(&readers[i], 0, CHUNK_SIZE(ZLIB_ABCD));
+		ASSERT_EQ(0, rv);
+
+		ctx[i].manager = &manager;
+		ctx[i].reader = &readers[i];
+		rv = pthread_create(&threads[i], NULL, concurrent_decompress, &ctx[i]);
+		ASSERT_EQ(0, rv);
+	}
+
+	for (size_t i = 0; i < LENGTH(threads); i++) {
+		pthread_join(threads[i], NULL);
+		ASSERT_EQ(0, ctx[i].rv);
+		ASSERT_EQ(ctx[0].buffer, ctx[i].buffer);
+		sqsh__map_reader_cleanup(&readers[i]);
+	}
+	ASSERT_EQ((size_t)4, cx_buffer_size(ctx[0].buffer));
+	ASSERT_EQ(0, memcmp(cx_buffer_data(ctx[0].buffer), "abcd", 4));
+	for (size_t i = 0; i < manager.shard_count; i++) {
+		ASSERT_EQ(NULL, manager.shards[i].inflight);
+	}
+
+	for (size_t i = 0; i < LENGTH(threads); i++) {
+		sqsh__extract_manager_release(
+				&manager, sizeof(struct SqshDataSuperblock));
+	}
+	sqsh__extract_manager_cleanup(&manager);
+	sqsh__archive_cleanup(&archive);
+}
+
 UTEST_MAIN()
@@ -75,6 +75,44 @@ UTEST(file, load_file) {
 	sqsh__archive_cleanup(&archive);
 }
 
+UTEST(file, block_address) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	uint64_t address;
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128),
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, 32768 * 2 + 4),
+			DATA_BLOCK_REF(100, 0),
+			DATA_BLOCK_REF(32768, 0),
+			DATA_BLOCK_REF(4, 1),
+			/* clang-format on */
+	};
+	mk_stub(&archive, payload, sizeof(payload));
+
+	rv = sqsh__file_init(&file, &archive, sqsh_address_ref_create(0, 0));
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_file_block_address(&file, 0, &address);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)1024, address);
+	rv = sqsh_file_block_address(&file, 1, &address);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)1124, address);
+	rv = sqsh_file_block_address(&file, 2, &address);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)1124 + 32768, address);
+	rv = sqsh_file_block_address(&file, 3, &address);
+	ASSERT_EQ(-SQSH_ERROR_OUT_OF_BOUNDS, rv);
+
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
 UTEST(file, resolve_file) {
 	int rv = 0;
 	struct SqshArchive archive = {0};
@@ -162,4 +200,140 @@ UTEST(file, resolve_unkown_dir_inode) {
 	sqsh__archive_cleanup(&archive);
 }
 
+#define FILE_STAT_PAYLOAD \
+	/* clang-format off */ \
+	SQSH_HEADER, \
+	/* inode */ \
+	[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128), \
+	INODE_HEADER(2, 0644, 0, 0, 4242, 1), \
+	INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, 8), \
+	DATA_BLOCK_REF(8, 0), \
+	[INODE_TABLE_OFFSET+2+64] = \
+	INODE_HEADER(2, 0600, 0, 0, 4343, 2), \
+	INODE_BASIC_FILE(2048, 0xFFFFFFFF, 0, 16), \
+	DATA_BLOCK_REF(16, 0), \
+	[FRAGMENT_TABLE_OFFSET] = 0 \
+	/* clang-format on */
+
+static int
+init_archive(
+		struct SqshArchive *archive, uint8_t *payload, size_t payload_size,
+		int file_stat_cache_size) {
+	FILE *farchive = test_sqsh_prepare_archive(payload, payload_size);
+	fclose(farchive);
+
+	struct SqshConfig config = DEFAULT_CONFIG(payload_size);
+	config.file_stat_cache_size = file_stat_cache_size;
+	return sqsh__archive_init(archive, payload, &config);
+}
+
+static bool
+is_stat_cached(struct SqshArchive *archive, uint64_t inode_ref) {
+	struct SqshFileStat stat;
+	return sqsh__file_stat_cache_get(
+			sqsh__archive_file_stat_cache(archive), inode_ref, &stat);
+}
+
+UTEST(file, stat_file) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	struct SqshFileStat stat;
+	uint8_t payload[] = {FILE_STAT_PAYLOAD};
+	rv = init_archive(&archive, payload, sizeof(payload), 0);
+	ASSERT_EQ(0, rv);
+
+	const uint64_t inode_ref = sqsh_address_ref_create(0, 0);
+	rv = sqsh_file_stat(&archive, inode_ref, &stat);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(inode_ref, stat.inode_ref);
+	ASSERT_EQ(SQSH_FILE_TYPE_FILE, (int)stat.type);
+	ASSERT_EQ(0644, stat.permission);
+	ASSERT_EQ((uint32_t)1, stat.inode_number);
+	ASSERT_EQ((uint32_t)4242, stat.modified_time);
+	ASSERT_EQ((uint64_t)8, stat.size);
+	ASSERT_EQ((uint64_t)1024, stat.blocks_start);
+	ASSERT_EQ((uint32_t)SQSH_INODE_NO_FRAGMENT, stat.fragment_block_index);
+
+	rv = sqsh__file_init(&file, &archive, inode_ref);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(sqsh_file_hard_link_count(&file), stat.hard_link_count);
+	ASSERT_EQ(sqsh_file_uid(&file), stat.uid);
+	ASSERT_EQ(sqsh_file_gid(&file), stat.gid);
+	ASSERT_EQ(sqsh_file_xattr_index(&file), stat.xattr_index);
+	sqsh__file_cleanup(&file);
+
+	ASSERT_TRUE(is_stat_cached(&archive, inode_ref));
+
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(file, stat_uses_cache) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFileStat stat;
+	uint8_t payload[] = {FILE_STAT_PAYLOAD};
+	rv = init_archive(&archive, payload, sizeof(payload), 0);
+	ASSERT_EQ(0, rv);
+
+	const uint64_t inode_ref = sqsh_address_ref_create(0, 0);
+	rv = sqsh_file_stat(&archive, inode_ref, &stat);
+	ASSERT_EQ(0, rv);
+
+	// Replace the cached attributes to see that the inode is not read
+	// again.
+	stat.modified_time = 1;
+	rv = sqsh__file_stat_cache_put(
+			sqsh__archive_file_stat_cache(&archive), &stat);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_file_stat(&archive, inode_ref, &stat);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)1, stat.modified_time);
+
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(file, stat_cache_is_bounded) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFileStat stat;
+	uint8_t payload[] = {FILE_STAT_PAYLOAD};
+	rv = init_archive(&archive, payload, sizeof(payload), 1);
+	ASSERT_EQ(0, rv);
+
+	const uint64_t first_ref = sqsh_address_ref_create(0, 0);
+	const uint64_t second_ref = sqsh_address_ref_create(0, 64);
+	rv = sqsh_file_stat(&archive, first_ref, &stat);
+	ASSERT_EQ(0, rv);
+	ASSERT_TRUE(is_stat_cached(&archive, first_ref));
+
+	rv = sqsh_file_stat(&archive, second_ref, &stat);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)2, stat.inode_number);
+	ASSERT_EQ(0600, stat.permission);
+	ASSERT_EQ((uint64_t)2048, stat.blocks_start);
+	ASSERT_TRUE(is_stat_cached(&archive, second_ref));
+	ASSERT_FALSE(is_stat_cached(&archive, first_ref));
+
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(file, stat_cache_disabled) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFileStat stat;
+	uint8_t payload[] = {FILE_STAT_PAYLOAD};
+	rv = init_archive(&archive, payload, sizeof(payload), -1);
+	ASSERT_EQ(0, rv);
+
+	const uint64_t inode_ref = sqsh_address_ref_create(0, 0);
+	rv = sqsh_file_stat(&archive, inode_ref, &stat);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)1, stat.inode_number);
+	ASSERT_FALSE(is_stat_cached(&archive, inode_ref));
+
+	sqsh__archive_cleanup(&archive);
+}
+
 UTEST_MAIN()
@@ -39,6 +39,8 @@
 #include <sqsh_common_private.h>
 #include <sqsh_data_private.h>
 
+#include <cextras/concurrency.h>
+
 static const size_t BLOCK_SIZE = 32768;
 #define ZERO_BLOCK_SIZE (size_t)16384
 uint8_t ZERO_BLOCK[ZERO_BLOCK_SIZE] = {0};
@@ -549,6 +551,126 @@ UTEST(file_iterator, load_two_sparse_blocks) {
 	sqsh__archive_cleanup(&archive);
 }
 
+UTEST(file_iterator, load_blocks_with_readahead) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	struct CxThreadpool threadpool = {0};
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* datablocks */
+			[1024] = ZLIB_32K_A, ZLIB_32K_A, ZLIB_ABCD,
+			/* inode */
+			[INODE_TABLE_OFFSET + 256] = METABLOCK_HEADER(0, 128), 0, 0, 0,
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, BLOCK_SIZE * 2 + 4),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_32K_A), 1),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_32K_A), 1),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_ABCD), 1),
+			/* clang-format on */
+	};
+	mk_stub(&archive, payload, sizeof(payload));
+
+	rv = cx_threadpool_init(&threadpool, 2);
+	ASSERT_EQ(0, rv);
+
+	uint64_t inode_ref = sqsh_address_ref_create(256, 3);
+	rv = sqsh__file_init(&file, &archive, inode_ref);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFileIterator iter = {0};
+	rv = sqsh__file_iterator_init(&iter, &file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__file_iterator_readahead(&iter, &threadpool, 4);
+	ASSERT_EQ(0, rv);
+
+	for (int i = 0; i < 2; i++) {
+		bool has_next = sqsh_file_iterator_next(&iter, 1, &rv);
+		ASSERT_LT(0, rv);
+		ASSERT_EQ(true, has_next);
+		ASSERT_EQ(BLOCK_SIZE, sqsh_file_iterator_size(&iter));
+		const uint8_t *data = sqsh_file_iterator_data(&iter);
+		ASSERT_EQ('a', data[0]);
+		ASSERT_EQ('a', data[BLOCK_SIZE - 1]);
+	}
+
+	bool has_next = sqsh_file_iterator_next(&iter, 1, &rv);
+	ASSERT_LT(0, rv);
+	ASSERT_EQ(true, has_next);
+	ASSERT_EQ((size_t)4, sqsh_file_iterator_size(&iter));
+	ASSERT_EQ(0, memcmp(sqsh_file_iterator_data(&iter), "abcd", 4));
+
+	has_next = sqsh_file_iterator_next(&iter, 1, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(false, has_next);
+
+	// Loading the first block schedules the two blocks behind it.
+	ASSERT_EQ((size_t)2, iter.readahead->scheduled_count);
+
+	sqsh__file_iterator_cleanup(&iter);
+	sqsh__file_cleanup(&file);
+	cx_threadpool_cleanup(&threadpool);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(file_iterator, readahead_over_sparse_block) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	struct CxThreadpool threadpool = {0};
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* datablocks */
+			[1024] = ZLIB_32K_A, ZLIB_32K_A, ZLIB_ABCD,
+			/* inode */
+			[INODE_TABLE_OFFSET + 256] = METABLOCK_HEADER(0, 128), 0, 0, 0,
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, BLOCK_SIZE * 3 + 4),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_32K_A), 1),
+			DATA_BLOCK_REF(0, 0),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_32K_A), 1),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_ABCD), 1),
+			/* clang-format on */
+	};
+	mk_stub(&archive, payload, sizeof(payload));
+
+	rv = cx_threadpool_init(&threadpool, 2);
+	ASSERT_EQ(0, rv);
+
+	uint64_t inode_ref = sqsh_address_ref_create(256, 3);
+	rv = sqsh__file_init(&file, &archive, inode_ref);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFileIterator iter = {0};
+	rv = sqsh__file_iterator_init(&iter, &file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__file_iterator_readahead(&iter, &threadpool, 4);
+	ASSERT_EQ(0, rv);
+
+	size_t total = 0;
+	bool has_next;
+	while ((has_next = sqsh_file_iterator_next(&iter, 1, &rv))) {
+		total += sqsh_file_iterator_size(&iter);
+	}
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((size_t)BLOCK_SIZE * 3 + 4, total);
+
+	// The sparse block is returned in more than one chunk. Only its first
+	// chunk moves the readahead window, so the two compressed blocks behind
+	// it are scheduled once.
+	ASSERT_GT(BLOCK_SIZE, ZERO_BLOCK_SIZE);
+	ASSERT_EQ((size_t)2, iter.readahead->scheduled_count);
+
+	sqsh__file_iterator_cleanup(&iter);
+	sqsh__file_cleanup(&file);
+	cx_threadpool_cleanup(&threadpool);
+	sqsh__archive_cleanup(&archive);
+}
+
 UTEST(file_iterator, open_directory_with_file_iterator) {
 	int rv;
 	struct SqshArchive archive = {0};
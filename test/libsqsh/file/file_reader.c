@@ -216,4 +216,47 @@ UTEST(file_reader, skip_over_zero_page) {
 	sqsh__archive_cleanup(&archive);
 }
 
+UTEST(file_reader, skip_from_mapped_block_to_next_block) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* datablock */
+			[1024] = ZLIB_32K_A,
+			ZLIB_ABCD,
+			/* inode */
+			[INODE_TABLE_OFFSET + 256] = METABLOCK_HEADER(0, 128),
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, 32768 + 4),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_32K_A), 1),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_ABCD), 1),
+			/* clang-format on */
+	};
+	mk_stub(&archive, payload, sizeof(payload));
+
+	uint64_t inode_ref = sqsh_address_ref_create(256, 0);
+	rv = sqsh__file_init(&file, &archive, inode_ref);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFileReader reader = {0};
+	rv = sqsh__file_reader_init(&reader, &file);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_file_reader_advance2(&reader, 32766, 2);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((size_t)2, sqsh_file_reader_size(&reader));
+	ASSERT_EQ(0, memcmp(sqsh_file_reader_data(&reader), "aa", 2));
+
+	rv = sqsh_file_reader_advance2(&reader, 2, 4);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((size_t)4, sqsh_file_reader_size(&reader));
+	ASSERT_EQ(0, memcmp(sqsh_file_reader_data(&reader), "abcd", 4));
+
+	sqsh__file_reader_cleanup(&reader);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
 UTEST_MAIN()
@@ -0,0 +1,548 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2023, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         curl_mapper.c
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "../common.h"
+#include <utest.h>
+
+#include <sqsh_mapper_private.h>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A minimal HTTP/1.1 server that answers range requests for a static
+ * buffer. It stands in for a remote archive. */
+struct HttpStandIn {
+	int listen_fd;
+	uint16_t port;
+	const uint8_t *data;
+	size_t size;
+	unsigned int delay_ms;
+	pthread_t thread;
+	int in_flight;
+	int max_in_flight;
+	int requests;
+	uint64_t bytes;
+};
+
+struct HttpConnection {
+	struct HttpStandIn *server;
+	int fd;
+};
+
+static int
+send_all(int fd, const void *data, size_t size) {
+	const uint8_t *p = data;
+	while (size > 0) {
+		ssize_t rv = send(fd, p, size, MSG_NOSIGNAL);
+		if (rv <= 0) {
+			return -1;
+		}
+		p += rv;
+		size -= (size_t)rv;
+	}
+	return 0;
+}
+
+static int
+serve_request(struct HttpStandIn *server, int fd, const char *request) {
+	char header[512];
+	uint64_t start = 0, end = 0;
+	const char *range = strstr(request, "Range: bytes=");
+	if (range == NULL ||
+		sscanf(range, "Range: bytes=%" SCNu64 "-%" SCNu64, &start, &end) !=
+				2 ||
+		start >= server->size || end < start) {
+		const char response[] =
+				"HTTP/1.1 416 Range Not Satisfiable\r\n"
+				"Content-Length: 0\r\n\r\n";
+		return send_all(fd, response, sizeof(response) - 1);
+	}
+	if (end >= server->size) {
+		end = server->size - 1;
+	}
+
+	const int in_flight =
+			__atomic_add_fetch(&server->in_flight, 1, __ATOMIC_SEQ_CST);
+	int max = __atomic_load_n(&server->max_in_flight, __ATOMIC_SEQ_CST);
+	while (in_flight > max &&
+		   !__atomic_compare_exchange_n(
+				   &server->max_in_flight, &max, in_flight, false,
+				   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+	}
+	__atomic_add_fetch(&server->requests, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&server->bytes, end - start + 1, __ATOMIC_SEQ_CST);
+	struct timespec delay = {
+			.tv_sec = server->delay_ms / 1000,
+			.tv_nsec = (long)(server->delay_ms % 1000) * 1000000,
+	};
+	nanosleep(&delay, NULL);
+	__atomic_sub_fetch(&server->in_flight, 1, __ATOMIC_SEQ_CST);
+
+	const int header_size = snprintf(
+			header, sizeof(header),
+			"HTTP/1.1 206 Partial Content\r\n"
+			"Content-Length: %" PRIu64 "\r\n"
+			"Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%zu\r\n"
+			"Last-Modified: Wed, 21 Oct 2015 07:28:00 GMT\r\n"
+			"\r\n",
+			end - start + 1, start, end, server->size);
+	if (send_all(fd, header, (size_t)header_size) < 0) {
+		return -1;
+	}
+	return send_all(fd, &server->data[start], (size_t)(end - start + 1));
+}
+
+static void *
+serve_connection(void *arg) {
+	struct HttpConnection *connection = arg;
+	char request[4096];
+	size_t used = 0;
+
+	for (;;) {
+		char *header_end = NULL;
+		while ((header_end = strstr(request, "\r\n\r\n")) == NULL) {
+			ssize_t rv = recv(
+					connection->fd, &request[used],
+					sizeof(request) - used - 1, 0);
+			if (rv <= 0) {
+				goto out;
+			}
+			used += (size_t)rv;
+			request[used] = '\0';
+		}
+		if (serve_request(connection->server, connection->fd, request) < 0) {
+			goto out;
+		}
+		const size_t request_size = (size_t)(header_end + 4 - request);
+		memmove(request, &request[request_size], used - request_size + 1);
+		used -= request_size;
+	}
+
+out:
+	close(connection->fd);
+	free(connection);
+	return NULL;
+}
+
+static void *
+serve(void *arg) {
+	struct HttpStandIn *server = arg;
+	for (;;) {
+		int fd = accept(server->listen_fd, NULL, NULL);
+		if (fd < 0) {
+			break;
+		}
+		struct HttpConnection *connection = calloc(1, sizeof(*connection));
+		connection->server = server;
+		connection->fd = fd;
+		pthread_t thread;
+		pthread_create(&thread, NULL, serve_connection, connection);
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+static int
+http_stand_in_start(
+		struct HttpStandIn *server, const uint8_t *data, size_t size,
+		unsigned int delay_ms) {
+	struct sockaddr_in addr = {
+			.sin_family = AF_INET,
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t addr_size = sizeof(addr);
+
+	memset(server, 0, sizeof(*server));
+	server->data = data;
+	server->size = size;
+	server->delay_ms = delay_ms;
+	server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (server->listen_fd < 0 ||
+		bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(server->listen_fd, 16) < 0 ||
+		getsockname(
+				server->listen_fd, (struct sockaddr *)&addr, &addr_size) < 0) {
+		return -1;
+	}
+	server->port = ntohs(addr.sin_port);
+	return pthread_create(&server->thread, NULL, serve, server);
+}
+
+static void
+http_stand_in_stop(struct HttpStandIn *server) {
+	shutdown(server->listen_fd, SHUT_RDWR);
+	close(server->listen_fd);
+	pthread_join(server->thread, NULL);
+}
+
+static void
+fill_payload(uint8_t *payload, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		payload[i] = (uint8_t)(i * 7);
+	}
+}
+
+UTEST(curl_mapper, read_blocks) {
+	int rv;
+	struct HttpStandIn server;
+	struct SqshMapManager mapper = {0};
+	struct SqshMapReader cursor = {0};
+	uint8_t payload[256];
+	char url[64];
+	fill_payload(payload, sizeof(payload));
+
+	rv = http_stand_in_start(&server, payload, sizeof(payload), 0);
+	ASSERT_EQ(0, rv);
+	snprintf(url, sizeof(url), "http://127.0.0.1:%u/image", server.port);
+
+	rv = sqsh__map_manager_init(
+			&mapper, url,
+			&(struct SqshConfig){
+					.source_mapper = sqsh_mapper_impl_curl,
+					.mapper_block_size = 16});
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)sizeof(payload), sqsh__map_manager_size(&mapper));
+
+	rv = sqsh__map_reader_init(&cursor, &mapper, 0, sizeof(payload));
+	ASSERT_EQ(0, rv);
+	rv = sqsh__map_reader_advance(&cursor, 10, 200);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(0, memcmp(sqsh__map_reader_data(&cursor), &payload[10], 200));
+
+	sqsh__map_reader_cleanup(&cursor);
+	sqsh__map_manager_cleanup(&mapper);
+	http_stand_in_stop(&server);
+}
+
+UTEST(curl_mapper, sequential_reads_are_coalesced) {
+	int rv;
+	struct HttpStandIn server;
+	struct SqshMapManager mapper = {0};
+	struct SqshMapReader cursor = {0};
+	uint8_t payload[256];
+	char url[64];
+	fill_payload(payload, sizeof(payload));
+
+	rv = http_stand_in_start(&server, payload, sizeof(payload), 0);
+	ASSERT_EQ(0, rv);
+	snprintf(url, sizeof(url), "http://127.0.0.1:%u/image", server.port);
+
+	rv = sqsh__map_manager_init(
+			&mapper, url,
+			&(struct SqshConfig){
+					.source_mapper = sqsh_mapper_impl_curl,
+					.mapper_block_size = 16});
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__map_reader_init(&cursor, &mapper, 0, sizeof(payload));
+	ASSERT_EQ(0, rv);
+	for (size_t offset = 0; offset < sizeof(payload); offset += 16) {
+		rv = sqsh__map_reader_advance(&cursor, offset == 0 ? 0 : 16, 16);
+		ASSERT_EQ(0, rv);
+		ASSERT_EQ(
+				0, memcmp(sqsh__map_reader_data(&cursor), &payload[offset],
+						  16));
+	}
+	// 16 blocks are fetched with requests of 1, 2, 4, 8 and 1 blocks.
+	ASSERT_EQ(5, __atomic_load_n(&server.requests, __ATOMIC_SEQ_CST));
+
+	sqsh__map_reader_cleanup(&cursor);
+	sqsh__map_manager_cleanup(&mapper);
+	http_stand_in_stop(&server);
+}
+
+static int
+read_all_blocks(
+		const char *url, const char *cache_dir, uint64_t max_bytes,
+		const uint8_t *payload, size_t size) {
+	int rv;
+	struct SqshMapManager mapper = {0};
+	struct SqshMapReader cursor = {0};
+
+	rv = sqsh__map_manager_init(
+			&mapper, url,
+			&(struct SqshConfig){
+					.source_mapper = sqsh_mapper_impl_curl,
+					.mapper_block_size = 16,
+					.curl_cache_dir = cache_dir,
+					.curl_cache_max_bytes = max_bytes});
+	if (rv < 0) {
+		return rv;
+	}
+	rv = sqsh__map_reader_init(&cursor, &mapper, 0, size);
+	if (rv == 0) {
+		rv = sqsh__map_reader_advance(&cursor, 0, size);
+	}
+	if (rv == 0 && memcmp(sqsh__map_reader_data(&cursor), payload, size)) {
+		rv = -1;
+	}
+	sqsh__map_reader_cleanup(&cursor);
+	sqsh__map_manager_cleanup(&mapper);
+	return rv;
+}
+
+static uint64_t
+remove_cache_dir(const char *path) {
+	uint64_t total = 0;
+	struct dirent *entry;
+	DIR *dir = opendir(path);
+	while (dir != NULL && (entry = readdir(dir)) != NULL) {
+		struct stat st;
+		if (strcmp(entry->d_name, ".") == 0 ||
+			strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+		if (fstatat(dirfd(dir), entry->d_name, &st, 0) == 0) {
+			total += (uint64_t)st.st_size;
+		}
+		unlinkat(dirfd(dir), entry->d_name, 0);
+	}
+	if (dir != NULL) {
+		closedir(dir);
+	}
+	rmdir(path);
+	return total;
+}
+
+UTEST(curl_mapper, disk_cache_is_reused) {
+	int rv;
+	struct HttpStandIn server;
+	uint8_t payload[256];
+	char url[64];
+	char cache_dir[] = "/tmp/libsqsh-curl-cache-XXXXXX";
+	fill_payload(payload, sizeof(payload));
+	ASSERT_NE(NULL, mkdtemp(cache_dir));
+
+	rv = http_stand_in_start(&server, payload, sizeof(payload), 0);
+	ASSERT_EQ(0, rv);
+	snprintf(url, sizeof(url), "http://127.0.0.1:%u/image", server.port);
+
+	rv = read_all_blocks(url, cache_dir, 0, payload, sizeof(payload));
+	ASSERT_EQ(0, rv);
+	const int cold_requests =
+			__atomic_load_n(&server.requests, __ATOMIC_SEQ_CST);
+
+	rv = read_all_blocks(url, cache_dir, 0, payload, sizeof(payload));
+	ASSERT_EQ(0, rv);
+	// Only the first block is requested again to check the file time.
+	ASSERT_EQ(
+			cold_requests + 1,
+			__atomic_load_n(&server.requests, __ATOMIC_SEQ_CST));
+
+	remove_cache_dir(cache_dir);
+	http_stand_in_stop(&server);
+}
+
+UTEST(curl_mapper, disk_cache_keeps_reads_sequential) {
+	int rv;
+	struct HttpStandIn server;
+	struct SqshCurlCache cache = {0};
+	uint8_t payload[256];
+	char url[64];
+	char cache_dir[] = "/tmp/libsqsh-curl-cache-XXXXXX";
+	// The Last-Modified header sent by the stand-in.
+	const uint64_t file_time = 1445412480;
+	fill_payload(payload, sizeof(payload));
+	ASSERT_NE(NULL, mkdtemp(cache_dir));
+
+	rv = http_stand_in_start(&server, payload, sizeof(payload), 0);
+	ASSERT_EQ(0, rv);
+	snprintf(url, sizeof(url), "http://127.0.0.1:%u/image", server.port);
+
+	// Blocks 1 to 3 and 8 to 11 are already on disk.
+	rv = sqsh__curl_cache_init(&cache, cache_dir, 4096, url, file_time);
+	ASSERT_EQ(0, rv);
+	for (size_t block = 1; block < 12; block++) {
+		if (block < 4 || block >= 8) {
+			sqsh__curl_cache_put(&cache, block * 16, &payload[block * 16], 16);
+		}
+	}
+	sqsh__curl_cache_cleanup(&cache);
+
+	rv = read_all_blocks(url, cache_dir, 0, payload, sizeof(payload));
+	ASSERT_EQ(0, rv);
+	// Reading the cached blocks keeps the read sequential, so the missing
+	// blocks are fetched with requests of 1, 2, 2 and 4 blocks. Requests
+	// stop at the first block that is already on disk.
+	ASSERT_EQ(4, __atomic_load_n(&server.requests, __ATOMIC_SEQ_CST));
+	ASSERT_EQ(
+			(uint64_t)9 * 16, __atomic_load_n(&server.bytes, __ATOMIC_SEQ_CST));
+
+	remove_cache_dir(cache_dir);
+	http_stand_in_stop(&server);
+}
+
+UTEST(curl_mapper, disk_cache_is_limited) {
+	int rv;
+	struct HttpStandIn server;
+	uint8_t payload[256];
+	char url[64];
+	char cache_dir[] = "/tmp/libsqsh-curl-cache-XXXXXX";
+	const uint64_t max_bytes = 512;
+	fill_payload(payload, sizeof(payload));
+	ASSERT_NE(NULL, mkdtemp(cache_dir));
+
+	rv = http_stand_in_start(&server, payload, sizeof(payload), 0);
+	ASSERT_EQ(0, rv);
+	snprintf(url, sizeof(url), "http://127.0.0.1:%u/image", server.port);
+
+	rv = read_all_blocks(url, cache_dir, max_bytes, payload, sizeof(payload));
+	ASSERT_EQ(0, rv);
+
+	ASSERT_LE(remove_cache_dir(cache_dir), max_bytes);
+	http_stand_in_stop(&server);
+}
+
+static int
+create_file(const char *dir, const char *name, time_t mtime) {
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		return -1;
+	}
+	fclose(file);
+	const struct timespec times[2] = {
+			{.tv_sec = mtime, .tv_nsec = 0},
+			{.tv_sec = mtime, .tv_nsec = 0},
+	};
+	return utimensat(AT_FDCWD, path, times, 0);
+}
+
+static bool
+file_exists(const char *dir, const char *name) {
+	char path[PATH_MAX];
+	struct stat st;
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	return stat(path, &st) == 0;
+}
+
+UTEST(curl_mapper, disk_cache_removes_stale_temporary_files) {
+	int rv;
+	struct HttpStandIn server;
+	uint8_t payload[256];
+	char url[64];
+	char cache_dir[] = "/tmp/libsqsh-curl-cache-XXXXXX";
+	fill_payload(payload, sizeof(payload));
+	ASSERT_NE(NULL, mkdtemp(cache_dir));
+
+	// Left behind by a process that died while writing a block.
+	rv = create_file(cache_dir, ".tmp-stale", time(NULL) - 2 * 60 * 60);
+	ASSERT_EQ(0, rv);
+	// Possibly still written to by another process.
+	rv = create_file(cache_dir, ".tmp-fresh", time(NULL));
+	ASSERT_EQ(0, rv);
+
+	rv = http_stand_in_start(&server, payload, sizeof(payload), 0);
+	ASSERT_EQ(0, rv);
+	snprintf(url, sizeof(url), "http://127.0.0.1:%u/image", server.port);
+
+	rv = read_all_blocks(url, cache_dir, 0, payload, sizeof(payload));
+	ASSERT_EQ(0, rv);
+	ASSERT_FALSE(file_exists(cache_dir, ".tmp-stale"));
+	ASSERT_TRUE(file_exists(cache_dir, ".tmp-fresh"));
+
+	remove_cache_dir(cache_dir);
+	http_stand_in_stop(&server);
+}
+
+struct ConcurrentGet {
+	struct SqshMapManager *mapper;
+	sqsh_index_t index;
+	const struct SqshMapSlice *slice;
+	int rv;
+};
+
+static void *
+concurrent_get(void *arg) {
+	struct ConcurrentGet *ctx = arg;
+	ctx->rv = sqsh__map_manager_get(ctx->mapper, ctx->index, &ctx->slice);
+	return NULL;
+}
+
+UTEST(curl_mapper, fetch_blocks_in_parallel) {
+	int rv;
+	struct HttpStandIn server;
+	struct SqshMapManager mapper = {0};
+	pthread_t threads[4];
+	struct ConcurrentGet ctx[4] = {0};
+	uint8_t payload[256];
+	char url[64];
+	fill_payload(payload, sizeof(payload));
+
+	rv = http_stand_in_start(&server, payload, sizeof(payload), 200);
+	ASSERT_EQ(0, rv);
+	snprintf(url, sizeof(url), "http://127.0.0.1:%u/image", server.port);
+
+	rv = sqsh__map_manager_init(
+			&mapper, url,
+			&(struct SqshConfig){
+					.source_mapper = sqsh_mapper_impl_curl,
+					.mapper_block_size = 16});
+	ASSERT_EQ(0, rv);
+
+	for (size_t i = 0; i < LENGTH(threads); i++) {
+		ctx[i].mapper = &mapper;
+		ctx[i].index = i + 1;
+		rv = pthread_create(&threads[i], NULL, concurrent_get, &ctx[i]);
+		ASSERT_EQ(0, rv);
+	}
+	for (size_t i = 0; i < LENGTH(threads); i++) {
+		pthread_join(threads[i], NULL);
+		ASSERT_EQ(0, ctx[i].rv);
+		ASSERT_EQ(
+				0, memcmp(sqsh__map_slice_data(ctx[i].slice),
+						  &payload[(i + 1) * 16], 16));
+		sqsh__map_manager_release(&mapper, ctx[i].slice);
+	}
+	ASSERT_LT(1, __atomic_load_n(&server.max_in_flight, __ATOMIC_SEQ_CST));
+
+	sqsh__map_manager_cleanup(&mapper);
+	http_stand_in_stop(&server);
+}
+
+UTEST_MAIN()
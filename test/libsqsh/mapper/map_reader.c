@@ -32,12 +32,16 @@
  * @file         map_reader.c
  */
 
+#define _DEFAULT_SOURCE
+
 #include "../common.h"
 #include <utest.h>
 
 #include <sqsh_mapper_private.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 UTEST(map_reader, init_cursor) {
 	int rv;
@@ -286,4 +290,95 @@ UTEST(map_reader, error_2) {
 	sqsh__map_manager_cleanup(&mapper);
 }
 
+UTEST(map_reader, whole_source_is_pinned) {
+	int rv;
+	struct SqshMapManager mapper = {0};
+	struct SqshMapReader cursor = {0};
+	const uint8_t buffer[] = "THIS IS A TEST STRING";
+	rv = sqsh__map_manager_init(
+			&mapper, buffer,
+			&(struct SqshConfig){
+					.source_mapper = sqsh_mapper_impl_static,
+					.source_size = sizeof(buffer) - 1});
+	ASSERT_EQ(0, rv);
+	ASSERT_TRUE(mapper.is_pinned);
+
+	rv = sqsh__map_reader_init(&cursor, &mapper, 0, sizeof(buffer) - 1);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__map_reader_advance(&cursor, 5, 2);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(&buffer[5], sqsh__map_reader_data(&cursor));
+
+	sqsh__map_reader_cleanup(&cursor);
+	sqsh__map_manager_cleanup(&mapper);
+}
+
+UTEST(map_reader, mmap_full) {
+	int rv;
+	struct SqshMapManager mapper = {0};
+	struct SqshMapReader cursor = {0};
+	const char buffer[] = "THIS IS A TEST STRING";
+	char path[] = "/tmp/libsqsh-mmap-full-XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_LE(0, fd);
+	ASSERT_EQ((ssize_t)sizeof(buffer) - 1,
+			  write(fd, buffer, sizeof(buffer) - 1));
+	close(fd);
+
+	rv = sqsh__map_manager_init(
+			&mapper, path,
+			&(struct SqshConfig){.source_mapper = sqsh_mapper_impl_mmap_full});
+	unlink(path);
+	ASSERT_EQ(0, rv);
+	ASSERT_TRUE(mapper.is_pinned);
+	ASSERT_EQ((uint64_t)sizeof(buffer) - 1, sqsh__map_manager_size(&mapper));
+
+	rv = sqsh__map_reader_init(&cursor, &mapper, 0, sizeof(buffer) - 1);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__map_reader_advance(&cursor, 8, 6);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(0, memcmp(sqsh__map_reader_data(&cursor), "A TEST", 6));
+
+	sqsh__map_reader_cleanup(&cursor);
+	sqsh__map_manager_cleanup(&mapper);
+}
+
+UTEST(map_reader, uring) {
+	int rv;
+	struct SqshMapManager mapper = {0};
+	struct SqshMapReader cursor = {0};
+	const char buffer[] = "THIS IS A TEST STRING";
+	char path[] = "/tmp/libsqsh-uring-XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_LE(0, fd);
+	ASSERT_EQ((ssize_t)sizeof(buffer) - 1,
+			  write(fd, buffer, sizeof(buffer) - 1));
+	close(fd);
+
+	rv = sqsh__map_manager_init(
+			&mapper, path,
+			&(struct SqshConfig){
+					.source_mapper = sqsh_mapper_impl_uring,
+					.mapper_block_size = 4});
+	unlink(path);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint64_t)sizeof(buffer) - 1, sqsh__map_manager_size(&mapper));
+
+	rv = sqsh__map_reader_init(&cursor, &mapper, 0, sizeof(buffer) - 1);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__map_reader_advance(&cursor, 8, 6);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(0, memcmp(sqsh__map_reader_data(&cursor), "A TEST", 6));
+
+	rv = sqsh__map_reader_advance(&cursor, 6, 7);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ(0, memcmp(sqsh__map_reader_data(&cursor), " STRING", 7));
+
+	sqsh__map_reader_cleanup(&cursor);
+	sqsh__map_manager_cleanup(&mapper);
+}
+
 UTEST_MAIN()
@@ -0,0 +1,428 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2023, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         file_ext.c
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "../common.h"
+#include <utest.h>
+
+#include <sqsh_archive_private.h>
+#include <sqsh_common_private.h>
+#include <sqsh_file_private.h>
+#include <pthread.h>
+#include <sqsh_posix_private.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE_LITERAL 32768
+static const size_t BLOCK_SIZE = BLOCK_SIZE_LITERAL;
+#define SPARSE_BLOCK_COUNT 16
+
+struct IteratorMtContext {
+	struct SqshFileIteratorMt *mt;
+	bool cancel;
+	size_t blocks;
+	size_t running;
+	size_t max_running;
+	bool done;
+	int err;
+};
+
+static void
+count_blocks_cb(
+		const struct SqshFile *file, const struct SqshFileIterator *iterator,
+		uint64_t offset, void *data, int err) {
+	(void)file;
+	(void)offset;
+	struct IteratorMtContext *ctx = data;
+
+	if (iterator == NULL) {
+		ctx->err = err;
+		__atomic_store_n(&ctx->done, true, __ATOMIC_RELEASE);
+		return;
+	}
+
+	size_t running = __atomic_add_fetch(&ctx->running, 1, __ATOMIC_ACQ_REL);
+	size_t max_running = __atomic_load_n(&ctx->max_running, __ATOMIC_ACQUIRE);
+	while (running > max_running &&
+		   !__atomic_compare_exchange_n(
+				   &ctx->max_running, &max_running, running, false,
+				   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+	}
+
+	if (ctx->cancel) {
+		// The handle is only returned after the first blocks are scheduled.
+		while (__atomic_load_n(&ctx->mt, __ATOMIC_ACQUIRE) == NULL) {
+			usleep(100);
+		}
+		sqsh_file_iterator_mt_cancel(ctx->mt);
+	} else {
+		usleep(1000);
+	}
+
+	__atomic_add_fetch(&ctx->blocks, 1, __ATOMIC_ACQ_REL);
+	__atomic_sub_fetch(&ctx->running, 1, __ATOMIC_ACQ_REL);
+}
+
+static void
+init_sparse_file(struct SqshArchive *archive, struct SqshFile *file) {
+	static uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128),
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, 32768 * SPARSE_BLOCK_COUNT),
+			/* clang-format on */
+	};
+	mk_stub(archive, payload, sizeof(payload));
+
+	int rv = sqsh__file_init(file, archive, sqsh_address_ref_create(0, 0));
+	assert(rv == 0);
+	(void)rv;
+}
+
+static void
+init_sparse_middle_file(struct SqshArchive *archive, struct SqshFile *file) {
+	static uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* datablocks */
+			[1024] = ZLIB_32K_A, ZLIB_ABCD,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128),
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, 32768 * 2 + 4),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_32K_A), 1),
+			DATA_BLOCK_REF(0, 0),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_ABCD), 1),
+			/* clang-format on */
+	};
+	mk_stub(archive, payload, sizeof(payload));
+
+	int rv = sqsh__file_init(file, archive, sqsh_address_ref_create(0, 0));
+	assert(rv == 0);
+	(void)rv;
+}
+
+UTEST(file_ext, iterator_mt_limits_blocks_in_flight) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	struct SqshThreadpool threadpool = {0};
+	struct IteratorMtContext ctx = {0};
+
+	init_sparse_file(&archive, &file);
+	ASSERT_EQ(BLOCK_SIZE * SPARSE_BLOCK_COUNT, sqsh_file_size(&file));
+
+	rv = sqsh__threadpool_init(&threadpool, 4);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFileIteratorMt *mt = sqsh_file_iterator_mt2(
+			&file, &threadpool, 2, count_blocks_cb, &ctx, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_NE(NULL, mt);
+
+	rv = sqsh_threadpool_wait(&threadpool);
+	ASSERT_EQ(0, rv);
+	ASSERT_TRUE(__atomic_load_n(&ctx.done, __ATOMIC_ACQUIRE));
+	ASSERT_EQ(0, ctx.err);
+	ASSERT_EQ((size_t)SPARSE_BLOCK_COUNT, ctx.blocks);
+	ASSERT_LE(ctx.max_running, (size_t)2);
+
+	sqsh_file_iterator_mt_release(mt);
+	sqsh__threadpool_cleanup(&threadpool);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(file_ext, iterator_mt_cancel) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	struct SqshThreadpool threadpool = {0};
+	struct IteratorMtContext ctx = {.cancel = true};
+
+	init_sparse_file(&archive, &file);
+
+	rv = sqsh__threadpool_init(&threadpool, 2);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFileIteratorMt *mt = sqsh_file_iterator_mt2(
+			&file, &threadpool, 1, count_blocks_cb, &ctx, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_NE(NULL, mt);
+	__atomic_store_n(&ctx.mt, mt, __ATOMIC_RELEASE);
+
+	rv = sqsh_threadpool_wait(&threadpool);
+	ASSERT_EQ(0, rv);
+	ASSERT_TRUE(__atomic_load_n(&ctx.done, __ATOMIC_ACQUIRE));
+	ASSERT_EQ(-SQSH_ERROR_CANCELLED, ctx.err);
+	ASSERT_EQ((size_t)1, ctx.blocks);
+
+	sqsh_file_iterator_mt_release(mt);
+	sqsh__threadpool_cleanup(&threadpool);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(file_ext, iterator_mt_empty_file) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	struct SqshThreadpool threadpool = {0};
+	struct IteratorMtContext ctx = {0};
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128),
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, 0),
+			/* clang-format on */
+	};
+	mk_stub(&archive, payload, sizeof(payload));
+
+	rv = sqsh__file_init(&file, &archive, sqsh_address_ref_create(0, 0));
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__threadpool_init(&threadpool, 2);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFileIteratorMt *mt = sqsh_file_iterator_mt2(
+			&file, &threadpool, 0, count_blocks_cb, &ctx, &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_NE(NULL, mt);
+	ASSERT_TRUE(ctx.done);
+	ASSERT_EQ(0, ctx.err);
+	ASSERT_EQ((size_t)0, ctx.blocks);
+
+	sqsh_file_iterator_mt_release(mt);
+	sqsh__threadpool_cleanup(&threadpool);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
+struct PipeReader {
+	int fd;
+	uint8_t data[BLOCK_SIZE_LITERAL * 2 + 4];
+	size_t size;
+};
+
+static void *
+pipe_reader(void *data) {
+	struct PipeReader *reader = data;
+	ssize_t n;
+	while ((n = read(reader->fd, reader->data + reader->size,
+					 sizeof(reader->data) - reader->size)) > 0) {
+		reader->size += (size_t)n;
+	}
+	return NULL;
+}
+
+UTEST(file_ext, to_stream_ordered_writes_to_pipe) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	struct SqshThreadpool threadpool = {0};
+	struct PipeReader reader = {0};
+	pthread_t reader_thread;
+	int fds[2];
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* datablocks */
+			[1024] = ZLIB_32K_A, ZLIB_32K_A, ZLIB_ABCD,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128),
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, BLOCK_SIZE * 2 + 4),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_32K_A), 1),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_32K_A), 1),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_ABCD), 1),
+			/* clang-format on */
+	};
+	mk_stub(&archive, payload, sizeof(payload));
+
+	rv = sqsh__file_init(&file, &archive, sqsh_address_ref_create(0, 0));
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__threadpool_init(&threadpool, 4);
+	ASSERT_EQ(0, rv);
+
+	rv = pipe(fds);
+	ASSERT_EQ(0, rv);
+	reader.fd = fds[0];
+	rv = pthread_create(&reader_thread, NULL, pipe_reader, &reader);
+	ASSERT_EQ(0, rv);
+
+	FILE *stream = fdopen(fds[1], "w");
+	ASSERT_NE(NULL, stream);
+
+	// A window of one block forces the writer to wait for each block.
+	rv = sqsh_file_to_stream_ordered(&file, &threadpool, 1, stream);
+	ASSERT_EQ(0, rv);
+	fclose(stream);
+
+	pthread_join(reader_thread, NULL);
+	close(fds[0]);
+
+	ASSERT_EQ(BLOCK_SIZE * 2 + 4, reader.size);
+	for (size_t i = 0; i < BLOCK_SIZE * 2; i++) {
+		ASSERT_EQ('a', reader.data[i]);
+	}
+	ASSERT_EQ(0, memcmp(&reader.data[BLOCK_SIZE * 2], "abcd", 4));
+
+	sqsh__threadpool_cleanup(&threadpool);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(file_ext, to_stream_ordered_writes_sparse_block) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	struct SqshThreadpool threadpool = {0};
+	struct PipeReader reader = {0};
+	pthread_t reader_thread;
+	int fds[2];
+
+	// The sparse block is larger than the zero block of the archive, so it
+	// is presented to the worker in more than one chunk.
+	init_sparse_middle_file(&archive, &file);
+	ASSERT_GT(BLOCK_SIZE, sqsh__archive_zero_block_size(&archive));
+
+	rv = sqsh__threadpool_init(&threadpool, 4);
+	ASSERT_EQ(0, rv);
+
+	rv = pipe(fds);
+	ASSERT_EQ(0, rv);
+	reader.fd = fds[0];
+	rv = pthread_create(&reader_thread, NULL, pipe_reader, &reader);
+	ASSERT_EQ(0, rv);
+
+	FILE *stream = fdopen(fds[1], "w");
+	ASSERT_NE(NULL, stream);
+
+	rv = sqsh_file_to_stream_ordered(&file, &threadpool, 0, stream);
+	ASSERT_EQ(0, rv);
+	fclose(stream);
+
+	pthread_join(reader_thread, NULL);
+	close(fds[0]);
+
+	ASSERT_EQ(BLOCK_SIZE * 2 + 4, reader.size);
+	for (size_t i = 0; i < BLOCK_SIZE; i++) {
+		ASSERT_EQ('a', reader.data[i]);
+	}
+	for (size_t i = BLOCK_SIZE; i < BLOCK_SIZE * 2; i++) {
+		ASSERT_EQ(0, reader.data[i]);
+	}
+	ASSERT_EQ(0, memcmp(&reader.data[BLOCK_SIZE * 2], "abcd", 4));
+
+	sqsh__threadpool_cleanup(&threadpool);
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(file_ext, read_mt_spans_blocks) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshFile file = {0};
+	struct SqshArchive sparse_archive = {0};
+	struct SqshFile sparse_file = {0};
+	struct SqshThreadpool threadpool = {0};
+	uint8_t buffer[BLOCK_SIZE_LITERAL + 6] = {0};
+	uint8_t payload[8192] = {
+			/* clang-format off */
+			SQSH_HEADER,
+			/* datablocks */
+			[1024] = ZLIB_32K_A, ZLIB_32K_A, ZLIB_ABCD,
+			/* inode */
+			[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 128),
+			INODE_HEADER(2, 0, 0, 0, 0, 1),
+			INODE_BASIC_FILE(1024, 0xFFFFFFFF, 0, BLOCK_SIZE * 2 + 4),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_32K_A), 1),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_32K_A), 1),
+			DATA_BLOCK_REF(CHUNK_SIZE(ZLIB_ABCD), 1),
+			/* clang-format on */
+	};
+	mk_stub(&archive, payload, sizeof(payload));
+
+	rv = sqsh__file_init(&file, &archive, sqsh_address_ref_create(0, 0));
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__threadpool_init(&threadpool, 4);
+	ASSERT_EQ(0, rv);
+
+	// Starts two bytes before the end of the first block and ends at the
+	// end of the file, so all three blocks are involved.
+	rv = sqsh_file_read_mt(
+			&file, &threadpool, BLOCK_SIZE - 2, sizeof(buffer), buffer);
+	ASSERT_EQ(0, rv);
+	for (size_t i = 0; i < BLOCK_SIZE + 2; i++) {
+		ASSERT_EQ('a', buffer[i]);
+	}
+	ASSERT_EQ(0, memcmp(&buffer[BLOCK_SIZE + 2], "abcd", 4));
+
+	rv = sqsh_file_read_mt(
+			&file, &threadpool, BLOCK_SIZE, sizeof(buffer), buffer);
+	ASSERT_EQ(-SQSH_ERROR_OUT_OF_BOUNDS, rv);
+
+	rv = sqsh_file_read_mt(&file, &threadpool, BLOCK_SIZE * 2 + 4, 0, buffer);
+	ASSERT_EQ(0, rv);
+
+	sqsh__file_cleanup(&file);
+	sqsh__archive_cleanup(&archive);
+
+	// The same read over a sparse middle block must fill the whole block,
+	// not only its first chunk.
+	init_sparse_middle_file(&sparse_archive, &sparse_file);
+	memset(buffer, 0xff, sizeof(buffer));
+	rv = sqsh_file_read_mt(
+			&sparse_file, &threadpool, BLOCK_SIZE - 2, sizeof(buffer),
+			buffer);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ('a', buffer[0]);
+	ASSERT_EQ('a', buffer[1]);
+	for (size_t i = 2; i < BLOCK_SIZE + 2; i++) {
+		ASSERT_EQ(0, buffer[i]);
+	}
+	ASSERT_EQ(0, memcmp(&buffer[BLOCK_SIZE + 2], "abcd", 4));
+
+	sqsh__threadpool_cleanup(&threadpool);
+	sqsh__file_cleanup(&sparse_file);
+	sqsh__archive_cleanup(&sparse_archive);
+}
+
+UTEST_MAIN()
@@ -0,0 +1,237 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2023, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         table.c
+ */
+
+#include "../common.h"
+#include <utest.h>
+
+#include <sqsh_archive_private.h>
+#include <sqsh_data_private.h>
+#include <sqsh_table_private.h>
+
+/* 2100 uint32_t elements span two metablocks. */
+#define TABLE_ELEMENTS 2100
+#define TABLE_METABLOCK_1 1024
+#define TABLE_METABLOCK_2 (TABLE_METABLOCK_1 + 2 + 8192)
+#define TABLE_LOOKUP 12288
+
+static void
+fill_table(uint8_t *payload) {
+	const uint8_t lookup[] = {
+			UINT64_BYTES(TABLE_METABLOCK_1),
+			UINT64_BYTES(TABLE_METABLOCK_2),
+	};
+	const uint8_t header_1[] = {METABLOCK_HEADER(0, 8192)};
+	const uint8_t header_2[] = {
+			METABLOCK_HEADER(0, TABLE_ELEMENTS * 4 - 8192)};
+	uint8_t *p;
+
+	memcpy(&payload[TABLE_METABLOCK_1], header_1, sizeof(header_1));
+	memcpy(&payload[TABLE_METABLOCK_2], header_2, sizeof(header_2));
+	for (uint32_t i = 0; i < TABLE_ELEMENTS; i++) {
+		if (i < 8192 / 4) {
+			p = &payload[TABLE_METABLOCK_1 + 2 + i * 4];
+		} else {
+			p = &payload[TABLE_METABLOCK_2 + 2 + i * 4 - 8192];
+		}
+		const uint8_t element[] = {UINT32_BYTES(i * 3)};
+		memcpy(p, element, sizeof(element));
+	}
+	memcpy(&payload[TABLE_LOOKUP], lookup, sizeof(lookup));
+}
+
+static void
+mk_table(struct SqshArchive *archive, uint8_t *payload, size_t payload_size) {
+	fill_table(payload);
+	mk_stub(archive, payload, payload_size);
+}
+
+static int
+init_budget_table(
+		struct SqshArchive *archive, uint8_t *payload, size_t payload_size,
+		uint64_t max_cache_bytes) {
+	fill_table(payload);
+	FILE *farchive = test_sqsh_prepare_archive(payload, payload_size);
+	fclose(farchive);
+
+	struct SqshConfig config = DEFAULT_CONFIG(payload_size);
+	config.max_cache_bytes = max_cache_bytes;
+	return sqsh__archive_init(archive, payload, &config);
+}
+
+UTEST(table, get) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshTable table = {0};
+	uint8_t payload[16384] = {SQSH_HEADER};
+	uint32_t element;
+
+	mk_table(&archive, payload, sizeof(payload));
+
+	rv = sqsh__table_init(
+			&table, &archive, TABLE_LOOKUP, sizeof(uint32_t), TABLE_ELEMENTS);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_table_get(&table, 0, &element);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)0, element);
+
+	rv = sqsh_table_get(&table, 2047, &element);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)2047 * 3, element);
+
+	rv = sqsh_table_get(&table, 2048, &element);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)2048 * 3, element);
+
+	rv = sqsh_table_get(&table, TABLE_ELEMENTS - 1, &element);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)(TABLE_ELEMENTS - 1) * 3, element);
+
+	rv = sqsh_table_get(&table, TABLE_ELEMENTS, &element);
+	ASSERT_EQ(-SQSH_ERROR_OUT_OF_BOUNDS, rv);
+
+	sqsh__table_cleanup(&table);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(table, get_range_across_metablocks) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshTable table = {0};
+	uint8_t payload[16384] = {SQSH_HEADER};
+	uint32_t elements[100] = {0};
+
+	mk_table(&archive, payload, sizeof(payload));
+
+	rv = sqsh__table_init(
+			&table, &archive, TABLE_LOOKUP, sizeof(uint32_t), TABLE_ELEMENTS);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_table_get_range(&table, 2000, LENGTH(elements), elements);
+	ASSERT_EQ(0, rv);
+	for (uint32_t i = 0; i < LENGTH(elements); i++) {
+		ASSERT_EQ((2000 + i) * 3, elements[i]);
+	}
+
+	rv = sqsh_table_get_range(
+			&table, TABLE_ELEMENTS - 50, LENGTH(elements), elements);
+	ASSERT_EQ(-SQSH_ERROR_OUT_OF_BOUNDS, rv);
+
+	sqsh__table_cleanup(&table);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(table, metablock_cache_is_bounded) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshTable table = {0};
+	uint8_t payload[16384] = {SQSH_HEADER};
+	const size_t metablock_count = SQSH_TABLE_METABLOCK_CACHE_SIZE + 8;
+	uint32_t element;
+
+	// Every entry of the lookup table points to the same metablock.
+	for (size_t i = 0; i < metablock_count; i++) {
+		const uint8_t lookup[] = {UINT64_BYTES(TABLE_METABLOCK_1)};
+		memcpy(&payload[TABLE_LOOKUP + i * 8], lookup, sizeof(lookup));
+	}
+	const uint8_t header[] = {METABLOCK_HEADER(0, 8192)};
+	memcpy(&payload[TABLE_METABLOCK_1], header, sizeof(header));
+	const uint8_t element_5[] = {UINT32_BYTES(15)};
+	memcpy(&payload[TABLE_METABLOCK_1 + 2 + 5 * 4], element_5, 4);
+	mk_stub(&archive, payload, sizeof(payload));
+
+	rv = sqsh__table_init(
+			&table, &archive, TABLE_LOOKUP, sizeof(uint32_t),
+			metablock_count * 2048);
+	ASSERT_EQ(0, rv);
+
+	for (size_t i = 0; i < metablock_count; i++) {
+		rv = sqsh_table_get(&table, i * 2048 + 5, &element);
+		ASSERT_EQ(0, rv);
+		ASSERT_EQ((uint32_t)15, element);
+	}
+	ASSERT_EQ((size_t)SQSH_TABLE_METABLOCK_CACHE_SIZE, table.cache->count);
+
+	sqsh__table_cleanup(&table);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(table, metablocks_are_charged_to_budget) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshTable table = {0};
+	uint8_t payload[16384] = {SQSH_HEADER};
+	uint32_t element;
+
+	rv = init_budget_table(&archive, payload, sizeof(payload), 1 << 20);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__table_init(
+			&table, &archive, TABLE_LOOKUP, sizeof(uint32_t), TABLE_ELEMENTS);
+	ASSERT_EQ(0, rv);
+
+	const uint64_t used_bytes = archive.cache_budget.used_bytes;
+	rv = sqsh_table_get(&table, 0, &element);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((size_t)1, table.cache->count);
+	ASSERT_LE(used_bytes + 8192, archive.cache_budget.used_bytes);
+
+	sqsh__table_cleanup(&table);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(table, metablocks_are_evicted_by_budget) {
+	int rv;
+	struct SqshArchive archive = {0};
+	struct SqshTable table = {0};
+	uint8_t payload[16384] = {SQSH_HEADER};
+	uint32_t element;
+
+	rv = init_budget_table(&archive, payload, sizeof(payload), 1);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh__table_init(
+			&table, &archive, TABLE_LOOKUP, sizeof(uint32_t), TABLE_ELEMENTS);
+	ASSERT_EQ(0, rv);
+
+	rv = sqsh_table_get(&table, 2048, &element);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)2048 * 3, element);
+	ASSERT_EQ((size_t)0, table.cache->count);
+
+	sqsh__table_cleanup(&table);
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST_MAIN()
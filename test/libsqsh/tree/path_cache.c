@@ -0,0 +1,243 @@
+/*
+ * BSD 2-Clause License
+ *
+ * Copyright (c) 2023, Enno Boland
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @author       Enno Boland (mail@eboland.de)
+ * @file         path_cache.c
+ */
+
+#include "../common.h"
+#include <utest.h>
+
+#include <sqsh_archive_private.h>
+#include <sqsh_common_private.h>
+#include <sqsh_data_private.h>
+#include <sqsh_tree_private.h>
+
+#define PATH_CACHE_PAYLOAD \
+	/* clang-format off */ \
+	SQSH_HEADER, \
+	/* inode */ \
+	[INODE_TABLE_OFFSET] = METABLOCK_HEADER(0, 1024), \
+	INODE_HEADER(1, 0, 0, 0, 0, 1), \
+	INODE_BASIC_DIR(0, 38, 0, 0), \
+	[INODE_TABLE_OFFSET+2+128] = \
+	INODE_HEADER(1, 0, 0, 0, 0, 2), \
+	INODE_BASIC_DIR(0, 27, 64, 1), \
+	[INODE_TABLE_OFFSET+2+256] = \
+	INODE_HEADER(2, 0, 0, 0, 0, 3), \
+	INODE_BASIC_FILE(0, 0xFFFFFFFF, 0, 0), \
+	[INODE_TABLE_OFFSET+2+384] = \
+	INODE_HEADER(3, 0, 0, 0, 0, 4), \
+	INODE_BASIC_SYMLINK(3), \
+	'd', 'i', 'r', \
+	[DIRECTORY_TABLE_OFFSET] = METABLOCK_HEADER(0, 128), \
+	DIRECTORY_HEADER(2, 0, 0), \
+	DIRECTORY_ENTRY(128, 2, 1, 3), \
+	'd', 'i', 'r', \
+	DIRECTORY_ENTRY(384, 4, 3, 4), \
+	'l', 'i', 'n', 'k', \
+	[DIRECTORY_TABLE_OFFSET+2+64] = \
+	DIRECTORY_HEADER(1, 0, 0), \
+	DIRECTORY_ENTRY(256, 3, 2, 4), \
+	'f', 'i', 'l', 'e', \
+	[FRAGMENT_TABLE_OFFSET] = 0 \
+	/* clang-format on */
+
+static int
+init_archive(
+		struct SqshArchive *archive, uint8_t *payload, size_t payload_size,
+		int path_cache_size) {
+	FILE *farchive = test_sqsh_prepare_archive(payload, payload_size);
+	fclose(farchive);
+
+	struct SqshConfig config = DEFAULT_CONFIG(payload_size);
+	config.path_cache_size = path_cache_size;
+	return sqsh__archive_init(archive, payload, &config);
+}
+
+static bool
+is_cached(struct SqshArchive *archive, const char *path, bool follow) {
+	struct SqshPathCacheValue value;
+	return sqsh__path_cache_get(
+			&archive->path_cache, path, strlen(path), follow, &value);
+}
+
+UTEST(path_cache, open_caches_path_and_directories) {
+	int rv;
+	struct SqshArchive archive = {0};
+	uint8_t payload[] = {PATH_CACHE_PAYLOAD};
+	rv = init_archive(&archive, payload, sizeof(payload), 16);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFile *file = sqsh_open(&archive, "/dir/file", &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)3, sqsh_file_inode(file));
+	sqsh_close(file);
+
+	ASSERT_EQ((size_t)2, archive.path_cache.count);
+	ASSERT_TRUE(is_cached(&archive, "dir", true));
+	ASSERT_TRUE(is_cached(&archive, "dir/file", true));
+	ASSERT_FALSE(is_cached(&archive, "dir/file", false));
+
+	file = sqsh_open(&archive, "dir/file", &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)3, sqsh_file_inode(file));
+	ASSERT_EQ(
+			sqsh_address_ref_create(0, 128),
+			sqsh__file_parent_inode_ref(file, &rv));
+	ASSERT_EQ(0, rv);
+	sqsh_close(file);
+	ASSERT_EQ((size_t)2, archive.path_cache.count);
+
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(path_cache, open_uses_cached_path) {
+	int rv;
+	struct SqshArchive archive = {0};
+	uint8_t payload[] = {PATH_CACHE_PAYLOAD};
+	rv = init_archive(&archive, payload, sizeof(payload), 16);
+	ASSERT_EQ(0, rv);
+
+	const struct SqshPathCacheValue value = {
+			.inode_ref = sqsh_address_ref_create(0, 256),
+			.parent_inode_ref = sqsh_address_ref_create(0, 128),
+	};
+	rv = sqsh__path_cache_put(
+			&archive.path_cache, "alias", 5, false, &value);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFile *file = sqsh_lopen(&archive, "/alias", &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)3, sqsh_file_inode(file));
+	sqsh_close(file);
+
+	file = sqsh_open(&archive, "/alias", &rv);
+	ASSERT_EQ(-SQSH_ERROR_NO_SUCH_FILE, rv);
+	ASSERT_EQ(NULL, file);
+
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(path_cache, open_caches_missing_paths) {
+	int rv;
+	struct SqshArchive archive = {0};
+	uint8_t payload[] = {PATH_CACHE_PAYLOAD};
+	rv = init_archive(&archive, payload, sizeof(payload), 16);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFile *file = sqsh_open(&archive, "/dir/missing", &rv);
+	ASSERT_EQ(-SQSH_ERROR_NO_SUCH_FILE, rv);
+	ASSERT_EQ(NULL, file);
+	ASSERT_TRUE(is_cached(&archive, "dir/missing", true));
+
+	file = sqsh_open(&archive, "/dir/missing/file", &rv);
+	ASSERT_EQ(-SQSH_ERROR_NO_SUCH_FILE, rv);
+	ASSERT_EQ(NULL, file);
+
+	file = sqsh_open(&archive, "/dir/file/file", &rv);
+	ASSERT_EQ(-SQSH_ERROR_NOT_A_DIRECTORY, rv);
+	ASSERT_EQ(NULL, file);
+	file = sqsh_open(&archive, "/dir/file/file", &rv);
+	ASSERT_EQ(-SQSH_ERROR_NOT_A_DIRECTORY, rv);
+	ASSERT_EQ(NULL, file);
+
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(path_cache, open_separates_symlinks) {
+	int rv;
+	struct SqshArchive archive = {0};
+	uint8_t payload[] = {PATH_CACHE_PAYLOAD};
+	rv = init_archive(&archive, payload, sizeof(payload), 16);
+	ASSERT_EQ(0, rv);
+
+	for (int i = 0; i < 2; i++) {
+		struct SqshFile *file = sqsh_lopen(&archive, "/link", &rv);
+		ASSERT_EQ(0, rv);
+		ASSERT_EQ(SQSH_FILE_TYPE_SYMLINK, sqsh_file_type(file));
+		sqsh_close(file);
+
+		file = sqsh_open(&archive, "/link", &rv);
+		ASSERT_EQ(0, rv);
+		ASSERT_EQ(SQSH_FILE_TYPE_DIRECTORY, sqsh_file_type(file));
+		ASSERT_EQ((uint32_t)2, sqsh_file_inode(file));
+		sqsh_close(file);
+
+		file = sqsh_open(&archive, "/link//file", &rv);
+		ASSERT_EQ(0, rv);
+		ASSERT_EQ((uint32_t)3, sqsh_file_inode(file));
+		ASSERT_EQ(
+				sqsh_address_ref_create(0, 128),
+				sqsh__file_parent_inode_ref(file, &rv));
+		ASSERT_EQ(0, rv);
+		sqsh_close(file);
+	}
+
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(path_cache, cache_is_bounded) {
+	int rv;
+	struct SqshArchive archive = {0};
+	uint8_t payload[] = {PATH_CACHE_PAYLOAD};
+	rv = init_archive(&archive, payload, sizeof(payload), 1);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFile *file = sqsh_open(&archive, "/dir/file", &rv);
+	ASSERT_EQ(0, rv);
+	sqsh_close(file);
+
+	ASSERT_EQ((size_t)1, archive.path_cache.count);
+	ASSERT_TRUE(is_cached(&archive, "dir/file", true));
+	ASSERT_FALSE(is_cached(&archive, "dir", true));
+
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST(path_cache, disabled_by_default) {
+	int rv;
+	struct SqshArchive archive = {0};
+	uint8_t payload[] = {PATH_CACHE_PAYLOAD};
+	rv = init_archive(&archive, payload, sizeof(payload), 0);
+	ASSERT_EQ(0, rv);
+
+	struct SqshFile *file = sqsh_open(&archive, "/dir/file", &rv);
+	ASSERT_EQ(0, rv);
+	ASSERT_EQ((uint32_t)3, sqsh_file_inode(file));
+	sqsh_close(file);
+
+	ASSERT_EQ((size_t)0, archive.path_cache.count);
+	ASSERT_FALSE(is_cached(&archive, "dir/file", true));
+
+	sqsh__archive_cleanup(&archive);
+}
+
+UTEST_MAIN()
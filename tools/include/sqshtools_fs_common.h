@@ -40,6 +40,8 @@
 
 #include "../include/sqsh.h"
 #include <fuse_opt.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/stat.h>
 
@@ -54,6 +56,23 @@ struct SqshfsOptions {
 	int multithreaded;
 	int foreground;
 	int offset;
+	int stats;
+};
+
+/**
+ * A reader that is kept between read requests. `offset` is the file offset
+ * the reader currently points to, so sequential reads only need to advance
+ * the reader by the distance to the next request.
+ */
+struct SqshfsReadCursor {
+	struct SqshFileReader *reader;
+	uint64_t offset;
+};
+
+struct SqshfsFileHandle {
+	struct SqshFile *file;
+	pthread_mutex_t lock;
+	struct SqshfsReadCursor cursor;
 };
 
 extern struct fuse_opt fs_common_opts[];
@@ -74,12 +93,52 @@ mode_t fs_common_inode_mode(struct SqshFile *file);
 
 int fs_common_map_err(int rv);
 
+struct SqshfsFileHandle *
+fs_common_file_handle_new(struct SqshFile *file, int *err);
+
+void fs_common_file_handle_free(struct SqshfsFileHandle *handle);
+
 int fs_common_read(
-		struct SqshFileReader **reader, struct SqshFile *file, off_t offset,
-		size_t size);
+		struct SqshfsReadCursor *cursor, struct SqshFile *file, off_t offset,
+		size_t size, const uint8_t **data);
+
+void fs_common_read_cursor_cleanup(struct SqshfsReadCursor *cursor);
+
+/**
+ * Reads that cover at least this many blocks have their blocks decompressed
+ * in parallel by fs_common_read_mt() instead of one after another.
+ */
+#define FS_COMMON_PARALLEL_READ_BLOCKS 2
+
+bool fs_common_read_is_parallel(
+		const struct SqshSuperblock *superblock, off_t offset, size_t size);
+
+int fs_common_read_mt(
+		struct SqshFile *file, struct SqshThreadpool *threadpool, off_t offset,
+		size_t size, uint8_t *buffer);
+
+/**
+ * Checks whether a read is served entirely by uncompressed data blocks. If
+ * so, `address` is set to the position of the data within the archive and
+ * the size of the read, limited to the end of the file, is returned.
+ * Otherwise 0 is returned.
+ */
+int fs_common_read_uncompressed(
+		struct SqshFile *file, const struct SqshSuperblock *superblock,
+		off_t offset, size_t size, uint64_t *address);
+
+void fs_common_print_stats(struct SqshArchive *archive);
 
 void fs_common_getattr(
 		struct SqshFile *file, const struct SqshSuperblock *superblock,
 		struct stat *st);
 
+/**
+ * Fills `st` from attributes retrieved with sqsh_file_stat(). This is the
+ * counterpart of fs_common_getattr() that does not need an open file.
+ */
+void fs_common_stat(
+		const struct SqshFileStat *stat,
+		const struct SqshSuperblock *superblock, struct stat *st);
+
 #endif // TOOLS_COMMON_H
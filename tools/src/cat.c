@@ -47,6 +47,8 @@ usage(char *arg0) {
 	return EXIT_FAILURE;
 }
 
+static struct SqshThreadpool *threadpool = NULL;
+
 static int
 cat_path(struct SqshArchive *archive, char *path) {
 	struct SqshFile *file = NULL;
@@ -59,7 +61,11 @@ cat_path(struct SqshArchive *archive, char *path) {
 		goto out;
 	}
 
-	rv = sqsh_file_to_stream(file, stdout);
+	if (threadpool != NULL) {
+		rv = sqsh_file_to_stream_ordered(file, threadpool, 0, stdout);
+	} else {
+		rv = sqsh_file_to_stream(file, stdout);
+	}
 	if (rv < 0) {
 		sqsh_perror(rv, path);
 		rv = EXIT_FAILURE;
@@ -114,6 +120,14 @@ main(int argc, char *argv[]) {
 		goto out;
 	}
 
+	// Files are still written in order, but their blocks are decompressed
+	// on all cores. Without a threadpool, fall back to a single thread.
+	threadpool = sqsh_threadpool_new(0, &rv);
+	if (rv < 0) {
+		threadpool = NULL;
+		rv = 0;
+	}
+
 	for (; optind < argc; optind++) {
 		rv = cat_path(sqsh, argv[optind]);
 		if (rv < 0) {
@@ -122,6 +136,7 @@ main(int argc, char *argv[]) {
 	}
 
 out:
+	sqsh_threadpool_free(threadpool);
 	sqsh_archive_close(sqsh);
 	return rv;
 }
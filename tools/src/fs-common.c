@@ -34,6 +34,7 @@
 #include <sqshtools_fs_common.h>
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -44,6 +45,7 @@
 struct fuse_opt fs_common_opts[] = {
 		SQSHFS_OPT("archive=%s", archive, 0),
 		SQSHFS_OPT("offset=%s", offset, 0),
+		SQSHFS_OPT("stats", stats, 1),
 		FUSE_OPT_KEY("--help", KEY_HELP),
 		FUSE_OPT_KEY("-h", KEY_HELP),
 		FUSE_OPT_KEY("-V", KEY_VERSION),
@@ -54,6 +56,8 @@ void
 fs_common_help(void) {
 	printf("    -o archive=PATH        squashfs archive to be mounted\n");
 	printf("    -o offset=OFFSET       skip OFFSET at the start of archive\n");
+	printf("    -o stats               print cache statistics to stderr on "
+		   "unmount\n");
 }
 
 void
@@ -128,37 +132,165 @@ fs_common_map_err(int rv) {
 	}
 }
 
+struct SqshfsFileHandle *
+fs_common_file_handle_new(struct SqshFile *file, int *err) {
+	struct SqshfsFileHandle *handle = calloc(1, sizeof(*handle));
+	if (handle == NULL) {
+		*err = -SQSH_ERROR_MALLOC_FAILED;
+		return NULL;
+	}
+	if (pthread_mutex_init(&handle->lock, NULL) != 0) {
+		free(handle);
+		*err = -SQSH_ERROR_MUTEX_INIT_FAILED;
+		return NULL;
+	}
+	handle->file = file;
+	*err = 0;
+	return handle;
+}
+
+void
+fs_common_file_handle_free(struct SqshfsFileHandle *handle) {
+	if (handle == NULL) {
+		return;
+	}
+	fs_common_read_cursor_cleanup(&handle->cursor);
+	pthread_mutex_destroy(&handle->lock);
+	sqsh_close(handle->file);
+	free(handle);
+}
+
 int
 fs_common_read(
-		struct SqshFileReader **reader, struct SqshFile *inode, off_t offset,
-		size_t size) {
+		struct SqshfsReadCursor *cursor, struct SqshFile *inode, off_t offset,
+		size_t size, const uint8_t **data) {
 	int rv = 0;
-	*reader = sqsh_file_reader_new(inode, &rv);
+	uint64_t skip = (uint64_t)offset;
+	*data = NULL;
+
+	// Reading a 0 size at the end of the file would make
+	// sqsh_file_reader_advance2 return SQSH_ERROR_OUT_OF_BOUNDS. This
+	// should succeed instead, providing an empty buffer.
+	// TODO: Fix this in lib/reader/reader.c
+	uint64_t file_size = sqsh_file_size(inode);
+	if (offset < 0 || (uint64_t)offset >= file_size) {
+		return 0;
+	}
+	if (size > file_size - offset) {
+		size = file_size - offset;
+	}
+	if (size == 0) {
+		return 0;
+	}
+
+	// The reader can only move forward. For backward seeks start over with
+	// a fresh reader; seeking to a block is cheap, and the block itself
+	// is usually still in the extract cache.
+	if (cursor->reader != NULL && skip >= cursor->offset) {
+		skip -= cursor->offset;
+	} else {
+		sqsh_file_reader_free(cursor->reader);
+		cursor->reader = sqsh_file_reader_new(inode, &rv);
+		if (rv < 0) {
+			goto out;
+		}
+	}
+
+	rv = sqsh_file_reader_advance2(cursor->reader, skip, size);
 	if (rv < 0) {
 		goto out;
 	}
+	cursor->offset = (uint64_t)offset;
+
+	*data = sqsh_file_reader_data(cursor->reader);
+	rv = (int)sqsh_file_reader_size(cursor->reader);
+out:
+	if (rv < 0) {
+		fs_common_read_cursor_cleanup(cursor);
+	}
+	return fs_common_map_err(rv);
+}
+
+bool
+fs_common_read_is_parallel(
+		const struct SqshSuperblock *superblock, off_t offset, size_t size) {
+	const uint32_t block_size = sqsh_superblock_block_size(superblock);
+	if (offset < 0 || size == 0) {
+		return false;
+	}
+	const uint64_t first_block = (uint64_t)offset / block_size;
+	const uint64_t last_block = ((uint64_t)offset + size - 1) / block_size;
+	return last_block - first_block + 1 >= FS_COMMON_PARALLEL_READ_BLOCKS;
+}
+
+int
+fs_common_read_mt(
+		struct SqshFile *inode, struct SqshThreadpool *threadpool, off_t offset,
+		size_t size, uint8_t *buffer) {
+	int rv = 0;
 
 	uint64_t file_size = sqsh_file_size(inode);
+	if (offset < 0 || (uint64_t)offset >= file_size) {
+		return 0;
+	}
 	if (size > file_size - offset) {
 		size = file_size - offset;
 	}
 
-	// This works around a bug in sqsh_file_reader_advance:
-	// Reading a 0 size at the end of the file will return
-	// SQSH_ERROR_OUT_OF_BOUNDS. This should succeed instead,
-	// providing an empty buffer.
-	// TODO: Fix this in lib/reader/reader.c
-	if (size == 0) {
+	rv = sqsh_file_read_mt(inode, threadpool, (uint64_t)offset, size, buffer);
+	if (rv < 0) {
+		return fs_common_map_err(rv);
+	}
+	return (int)size;
+}
+
+int
+fs_common_read_uncompressed(
+		struct SqshFile *inode, const struct SqshSuperblock *superblock,
+		off_t offset, size_t size, uint64_t *address) {
+	int rv = 0;
+	const uint32_t block_size = sqsh_superblock_block_size(superblock);
+	const uint64_t block_count = sqsh_file_block_count2(inode);
+
+	uint64_t file_size = sqsh_file_size(inode);
+	if (offset < 0 || (uint64_t)offset >= file_size) {
 		return 0;
 	}
+	if (size > file_size - offset) {
+		size = file_size - offset;
+	}
 
-	rv = sqsh_file_reader_advance2(*reader, offset, size);
+	// Uncompressed blocks are stored back to back, so a run of them is
+	// one contiguous range in the archive. Sparse blocks and the fragment
+	// at the end of the file are not stored there and end the run. A short
+	// block before the last one is padded with zeros when read, which
+	// shifts the following blocks against the archive.
+	const uint64_t first_block = (uint64_t)offset / block_size;
+	const uint64_t last_block = ((uint64_t)offset + size - 1) / block_size;
+	for (uint64_t i = first_block; i <= last_block; i++) {
+		if (i >= block_count || sqsh_file_block_is_compressed2(inode, i)) {
+			return 0;
+		}
+		const uint32_t data_block_size = sqsh_file_block_size2(inode, i);
+		if (data_block_size == 0 ||
+			(i + 1 < block_count && data_block_size != block_size)) {
+			return 0;
+		}
+	}
+
+	rv = sqsh_file_block_address(inode, first_block, address);
 	if (rv < 0) {
-		goto out;
+		return fs_common_map_err(rv);
 	}
-out:
+	*address += (uint64_t)offset - first_block * block_size;
+	return (int)size;
+}
 
-	return fs_common_map_err(rv);
+void
+fs_common_read_cursor_cleanup(struct SqshfsReadCursor *cursor) {
+	sqsh_file_reader_free(cursor->reader);
+	cursor->reader = NULL;
+	cursor->offset = 0;
 }
 
 void
@@ -179,3 +311,46 @@ fs_common_getattr(
 		st->st_blksize = sqsh_superblock_block_size(superblock);
 	}
 }
+
+void
+fs_common_stat(
+		const struct SqshFileStat *stat,
+		const struct SqshSuperblock *superblock, struct stat *st) {
+	st->st_dev = 0;
+	st->st_ino = fs_common_inode_sqsh_to_ino(stat->inode_number);
+	st->st_mode = stat->permission | fs_common_mode_type(stat->type);
+	st->st_nlink = stat->hard_link_count;
+	st->st_uid = stat->uid;
+	st->st_gid = stat->gid;
+	st->st_size = stat->size;
+	st->st_atime = st->st_mtime = st->st_ctime = stat->modified_time;
+	if (superblock != NULL) {
+		st->st_blksize = sqsh_superblock_block_size(superblock);
+	}
+}
+
+static void
+print_cache_stats(const char *name, const struct SqshCacheStats *stats) {
+	fprintf(stderr,
+			"%s: hits=%" PRIu64 " misses=%" PRIu64 " evictions=%" PRIu64
+			" bytes_in=%" PRIu64 " bytes_out=%" PRIu64
+			" lock_contentions=%" PRIu64 " lock_wait_ns=%" PRIu64 "\n",
+			name, stats->hits, stats->misses, stats->evictions,
+			stats->bytes_in, stats->bytes_out, stats->lock_contentions,
+			stats->lock_wait_ns);
+}
+
+void
+fs_common_print_stats(struct SqshArchive *archive) {
+	struct SqshArchiveStats stats = {0};
+	int rv = sqsh_archive_stats(archive, &stats);
+	if (rv < 0) {
+		sqsh_perror(rv, "sqsh_archive_stats");
+		return;
+	}
+
+	fprintf(stderr, "compression_id: %i\n", (int)stats.compression_id);
+	print_cache_stats("mapper", &stats.mapper);
+	print_cache_stats("metablock", &stats.metablock);
+	print_cache_stats("data", &stats.data);
+}
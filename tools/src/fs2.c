@@ -52,6 +52,7 @@ struct Context {
 	struct SqshArchive *archive;
 	struct fuse *fuse;
 	struct fuse_chan *fuse_ch;
+	struct SqshThreadpool *threadpool;
 };
 
 static struct Context context = {0};
@@ -96,7 +97,7 @@ static int
 fs_readdir_item(
 		void *buf, struct SqshDirectoryIterator *iterator,
 		fuse_fill_dir_t filler) {
-	struct SqshFile *file = NULL;
+	struct SqshFileStat stat;
 	int rv = 0;
 	char *name = NULL;
 	struct stat stbuf = {0};
@@ -106,17 +107,17 @@ fs_readdir_item(
 		rv = -SQSH_ERROR_MALLOC_FAILED;
 		goto out;
 	}
-	file = sqsh_directory_iterator_open_file(iterator, &rv);
+	const uint64_t inode_ref = sqsh_directory_iterator_inode_ref(iterator);
+	rv = sqsh_file_stat(context.archive, inode_ref, &stat);
 	if (rv < 0) {
 		goto out;
 	}
-	fs_common_getattr(file, NULL, &stbuf);
+	fs_common_stat(&stat, NULL, &stbuf);
 
 	filler(buf, name, &stbuf, 0);
 
 out:
 	free(name);
-	sqsh_close(file);
 	return fs_common_map_err(rv);
 }
 
@@ -159,13 +160,19 @@ out:
 static int
 fs_open(const char *path, struct fuse_file_info *fi) {
 	int rv = 0;
+	struct SqshfsFileHandle *handle = NULL;
 
 	struct SqshFile *file = sqsh_open(context.archive, path, &rv);
 	if (rv < 0) {
 		goto out;
 	}
 
-	fi->fh = (uintptr_t)file;
+	handle = fs_common_file_handle_new(file, &rv);
+	if (rv < 0) {
+		goto out;
+	}
+
+	fi->fh = (uintptr_t)handle;
 
 out:
 	if (rv < 0) {
@@ -179,31 +186,51 @@ fs_read(const char *path, char *buf, size_t size, off_t offset,
 		struct fuse_file_info *fi) {
 	(void)path;
 	int rv = 0;
-	struct SqshFile *file = (struct SqshFile *)(uintptr_t)fi->fh;
-	struct SqshFileReader *reader = NULL;
+	struct SqshfsFileHandle *handle =
+			(struct SqshfsFileHandle *)(uintptr_t)fi->fh;
+	struct SqshfsReadCursor transient_cursor = {0};
+	struct SqshfsReadCursor *cursor = &transient_cursor;
+	const uint8_t *data = NULL;
+	bool locked = false;
 
-	rv = fs_common_read(&reader, file, offset, size);
-	if (rv < 0) {
-		goto out;
+	// See fs3.c: large reads are decompressed in parallel, straight into
+	// the buffer of the request.
+	const struct SqshSuperblock *superblock =
+			sqsh_archive_superblock(context.archive);
+	if (context.threadpool != NULL &&
+		fs_common_read_is_parallel(superblock, offset, size)) {
+		return fs_common_read_mt(
+				handle->file, context.threadpool, offset, size,
+				(uint8_t *)buf);
 	}
 
-	const uint8_t *data = sqsh_file_reader_data(reader);
-	rv = sqsh_file_reader_size(reader);
-	size = rv;
-	memcpy(buf, data, size);
+	// See fs3.c: keep the cursor of the handle for sequential reads, but
+	// don't serialize concurrent reads on the same handle.
+	if (pthread_mutex_trylock(&handle->lock) == 0) {
+		locked = true;
+		cursor = &handle->cursor;
+	}
 
-out:
-	sqsh_file_reader_free(reader);
+	rv = fs_common_read(cursor, handle->file, offset, size, &data);
+	if (rv > 0) {
+		memcpy(buf, data, (size_t)rv);
+	}
 
-	return fs_common_map_err(rv);
+	if (locked) {
+		pthread_mutex_unlock(&handle->lock);
+	}
+	fs_common_read_cursor_cleanup(&transient_cursor);
+
+	return rv;
 }
 
 static int
 fs_release(const char *path, struct fuse_file_info *fi) {
 	(void)path;
-	struct SqshFile *file = (struct SqshFile *)(uintptr_t)fi->fh;
+	struct SqshfsFileHandle *handle =
+			(struct SqshfsFileHandle *)(uintptr_t)fi->fh;
 
-	sqsh_close(file);
+	fs_common_file_handle_free(handle);
 	return 0;
 }
 
@@ -425,6 +452,13 @@ init_context(struct fuse_args *args) {
 		return rv;
 	}
 
+	////////////////////////////////////////
+	// Init threadpool
+	// Created after fuse_daemonize(), as threads don't survive the fork.
+	// Without it, large reads are decompressed on the FUSE thread.
+	int err = 0;
+	context.threadpool = sqsh_threadpool_new(0, &err);
+
 	return 0;
 }
 
@@ -463,6 +497,10 @@ main(int argc, char *argv[]) {
 	}
 
 out:
+	if (options.stats && context.archive != NULL) {
+		fs_common_print_stats(context.archive);
+	}
+	sqsh_threadpool_free(context.threadpool);
 	sqsh_archive_close(context.archive);
 	cleanup_fuse();
 
@@ -36,25 +36,36 @@
 #include <sqshtools_fs_common.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <fuse_lowlevel.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 struct Context {
 	struct SqshArchive *archive;
 	struct SqshInodeMap *inode_map;
+	struct SqshThreadpool *threadpool;
+	// The archive file, used to splice uncompressed data blocks into
+	// replies. -1 if the archive isn't a local file.
+	int archive_fd;
 };
 
 struct FsDirHandle {
 	struct SqshFile *file;
 	struct SqshDirectoryIterator *iterator;
-	char *current_name;
-	struct stat current_stat;
+	// Number of entries that have already been returned to the kernel. This
+	// is also the readdir offset the next request is expected to start at.
+	off_t offset;
+	// Whether the iterator points to an entry that did not fit into the
+	// buffer of the previous request.
+	bool pending;
 };
 
-static struct Context context = {0};
+static struct Context context = {.archive_fd = -1};
 struct fuse_cmdline_opts fuse_options = {0};
 struct SqshfsOptions options = {0};
 
@@ -81,7 +92,13 @@ fs_init(void *userdata, struct fuse_conn_info *conn) {
 	(void)userdata;
 
 	if (conn->capable & FUSE_CAP_PARALLEL_DIROPS) {
-		conn->want = FUSE_CAP_PARALLEL_DIROPS;
+		conn->want |= FUSE_CAP_PARALLEL_DIROPS;
+	}
+	if (conn->capable & FUSE_CAP_READDIRPLUS) {
+		conn->want |= FUSE_CAP_READDIRPLUS;
+	}
+	if (conn->capable & FUSE_CAP_SPLICE_WRITE) {
+		conn->want |= FUSE_CAP_SPLICE_WRITE;
 	}
 }
 
@@ -94,26 +111,34 @@ fs_file_open(fuse_ino_t ino, int *err) {
 	return sqsh_open_by_ref(context.archive, inode_ref, err);
 }
 
+static int
+fs_file_stat(fuse_ino_t ino, struct SqshFileStat *stat) {
+	int rv = 0;
+	const uint64_t inode_ref = fs_common_context_inode_ref(ino, &rv);
+	if (rv < 0) {
+		return rv;
+	}
+	return sqsh_file_stat(context.archive, inode_ref, stat);
+}
+
 static void
 fs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 	(void)fi;
 	int rv = 0;
-	struct SqshFile *file = NULL;
+	struct SqshFileStat stat;
 	const struct SqshSuperblock *superblock =
 			sqsh_archive_superblock(context.archive);
 
-	file = fs_file_open(ino, &rv);
+	rv = fs_file_stat(ino, &stat);
 	if (rv < 0) {
 		fuse_reply_err(req, -fs_common_map_err(rv));
-		goto out;
+		return;
 	}
 
 	struct stat stbuf = {0};
-	fs_common_getattr(file, superblock, &stbuf);
+	fs_common_stat(&stat, superblock, &stbuf);
 
 	fuse_reply_attr(req, &stbuf, 1.0);
-out:
-	sqsh_close(file);
 }
 
 static void
@@ -121,7 +146,7 @@ fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
 	int rv = 0;
 	struct SqshDirectoryIterator *iterator = NULL;
 	struct SqshFile *parent_dir = NULL;
-	struct SqshFile *file = NULL;
+	struct SqshFileStat stat;
 	const struct SqshSuperblock *superblock =
 			sqsh_archive_superblock(context.archive);
 
@@ -140,13 +165,13 @@ fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
 	}
 
 	const uint64_t inode_ref = sqsh_directory_iterator_inode_ref(iterator);
-	file = sqsh_open_by_ref(context.archive, inode_ref, &rv);
+	rv = sqsh_file_stat(context.archive, inode_ref, &stat);
 	if (rv < 0) {
 		fuse_reply_err(req, -fs_common_map_err(rv));
 		goto out;
 	}
 
-	uint32_t inode_number = sqsh_file_inode(file);
+	uint32_t inode_number = stat.inode_number;
 	if (inode_number > sqsh_superblock_inode_count(superblock)) {
 		fuse_reply_err(req, EIO);
 		goto out;
@@ -164,12 +189,11 @@ fs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
 			.entry_timeout = 1.0,
 			.generation = 1,
 	};
-	fs_common_getattr(file, NULL, &entry.attr);
+	fs_common_stat(&stat, NULL, &entry.attr);
 
 	fuse_reply_entry(req, &entry);
 
 out:
-	sqsh_close(file);
 	sqsh_directory_iterator_free(iterator);
 	sqsh_close(parent_dir);
 }
@@ -177,19 +201,15 @@ out:
 static void
 fs_access(fuse_req_t req, fuse_ino_t ino, int mask) {
 	int rv = 0;
-	struct SqshFile *file = NULL;
+	struct SqshFileStat stat;
 
-	file = fs_file_open(ino, &rv);
+	rv = fs_file_stat(ino, &stat);
 	if (rv < 0) {
 		fuse_reply_err(req, -fs_common_map_err(rv));
-		goto out;
+		return;
 	}
 
-	const uint16_t permission = sqsh_file_permission(file);
-	fuse_reply_err(req, permission & mask ? 0 : EACCES);
-
-out:
-	sqsh_close(file);
+	fuse_reply_err(req, stat.permission & mask ? 0 : EACCES);
 }
 
 static void
@@ -253,44 +273,158 @@ out:
 	}
 }
 
-static void
-fs_readdir(
-		fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
-		struct fuse_file_info *fi) {
-	(void)ino;
+static int
+dir_handle_seek(struct FsDirHandle *handle, off_t offset) {
+	int rv = 0;
+
+	if (offset == handle->offset) {
+		return 0;
+	}
 
+	// Directory iterators can't go backwards, start over from the first
+	// entry.
+	if (offset < handle->offset) {
+		sqsh_directory_iterator_free(handle->iterator);
+		handle->iterator = sqsh_directory_iterator_new(handle->file, &rv);
+		if (rv < 0) {
+			return rv;
+		}
+		handle->offset = 0;
+		handle->pending = false;
+	}
+
+	if (handle->pending) {
+		handle->offset++;
+		handle->pending = false;
+	}
+	while (handle->offset < offset &&
+		   sqsh_directory_iterator_next(handle->iterator, &rv)) {
+		handle->offset++;
+	}
+	return rv;
+}
+
+static size_t
+dir_handle_add_entry(
+		fuse_req_t req, struct FsDirHandle *handle, char *buf, size_t size,
+		bool plus, int *err) {
 	int rv = 0;
-	struct FsDirHandle *handle = get_dir_handle(fi);
-	char buf[size];
+	size_t entry_size = 0;
+	struct SqshDirectoryIterator *iterator = handle->iterator;
+	struct SqshFileStat stat;
+	struct fuse_entry_param entry = {
+			.attr_timeout = 1.0,
+			.entry_timeout = 1.0,
+			.generation = 1,
+	};
+	const off_t next_offset = handle->offset + 1;
 
-	bool has_next = sqsh_directory_iterator_next(handle->iterator, &rv);
+	char *name = sqsh_directory_iterator_name_dup(iterator);
+	if (name == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+
+	if (plus == false) {
+		entry.attr.st_ino = fs_common_inode_sqsh_to_ino(
+				sqsh_directory_iterator_inode(iterator));
+		entry.attr.st_mode = fs_common_mode_type(
+				sqsh_directory_iterator_file_type(iterator));
+		entry_size = fuse_add_direntry(
+				req, buf, size, name, &entry.attr, next_offset);
+		goto out;
+	}
+
+	const uint64_t inode_ref = sqsh_directory_iterator_inode_ref(iterator);
+	rv = sqsh_file_stat(context.archive, inode_ref, &stat);
 	if (rv < 0) {
-		fuse_reply_err(req, -fs_common_map_err(rv));
 		goto out;
-	} else if (has_next == false) {
-		fuse_reply_buf(req, NULL, 0);
+	}
+	const uint32_t inode_number = stat.inode_number;
+	rv = sqsh_inode_map_set2(context.inode_map, inode_number, inode_ref);
+	if (rv < 0) {
 		goto out;
 	}
+	entry.ino = fs_common_inode_sqsh_to_ino(inode_number);
+	fs_common_stat(&stat, NULL, &entry.attr);
+	entry_size = fuse_add_direntry_plus(
+			req, buf, size, name, &entry, next_offset);
 
-	handle->current_stat.st_ino = fs_common_inode_sqsh_to_ino(
-			sqsh_directory_iterator_inode(handle->iterator));
+out:
+	free(name);
+	*err = rv;
+	return entry_size;
+}
 
-	handle->current_stat.st_mode = fs_common_mode_type(
-			sqsh_directory_iterator_file_type(handle->iterator));
-	handle->current_name = sqsh_directory_iterator_name_dup(handle->iterator);
-	if (handle->current_name == NULL) {
-		fuse_reply_err(req, ENOMEM);
+static void
+dir_handle_read(
+		fuse_req_t req, size_t size, off_t offset, struct fuse_file_info *fi,
+		bool plus) {
+	int rv = 0;
+	struct FsDirHandle *handle = get_dir_handle(fi);
+	size_t buf_size = 0;
+	char *buf = malloc(size);
+
+	if (buf == NULL) {
+		rv = -SQSH_ERROR_MALLOC_FAILED;
+		goto out;
+	}
+
+	rv = dir_handle_seek(handle, offset);
+	if (rv < 0) {
 		goto out;
 	}
-	size_t result_size = fuse_add_direntry(
-			req, buf, size, handle->current_name, &handle->current_stat,
-			offset);
-	free(handle->current_name);
 
-	fuse_reply_buf(req, buf, result_size);
+	// Fill the buffer with as many entries as possible. An entry that
+	// doesn't fit stays pending and is returned by the next request.
+	for (;;) {
+		if (handle->pending == false) {
+			bool has_next = sqsh_directory_iterator_next(handle->iterator, &rv);
+			if (rv < 0) {
+				goto out;
+			} else if (has_next == false) {
+				break;
+			}
+			handle->pending = true;
+		}
+
+		const size_t remaining = size - buf_size;
+		const size_t entry_size = dir_handle_add_entry(
+				req, handle, &buf[buf_size], remaining, plus, &rv);
+		if (rv < 0) {
+			goto out;
+		} else if (entry_size > remaining) {
+			break;
+		}
+		buf_size += entry_size;
+		handle->offset++;
+		handle->pending = false;
+	}
 
 out:
-	return;
+	// Errors after the first entry are reported by the next request.
+	if (rv < 0 && buf_size == 0) {
+		fuse_reply_err(req, -fs_common_map_err(rv));
+	} else {
+		fuse_reply_buf(req, buf, buf_size);
+	}
+	free(buf);
+}
+
+static void
+fs_readdir(
+		fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+		struct fuse_file_info *fi) {
+	(void)ino;
+	dir_handle_read(req, size, offset, fi, false);
+}
+
+static void
+fs_readdirplus(
+		fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+		struct fuse_file_info *fi) {
+	(void)ino;
+	dir_handle_read(req, size, offset, fi, true);
 }
 
 static void
@@ -304,9 +438,15 @@ fs_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 	fuse_reply_err(req, 0);
 }
 
+static struct SqshfsFileHandle *
+get_file_handle(struct fuse_file_info *fi) {
+	return (struct SqshfsFileHandle *)(uintptr_t)fi->fh;
+}
+
 static void
 fs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 	struct SqshFile *file = NULL;
+	struct SqshfsFileHandle *handle = NULL;
 
 	int rv = 0;
 
@@ -315,7 +455,12 @@ fs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 		fuse_reply_err(req, EIO);
 		goto out;
 	}
-	fi->fh = (uintptr_t)file;
+	handle = fs_common_file_handle_new(file, &rv);
+	if (rv < 0) {
+		fuse_reply_err(req, ENOMEM);
+		goto out;
+	}
+	fi->fh = (uintptr_t)handle;
 	file = NULL;
 	fuse_reply_open(req, fi);
 out:
@@ -325,34 +470,104 @@ out:
 static void
 fs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 	(void)ino;
-	struct SqshFile *file = (struct SqshFile *)(uintptr_t)fi->fh;
+	struct SqshfsFileHandle *handle = get_file_handle(fi);
 
-	sqsh_close(file);
+	fs_common_file_handle_free(handle);
 	fuse_reply_err(req, 0);
 }
 
+static bool
+fs_read_uncompressed(
+		fuse_req_t req, struct SqshfsFileHandle *handle,
+		const struct SqshSuperblock *superblock, size_t size, off_t offset) {
+	uint64_t address = 0;
+
+	if (context.archive_fd < 0) {
+		return false;
+	}
+	int rv = fs_common_read_uncompressed(
+			handle->file, superblock, offset, size, &address);
+	if (rv <= 0) {
+		return false;
+	}
+
+	// Point the reply at the archive file, so the kernel can splice the
+	// data instead of it being copied through userspace buffers.
+	struct fuse_bufvec bufvec = FUSE_BUFVEC_INIT((size_t)rv);
+	bufvec.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	bufvec.buf[0].fd = context.archive_fd;
+	bufvec.buf[0].pos = (off_t)(options.offset + address);
+	fuse_reply_data(req, &bufvec, 0);
+	return true;
+}
+
+static void
+fs_read_mt(
+		fuse_req_t req, struct SqshfsFileHandle *handle, size_t size,
+		off_t offset) {
+	int rv = 0;
+	uint8_t *buffer = malloc(size);
+	if (buffer == NULL) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+
+	rv = fs_common_read_mt(
+			handle->file, context.threadpool, offset, size, buffer);
+	if (rv < 0) {
+		fuse_reply_err(req, -rv);
+	} else {
+		fuse_reply_buf(req, (const char *)buffer, (size_t)rv);
+	}
+	free(buffer);
+}
+
 static void
 fs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
 		struct fuse_file_info *fi) {
 	(void)ino;
-	struct SqshFile *file = (struct SqshFile *)(uintptr_t)fi->fh;
+	struct SqshfsFileHandle *handle = get_file_handle(fi);
+	struct SqshfsReadCursor transient_cursor = {0};
+	struct SqshfsReadCursor *cursor = &transient_cursor;
+	const uint8_t *data = NULL;
+	bool locked = false;
 	int rv = 0;
-	struct SqshFileReader *reader = NULL;
 
-	rv = fs_common_read(&reader, file, offset, size);
+	// Data that is stored uncompressed is handed to the kernel as is.
+	// Large reads of compressed data span several blocks. Decompress
+	// those in parallel instead of one after another on this thread.
+	const struct SqshSuperblock *superblock =
+			sqsh_archive_superblock(context.archive);
+	if (fs_read_uncompressed(req, handle, superblock, size, offset)) {
+		return;
+	}
+	if (context.threadpool != NULL &&
+		fs_common_read_is_parallel(superblock, offset, size)) {
+		fs_read_mt(req, handle, size, offset);
+		return;
+	}
+
+	// Reuse the cursor of the handle for sequential reads. If another
+	// thread is currently reading from the same handle, don't wait for it
+	// and use a short-lived cursor instead.
+	if (pthread_mutex_trylock(&handle->lock) == 0) {
+		locked = true;
+		cursor = &handle->cursor;
+	}
+
+	rv = fs_common_read(cursor, handle->file, offset, size, &data);
 	if (rv < 0) {
+		fuse_reply_err(req, -rv);
 		goto out;
 	}
 
-	const uint8_t *data = sqsh_file_reader_data(reader);
-	const size_t data_size = sqsh_file_reader_size(reader);
-	fuse_reply_buf(req, (const char *)data, data_size);
+	fuse_reply_buf(req, (const char *)data, (size_t)rv);
 
 out:
-	if (rv < 0) {
-		fuse_reply_err(req, -fs_common_map_err(rv));
+	if (locked) {
+		pthread_mutex_unlock(&handle->lock);
 	}
-	sqsh_file_reader_free(reader);
+	fs_common_read_cursor_cleanup(&transient_cursor);
 }
 
 static void
@@ -472,6 +687,7 @@ static const struct fuse_lowlevel_ops fs_oper = {
 		.readlink = fs_readlink,
 		.opendir = fs_opendir,
 		.readdir = fs_readdir,
+		.readdirplus = fs_readdirplus,
 		.releasedir = fs_releasedir,
 		.open = fs_open,
 		.release = fs_release,
@@ -534,6 +750,11 @@ main(int argc, char *argv[]) {
 		goto out;
 	}
 
+	// Archives fetched through a URL are not backed by a local file.
+	if (strstr(options.archive, "://") == NULL) {
+		context.archive_fd = open(options.archive, O_RDONLY);
+	}
+
 	fuse_session = fuse_session_new(&args, &fs_oper, sizeof(fs_oper), NULL);
 	if (fuse_session == NULL) {
 		goto out;
@@ -561,6 +782,12 @@ main(int argc, char *argv[]) {
 		goto out;
 	}
 
+	// The threads of the pool would not survive the fork in
+	// fuse_daemonize(), so the pool is created afterwards. Without it,
+	// large reads are decompressed on the FUSE worker thread.
+	int err = 0;
+	context.threadpool = sqsh_threadpool_new(0, &err);
+
 	if (fuse_options.singlethread)
 		rv = fuse_session_loop(fuse_session);
 	else {
@@ -578,6 +805,13 @@ out:
 	}
 	free(fuse_options.mountpoint);
 	fuse_opt_free_args(&args);
+	if (options.stats && context.archive != NULL) {
+		fs_common_print_stats(context.archive);
+	}
+	sqsh_threadpool_free(context.threadpool);
+	if (context.archive_fd >= 0) {
+		close(context.archive_fd);
+	}
 	sqsh_archive_close(context.archive);
 
 	return rv;